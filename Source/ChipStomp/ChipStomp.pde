@@ -35,9 +35,10 @@
 #include "config.h"
 
 // Include the font's you want here
-#include "LiberationSans10.c"
+// fonts.inc is LiberationSans10 and DejaVuSans12 cut down to the characters
+// the sources print. Regenerate it with make in Source/HostSim
+#include "fonts.inc"
 // #include "LiberationMono11.c"
-#include "DejaVuSans12.c"
 
 // Make an array of pointers to FONT_INFOs for each font that you want
 // Don't forget to put a NULL at the end
@@ -56,45 +57,101 @@ const FONT_INFO *g_font_table[] = {
 #include "effect_bitcrush.h"
 #include "effect_dummy.h"
 #include "effect_pitchshift.h"
+#include "effect_distortion.h"
+#include "effect_filter.h"
+#include "effect_compressor.h"
+#include "effect_reverb.h"
+#include "effect_chorus.h"
 // #include "effect_sinus.h"
-
-// Effects stack : Important that the last one is NULL so that we are a the end.
-Effect_t *g_effects[] = {
-			&effect_Tremolo
-		, &effect_Flanger
-		, &effect_Pitchshift
-		, &effect_Bitcrush
-		, &effect_Echo
-		// , &effect_Sinus
+// Delay lines for the effects are shared out of this
+#include "delay_arena.h"
+// Button and encoder events from cn_isr
+#include "input_queue.h"
+// Crossfades effects in and out. Used by isr.pde
+#include "effect_bypass.h"
+// Fixed point maths shared with the effects. Used by isr.pde
+#include "dsp_fixed.h"
+// Speeds the encoder up when it's turned quickly
+#include "encoder_accel.h"
+// Saved effect settings in flash
+#include "preset.h"
+// The order the ISR runs the effects in
+#include "effect_slots.h"
+
+// Every effect there is : Important that the last one is NULL so that we are a the end.
+// setup() puts one of each in the chain in this order. Presets refer to
+// effects by their position here so only ever add to the end.
+const EffectCreate_t g_effectTypes[] = {
+			tremolo_create
+		, flng_create
+		, pitch_create
+		, bitcrush_create
+		, echo_create
+		, dist_create
+		, filt_create
+		, comp_create
+		, revb_create
+		, chor_create
+		// , sinus_create
 		, NULL
 	};
 
-// TODO : Create a distortion effect with configuable threshold, shoft/hard clipping.
+#if STATIC_CHAIN
+// Compile time version of the chain setup() builds. Must be the same effects in the same order.
+#include "effect_chain.h"
+typedef ChainStage<tremolo_process, 0,
+	ChainStage<flng_process, 1,
+	ChainStage<pitch_process, 2,
+	ChainStage<bitcrush_process, 3,
+	ChainStage<echo_process, 4,
+	ChainStage<dist_process, 5,
+	ChainStage<filt_process, 6,
+	ChainStage<comp_process, 7,
+	ChainStage<revb_process, 8,
+	ChainStage<chor_process, 9> > > > > > > > > > StaticChain_t;
+#endif
+// Bit N set when the effect in slot N is on. Used by the static chain
+volatile uint32_t g_chainMask;
+
 // TODO : Add a metronome effect (last in the chain) with config bpm/volume.
 // TODO : Improve input sampling by oversampling (running ADC at faster rate then averaging the results)
-// TODO : Add "cost" to each effect (measured using LA) to allow user to select effects that fit withing the overall CPU budget.
-// TODO : Allow user to change order or load-out of effects to allow duplication of effects?
-// TODO : Allow user to save their current config and effect values. Provide interface to load these saves.
-// TODO : Bandpass|HP|LP filters? Might be too CPU intensive to run concurrent with other effects. (Hence need for cost/budget)
 
 // Digilent hardware SPI library
 DSPI0 spi;
 // OLED Driver : Uses Adafruit GFX library
 Catmacey_SH1106 display(OLED_DC, OLED_RESET, OLED_CS, &spi, g_font_table);
 
-// Global for holding the state of the various inputs
-InputState_t g_input;
+// Input events from cn_isr to the main loop
+InputQueue_t g_input;
 // Global struct for holding VU values. Used by both ISR and main()
 volatile VUMeter_t g_meter;
 
+#if BLOCKSIZE > 1
+// Block mode DMA ping-pong buffers. See isr.pde
+volatile int32_t g_adc_block[2 * BLOCKSIZE];
+volatile uint8_t g_dac_hi[2 * BLOCKSIZE];
+volatile uint8_t g_dac_lo[2 * BLOCKSIZE];
+#endif
+
 // USed for managing the input 
-enum btnmode_t {START, TOGGLE, HOLD};
+enum btnmode_t {START, TOGGLE, HOLD, PRESET, SELECT, ARRANGE};
 // Only used for debugging above
-const char *btnmode_str[] = {"Nada","Toggle","Hold"};
+const char *btnmode_str[] = {"Nada","Toggle","Hold","Preset","Select","Arrange"};
+// What happened to the preset picked in PRESET mode
+enum presetstatus_t {PRESET_PICK, PRESET_SAVED, PRESET_FAILED};
+// What the last change to the chain in ARRANGE mode was
+enum arrangestatus_t {ARRANGE_MOVED, ARRANGE_COPIED, ARRANGE_REMOVED, ARRANGE_FAILED};
 
 
 // Arduino setup routine
 void setup() {
+	uint16_t idx;
+
+	// Default chain : One of each effect, all off
+	for(idx=0; g_effectTypes[idx] != NULL; idx++){
+		slots_add(idx);
+	}
+
 	// set the digital pin as output:
 	mPORTASetPinsDigitalOut(DACHI_BIT | CLIP_BIT | OLEDRES_BIT);
 	mPORTBSetPinsDigitalOut(OLEDCS_BIT | MOSI_BIT | OLEDDC_BIT | DACLO_BIT | SCLK_BIT);
@@ -142,6 +199,7 @@ void setup() {
 	AD1CON3bits.ADCS = 0x01;
 	EnableADC10();
 
+#if BLOCKSIZE == 1
 	// Setup timer to trigger ISR for main processing routine.
 	// Timer is set to the desired sample rate (eg. 44.1khz)
 	ConfigIntTimer1(T1_INT_ON | T1_INT_PRIOR_3);
@@ -150,6 +208,38 @@ void setup() {
 	// Set the default duty cycles for the PWMs
 	SetDCOC4PWM(0x7f); 
 	SetDCOC2PWM(0xff); 
+#else
+	// Block mode : See isr.pde
+	// Start with silence in both halves of the output
+	for(idx=0; idx < 2 * BLOCKSIZE; idx++){
+		g_dac_hi[idx] = 0x7f;
+		g_dac_lo[idx] = 0xff;
+	}
+	// Output DMAs : one byte per Timer1 event into each duty cycle register
+	DmaChnOpen(DMA_CHANNEL1, DMA_CHN_PRI3, DMA_OPEN_AUTO);
+	DmaChnSetEventControl(DMA_CHANNEL1, DMA_EV_START_IRQ_EN | DMA_EV_START_IRQ(_TIMER_1_IRQ));
+	DmaChnSetTxfer(DMA_CHANNEL1, (void*)g_dac_hi, (void*)&OC4RS, 2 * BLOCKSIZE, 1, 1);
+	DmaChnOpen(DMA_CHANNEL2, DMA_CHN_PRI3, DMA_OPEN_AUTO);
+	DmaChnSetEventControl(DMA_CHANNEL2, DMA_EV_START_IRQ_EN | DMA_EV_START_IRQ(_TIMER_1_IRQ));
+	DmaChnSetTxfer(DMA_CHANNEL2, (void*)g_dac_lo, (void*)&OC2RS, 2 * BLOCKSIZE, 1, 1);
+	// Input DMA : Latest ADC result into the ping-pong buffer, interrupt at each half
+	DmaChnOpen(DMA_CHANNEL0, DMA_CHN_PRI3, DMA_OPEN_AUTO);
+	DmaChnSetEventControl(DMA_CHANNEL0, DMA_EV_START_IRQ_EN | DMA_EV_START_IRQ(_TIMER_1_IRQ));
+	DmaChnSetTxfer(DMA_CHANNEL0, (void*)&ADC1BUF0, (void*)g_adc_block, 4, sizeof(g_adc_block), 4);
+	DmaChnSetEvEnableFlags(DMA_CHANNEL0, DMA_EV_DST_HALF_FULL | DMA_EV_DST_FULL);
+	INTSetVectorPriority(INT_VECTOR_DMA(DMA_CHANNEL0), INT_PRIORITY_LEVEL_3);
+	INTSetVectorSubPriority(INT_VECTOR_DMA(DMA_CHANNEL0), INT_SUB_PRIORITY_LEVEL_0);
+	INTClearFlag(INT_SOURCE_DMA(DMA_CHANNEL0));
+	INTEnable(INT_SOURCE_DMA(DMA_CHANNEL0), INT_ENABLED);
+	DmaChnEnable(DMA_CHANNEL1);
+	DmaChnEnable(DMA_CHANNEL2);
+	DmaChnEnable(DMA_CHANNEL0);
+
+	// Timer1 sets the sample rate but doesn't interrupt. Its flag still
+	// raises the IRQ event that starts each DMA cell transfer.
+	ConfigIntTimer1(T1_INT_OFF | T1_INT_PRIOR_3);
+	OpenTimer1(T1_ON | T1_PS_1_1, F_CPU / SAMPLERATE);
+#endif
 	
 
 	// Setup hardware SPI. Not we're not using MISO
@@ -158,6 +248,8 @@ void setup() {
  	
  	// Initialize the OLED using the internal DC/DC convertor
 	display.begin();
+	// Let the loop flush the display by DMA. See isr.pde
+	display.beginAsync((p32_spi *)_DSPI0_BASE, _DSPI0_TX_IRQ, OLED_DMA);
 	// Load the spashscreen into the displaybuffer
 	display.drawBitmap(0, 0, g_splashscreen, 128, 64, 1);
 	display.display(); // show splashscreen
@@ -176,17 +268,28 @@ void loop() {
 	uint8_t idx = 0;
 	uint8_t effectCount = 0;
 	uint8_t somethinghappened = false;
+	uint8_t redraw = false; // Display buffer has changed since the last flush
+	uint32_t now, nextframe = 0; // millis() the meters are next due
+	uint16_t overbudget = 0; // Cycles wanted by an effect or feature refused as it won't fit in the CPU budget
+	uint16_t cost;
+	uint8_t outofmemory = false; // Set when an effect was refused as there's no delay memory for it
+	uint8_t retired; // arena_retire() flags
 	int tmp, addr = 0;
 	
 	uint16_t ctr;
 
 	btnmode_t mode = START;  // Default button mode
+	uint8_t presetIdx = 0; // Preset picked by turning the encoder with the effect button held
+	uint8_t presetstatus = PRESET_PICK; // presetstatus_t
+	uint8_t arrangestatus = ARRANGE_MOVED; // arrangestatus_t
 	char buff[100];
 	Effect_t *currentEffect;
-	Effect_t **currentAddr = &g_effects[0]; // Get Ptr2ptr in array pos zero
 	// Start with currentEffect as first one
-	currentEffect = *currentAddr;
-	InputState_t input;
+	currentEffect = slots_chain()[0];
+	InputState_t input; // What this pass acts on
+	InputEvent_t event;
+	EncoderAccel_t accel = {0, 0, 0}; // Encoder speed between events
+	uint8_t curve;
 
 	mPORTAToggleBits(CLIP_BIT);
 	display.setTextColor(1);
@@ -206,9 +309,36 @@ void loop() {
 	somethinghappened = true;
 
 	// Loop here. Not using the Arduino loop().
+	input.btn_state.complete = 0;
 	while(1){
-		// Grab a copy : It changes fast
-		input = g_input;
+		// Take the queued events in order. A run of encoder steps is added up
+		// into one delta. A button change is taken on its own, and only once
+		// the steps before it have been acted on, so the order is kept.
+		// Each step is weighted by how fast the knob was turning using the
+		// current feature's curve.
+		input.encoder = 0;
+		input.btn_diff.complete = 0;
+		// Effects that have finished fading out give their memory back, and
+		// those waiting for it come on. Or are refused if it's not enough
+		retired = arena_retire(slots_chain());
+		if(retired & ARENA_CHANGED) updateChainMask();
+		if(retired & ARENA_REFUSED){
+			outofmemory = true;
+			somethinghappened = true;
+		}
+		curve = currentEffect->curves ? currentEffect->curves[currentEffect->featureIdx] : ENC_CURVE_NONE;
+		while(input_peek(&g_input, &event)){
+			if(event.type == INPUT_BUTTONS){
+				if(input.encoder == 0){
+					input.btn_state = event.btn_state;
+					input.btn_diff = event.btn_diff;
+					input_pop(&g_input);
+				}
+				break;
+			}
+			input.encoder += encoder_accel(&accel, &event, curve);
+			input_pop(&g_input);
+		}
 		if(input.btn_diff.complete){
 			/*
 				TODO: Would like to add a timeout so that if the Effect
@@ -218,11 +348,6 @@ void loop() {
 				Could maybe also have a timeout for the Effect's featureIdx.
 				After a period of no input it would reset to the dummy feature (0)
 			*/ 
-			/*
-				TODO: Might be useful to add some sort of "acceleration" factor
-				to the input from the encoder. It takes ages to go from end to end 
-				of the scale. Maybe if the encoder delta is > X we double it?
-			*/
 			switch(mode){
 				case TOGGLE:
 				case HOLD:{
@@ -231,16 +356,14 @@ void loop() {
 						if(mode == HOLD){
 							// No other button was pressed
 							// Serial.println("Switch");
-							// Each press should cycle through the available g_effects
+							// Each press should cycle through the effects in the chain
 							//Serial.print("Switch Effect to ");
-							currentAddr++;
-							if(*currentAddr == 0){
-								currentAddr = &g_effects[0];
+							idx = slots_find(currentEffect) + 1;
+							if(slots_chain()[idx] == NULL){
+								idx = 0;
 							}
-							currentEffect = *currentAddr;
+							currentEffect = slots_chain()[idx];
 							// Serial.println(currentEffect->name);
-							// sprintf(buff, "currentEffect size:%d, addr:%p, ptrAddr:%x \n", sizeof(*currentEffect), currentEffect, *currentAddr);
-							// Serial.println(buff);
 							// Flag that something has happened
 							somethinghappened = true;        
 						}
@@ -248,7 +371,12 @@ void loop() {
 					}else if(input.btn_diff.select & !input.btn_state.select){
 						// Released the select button
 						//Serial.println("Toggle");
-						currentEffect->toggleOnOff();
+						if(slots_budgetAllows(currentEffect)){
+							if(!arena_toggle(currentEffect)) outofmemory = true;
+							updateChainMask();
+						}else{
+							overbudget = currentEffect->cost;
+						}
 						//Serial.print(currentEffect->name);
 						//Serial.println(currentEffect->state?" ON":" OFF");
 						// Switch mode to indicate that we've done this
@@ -259,18 +387,64 @@ void loop() {
 
 					break;
 				}
+				case PRESET:{
+					// Effect button held and the encoder turned to pick a preset
+					if(input.btn_diff.select & !input.btn_state.select){
+						// Released the select button : Keep the current sound in the preset
+						presetstatus = preset_save(presetIdx) ? PRESET_SAVED : PRESET_FAILED;
+						somethinghappened = true;
+					}else if(input.btn_diff.effect & !input.btn_state.effect){
+						// Released the effect button : Load the preset, unless we just saved it
+						// Any effect it couldn't turn on is reported like a toggle would be
+						if(presetstatus == PRESET_PICK && preset_recall(presetIdx, &overbudget, &outofmemory)){
+							updateChainMask();
+						}
+						mode = START;
+						somethinghappened = true;
+					}
+					break;
+				}
+				case SELECT:
+				case ARRANGE:{
+					// Select button held. Turning the encoder moves the effect
+					// along the chain, the effect button copies it
+					if(input.btn_diff.select & !input.btn_state.select){
+						// Released the select button
+						if(mode == SELECT){
+							// Nothing else happened
+							//Serial.println("Next feature");
+							currentEffect->nextFeature(currentEffect);
+						}
+						mode = START;
+						somethinghappened = true;
+					}else if(input.btn_diff.effect & input.btn_state.effect){
+						// Pressed the effect button : Copy the effect, or take
+						// away a copy that is off so a second press undoes the first
+						idx = slots_find(currentEffect);
+						if(slots_remove(currentEffect)){
+							if(slots_chain()[idx] == NULL) idx--;
+							currentEffect = slots_chain()[idx];
+							arrangestatus = ARRANGE_REMOVED;
+						}else if(Effect_t *copy = slots_duplicate(currentEffect)){
+							currentEffect = copy;
+							arrangestatus = ARRANGE_COPIED;
+						}else{
+							arrangestatus = ARRANGE_FAILED;
+						}
+						mode = ARRANGE;
+						somethinghappened = true;
+					}
+					break;
+				}
 				case START:{
 					// No other buttons held : This is the start of something.
 					if(input.btn_diff.effect & input.btn_state.effect & !input.btn_state.select){
 						// Pressed the effect button (ignore if select is pressed)
 						mode = HOLD;
 					}
-					if(input.btn_diff.select & input.btn_state.select){
-						// Released the select button
-						//Serial.println("Next feature");
-						currentEffect->nextFeature();
-						// Flag that something has happened
-						somethinghappened = true;
+					if(input.btn_diff.select & input.btn_state.select & !input.btn_state.effect){
+						// Pressed the select button. Acted on when it's released
+						mode = SELECT;
 					}
 
 
@@ -279,27 +453,35 @@ void loop() {
 			}
 			//sprintf(buff, "Now Mode:%d:%s", mode, btnmode_str[mode]);
 			//Serial.println(buff);
-
-			// Need to clear btn_diff once you've "used" it
-			g_input.btn_diff.complete = 0;
-			
 		}
-		if(input.encoder.value != 0){
+		if(input.encoder != 0){
 			//Serial.print("Encoder:");
-			//Serial.print(input.encoder.value, DEC);
-			input.encoder.value *= abs(input.encoder.value);
-			//Serial.print(" : ");
-			//Serial.println(input.encoder.value, DEC);
+			//Serial.print(input.encoder, DEC);
 			// Encoder has been twiddled
-			if(input.btn_state.effect){
-				// Choose effect
-				// lfo_step_alter(input.encoder.value);
+			if(mode == SELECT || mode == ARRANGE){
+				// Move the effect one slot along the chain
+				slots_move(currentEffect, input.encoder > 0 ? 1 : -1);
+				mode = ARRANGE;
+				arrangestatus = ARRANGE_MOVED;
+			}else if(input.btn_state.effect){
+				// Choose a preset. The first turn just shows the last one picked
+				if(mode == PRESET){
+					presetIdx = (presetIdx + PRESET_COUNT + (input.encoder > 0 ? 1 : -1)) % PRESET_COUNT;
+					presetstatus = PRESET_PICK;
+				}else if(mode == HOLD){
+					mode = PRESET;
+					presetstatus = PRESET_PICK;
+				}
 			}else{
-				currentEffect->adjustFeature(input.encoder.value);
+				cost = currentEffect->cost;
+				currentEffect->adjustFeature(currentEffect, input.encoder);
+				// A feature can cost more (the distortion's oversampling). Undo it if the running chain no longer fits
+				if(currentEffect->cost > cost && currentEffect->state && slots_cost() > CYCLE_BUDGET){
+					overbudget = currentEffect->cost - cost;
+					currentEffect->adjustFeature(currentEffect, -input.encoder);
+				}
 			}
 
-			// Set the value to zero once used
-			g_input.encoder.value = 0;
 			// Flag that something has happened
 			somethinghappened = true;
 		}
@@ -308,72 +490,92 @@ void loop() {
 			// Output a report of current state
 			// The first line is the same for all effects
 			display.clearDisplay();
-			display.setCursor(0,DISP_FEAT_INDENT);
-			display.setTextColor(1);
-			display.setFont(1);
-			display.print(currentEffect->name);
-			display.setFont(0);
-			display.drawFastHLine(0,17,DISP_FEAT_W,1);
-			if(currentEffect->state){
-				display.setTextColor(0);
-				display.fillRect(98,0,25,18,1);
-				display.setCursor(105,2);
-				display.print("on");
+			if(mode == PRESET){
+				reportPreset(presetIdx, presetstatus);
+			}else if(mode == ARRANGE){
+				reportChain(currentEffect, arrangestatus);
 			}else{
-				display.drawRect(98,0,25,18,1);
-				display.setCursor(103,2);
-				display.print("off");
+				display.setCursor(0,DISP_FEAT_INDENT);
+				display.setTextColor(1);
+				display.setFont(1);
+				printEffectName(currentEffect);
+				display.setFont(0);
+				display.drawFastHLine(0,17,DISP_FEAT_W,1);
+				if(effect_isOn(currentEffect)){
+					display.setTextColor(0);
+					display.fillRect(98,0,25,18,1);
+					display.setCursor(105,2);
+					display.print("on");
+				}else{
+					display.drawRect(98,0,25,18,1);
+					display.setCursor(103,2);
+					display.print("off");
+				}
+				display.setTextColor(1);
+				// Other lines are specifc to the effect and its internal settings
+				display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y);
+				//display.setTextSize(1);
+				if(overbudget){
+					// Show why the effect didn't turn on until the next input
+					reportBudget(overbudget);
+					overbudget = 0;
+				}else if(outofmemory){
+					reportMemory();
+					outofmemory = false;
+				}else{
+					currentEffect->report(currentEffect);
+				}
 			}
-			display.setTextColor(1);
-			// Other lines are specifc to the effect and its internal settings
-			display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y);
-			//display.setTextSize(1);
-			currentEffect->report();
 			somethinghappened = false;
+			redraw = true;
 		}
 
-		// Render the VU bars
-		renderVU();
+		// The meters move all the time so they are redrawn on a fixed deadline
+		now = millis();
+		if((int32_t)(now - nextframe) >= 0){
+			renderVU();
+			redraw = true;
+			nextframe += VU_FRAME_MS;
+			// Don't try to catch up after a long redraw
+			if((int32_t)(now - nextframe) >= 0) nextframe = now + VU_FRAME_MS;
+			mPORTBToggleBits(BIT_2);
+		}
 
-		// Now render the whole display buffer
-		display.display();
+		// Start sending what changed. The DMA does it while we carry on
+		// If the last frame is still going, try again next time round
+		if(redraw && display.displayAsync()) redraw = false;
 
-		delay(35);
-		mPORTBToggleBits(BIT_2);
+		// Nothing to do until an interrupt : input, audio, the display DMA
+		// or the millis() tick. The audio one comes every sample (or block)
+		// so an input that lands just before this waits at most that long.
+		// The memory clobber makes the loop re-read what the ISRs changed.
+		if((!redraw || display.isFlushing()) && input_empty(&g_input)){
+			asm volatile("wait" ::: "memory");
+		}
 	} //while
 }
 
 // Render the input and output V meters
+// The bars are RMS and the marker the held peak. The ISR keeps both up to
+// date every sample. See vu_track() in isr.pde
 void renderVU(){
-	uint8_t idx, yi, yo, ypo, ypi;
-	uint32_t sum_out, sum_in;
-
-	sum_in = 0;
-	sum_out = 0;
-	// First do the averaging
-	for(idx=0; idx < VUTICKLEN; idx++){
-		sum_in += abs(g_meter.input[idx]);
-		sum_out += abs(g_meter.output[idx]);
-	}
+	uint8_t yi, yo, ypo, ypi;
+	uint32_t sum_out, sum_in, peak_in, peak_out;
+
+	// Each level is one word so reading it can't catch the ISR half way
+	sum_in = isqrt(g_meter.input.power);
+	sum_out = isqrt(g_meter.output.power);
+	peak_in = g_meter.input.peak >> 15;
+	peak_out = g_meter.output.peak >> 15;
 
-	sum_in /= VUTICKLEN;
-	sum_out /= VUTICKLEN;
-	// The sums should now contain an average of the last N samples
 	// Scale is 15bits (half a 16bit signed int)
 	// Shift them down to 6 bits to fit in vertical scale of screen
-	sum_in >>= 9;
-	sum_out >>= 9;
+	sum_in = vuScale(sum_in);
+	sum_out = vuScale(sum_out);
 	yi = 63-sum_in;
 	yo = 63-sum_out;
-
-	if(sum_in > g_meter.peak_in) g_meter.peak_in = sum_in;
-	else if(g_meter.peak_in > 1) g_meter.peak_in-=2;
-
-	if(sum_out > g_meter.peak_out) g_meter.peak_out = sum_out;
-	else if(g_meter.peak_out > 1) g_meter.peak_out-=2;
-
-	ypi = 63-g_meter.peak_in;
-	ypo = 63-g_meter.peak_out;
+	ypi = 63-vuScale(peak_in);
+	ypo = 63-vuScale(peak_out);
 
 	// Clear space
 	display.drawFastVLine(124,0,63,0);
@@ -392,6 +594,149 @@ void renderVU(){
 }
 
 
+// Rebuilds g_chainMask from the effect states
+void updateChainMask(){
+	uint32_t mask = 0;
+	uint8_t bit = 0;
+	Effect_t * const *currentAddr = slots_chain();
+	while(*currentAddr != NULL){
+		if((*currentAddr)->state) mask |= (1 << bit);
+		bit++;
+		currentAddr++;
+	}
+	g_chainMask = mask;
+}
+
+// Explains why an effect or feature needing cost cycles was refused
+void reportBudget(uint16_t cost){
+	display.setTextColor(0);
+	display.fillRect(0,DISP_FEAT_Y,DISP_FEAT_W,13,1);
+	display.print("Over CPU budget!");
+	display.setTextColor(1);
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
+	display.print("Needs ");
+	display.print(cost, DEC);
+	display.print(" cycles");
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+28);
+	display.print("Free ");
+	display.print(CYCLE_BUDGET - slots_cost(), DEC);
+	display.print(" of ");
+	display.print(CYCLE_BUDGET, DEC);
+}
+
+// Shows the preset picked while the effect button is held
+void reportPreset(uint8_t slot, uint8_t status){
+	display.setCursor(0,DISP_FEAT_INDENT);
+	display.setTextColor(1);
+	display.setFont(1);
+	display.print("Preset ");
+	display.print(slot + 1, DEC);
+	display.setFont(0);
+	display.drawFastHLine(0,17,DISP_FEAT_W,1);
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y);
+	if(status == PRESET_SAVED){
+		display.print("Saved");
+	}else if(status == PRESET_FAILED){
+		display.setTextColor(0);
+		display.fillRect(0,DISP_FEAT_Y,DISP_FEAT_W,13,1);
+		display.print("Save failed!");
+		display.setTextColor(1);
+	}else if(preset_used(slot)){
+		display.print("Release to load");
+	}else{
+		display.print("Empty");
+	}
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
+	display.print("Select to save");
+}
+
+// Shows the slots around the effect while it is moved or copied
+void reportChain(Effect_t *effect, uint8_t status){
+	Effect_t * const *chain = slots_chain();
+	uint8_t slot = slots_find(effect);
+	uint8_t count = slots_count();
+	uint8_t line, first, y;
+	display.setCursor(0,DISP_FEAT_INDENT);
+	display.setTextColor(1);
+	display.setFont(1);
+	if(status == ARRANGE_COPIED){
+		display.print("Copied");
+	}else if(status == ARRANGE_REMOVED){
+		display.print("Removed");
+	}else if(status == ARRANGE_FAILED){
+		display.print("Can't copy");
+	}else{
+		display.print("Chain");
+	}
+	display.setFont(0);
+	display.drawFastHLine(0,17,DISP_FEAT_W,1);
+	// Three lines, scrolled so the effect's neighbours show
+	first = (slot > 0) ? slot - 1 : 0;
+	if(first + 3 > count) first = (count > 3) ? count - 3 : 0;
+	for(line=first; line < first + 3 && line < count; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		if(line == slot){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		display.print(line + 1, DEC);
+		display.print(" ");
+		printEffectName(chain[line]);
+		if(effect_isOn(chain[line])) display.print(" on");
+	}
+	display.setTextColor(1);
+}
+
+// Effect name, numbered if it is a copy
+void printEffectName(Effect_t *effect){
+	display.print(effect->name);
+	if(effect->copy > 1){
+		display.print(" ");
+		display.print(effect->copy, DEC);
+	}
+}
+
+// Explains why an effect was refused
+void reportMemory(){
+	display.setTextColor(0);
+	display.fillRect(0,DISP_FEAT_Y,DISP_FEAT_W,13,1);
+	display.print("Out of memory!");
+	display.setTextColor(1);
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
+	display.print("Largest free ");
+	display.print(arena_largestFree(), DEC);
+	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+28);
+	display.print("of ");
+	display.print(ARENA_SAMPLES, DEC);
+	display.print(" samples");
+}
+
+// 15bit level to a VU bar height
+uint8_t vuScale(uint32_t level){
+	level >>= 9;
+	return level > 63 ? 63 : (uint8_t)level;
+}
+
+// Integer square root, rounded down
+uint16_t isqrt(uint32_t value){
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+	while(bit > value) bit >>= 2;
+	while(bit){
+		if(value >= root + bit){
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}else{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint16_t)root;
+}
+
 // Returns a pergentage value (float)
 float percentage(uint16_t value, uint16_t max, uint16_t min){
 	float result, frac;
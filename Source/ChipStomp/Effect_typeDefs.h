@@ -13,17 +13,49 @@
 
 #define EFFECTCOUNT 6
 
+// Effect_t.state
+#define EFFECT_OFF 0
+#define EFFECT_ON 1
+#define EFFECT_FADING 2 // Turned off but the ISR is still ramping it out. See effect_bypass.h
+#define EFFECT_WAITING 3 // Turned on but waiting for delay memory. The ISR passes it by. See delay_arena.cpp
+#define EFFECT_RESTART 4 // On, but ramping out to give up or change its delay memory. Then waits to get it back
+
 // Each Effect
-typedef struct {
-  char* name; // Name of effect
-  uint8_t state; // 0x01 = on, 0x00 = off
+// One per instance in the chain. An effect's create() copies its prototype
+// and points data at a free instance of its state (see effect_instance.h)
+// so every function is handed the Effect_t it is acting on.
+typedef struct Effect_s Effect_t;
+struct Effect_s {
+  const char *name; // Name of effect
+  uint8_t state; // EFFECT_ON, EFFECT_OFF, EFFECT_FADING, EFFECT_WAITING or EFFECT_RESTART
   uint8_t featureIdx; // Feature 0 is a safe dummy feature that does nothing
-  void (*nextFeature)(); // Cycles to the next Feature
-  void (*adjustFeature)(int16_t); // Receives the encoder values
-  uint8_t (*toggleOnOff)(); // Turns the Effect On/Off
-  int32_t (*effectISR)(int32_t); // Called in the main ISR arg is the input buffer. Returns the modified sample
-  void (*report)(); // Prints a report of the Effects current state to stdout.
-} Effect_t;
+  void (*nextFeature)(Effect_t*); // Cycles to the next Feature
+  void (*adjustFeature)(Effect_t*, int16_t); // Receives the encoder values
+  uint8_t (*toggleOnOff)(Effect_t*); // Turns the Effect On/Off
+  int32_t (*effectISR)(Effect_t*, int32_t); // Called in the main ISR arg is the input buffer. Returns the modified sample
+  void (*processBlock)(Effect_t*, int32_t*, uint16_t); // Block mode version of effectISR. Processes n samples in place
+  void (*report)(Effect_t*); // Prints a report of the Effects current state to stdout.
+  uint16_t cost; // Worst case cycles per sample for effectISR. Seeded from the host cost model, raised by the ISR when COST_PROFILE is set
+  const uint8_t *curves; // Encoder acceleration curve for each feature. See encoder_accel.h. NULL = single steps
+  uint8_t (*save)(Effect_t*, uint8_t*); // Copies the user settings out for a preset. Returns the length. NULL = not saved
+  void (*load)(Effect_t*, const uint8_t*, uint8_t); // Takes the user settings from a preset. Ignores a length it doesn't expect
+  uint16_t memory; // Least delay memory in samples toggleOnOff() takes from the arena. 0 = none. See delay_arena.cpp
+  uint8_t tails; // 1 = turning off mutes the input and lets the delay ring out. Needs tail
+  uint32_t tail; // Samples of silence before a muted delay has rung out. Set by effects with a delay
+  // Bypass ramp. Only the ISR writes these. See effect_bypass.h
+  uint16_t bypass; // Wet level (or input level in tails mode) 0 to BYPASS_ONE
+  uint32_t quiet; // Samples the tail has been silent for
+  volatile uint8_t faded; // Set once a fading effect has ramped and rung out
+  // Instance. Set when created
+  void *data; // This instance's params, DSP state and delay line. NULL = not in use
+  uint8_t copy; // 1 for the first instance of an effect, 2 for the next...
+  uint8_t type; // Position in g_effectTypes. Presets store this. See effect_slots.h
+};
+
+// On as far as the user is concerned, even if it isn't running just yet
+inline uint8_t effect_isOn(const Effect_t *effect){
+  return effect->state == EFFECT_ON || effect->state == EFFECT_WAITING || effect->state == EFFECT_RESTART;
+}
 
 // Global Effect manager
 typedef struct {
@@ -13,6 +13,28 @@
 #define SAMPLETIME 0.025
 // #define SAMPLERATE 32000  
 // #define SAMPLETIME 0.03125
+// Block mode
+// 1 = Timer1 ISR processes every sample as it arrives.
+// >1 = Timer1 triggers DMA from the ADC into a ping-pong buffer and from
+// another into the PWM duty registers. The DMA ISR runs the chain over
+// BLOCKSIZE samples at a time which costs 2 * BLOCKSIZE samples of latency.
+#ifndef BLOCKSIZE
+#define BLOCKSIZE 1
+#endif
+// 1 = ISR runs the compile time chain in ChipStomp.pde instead of walking
+// the chain slots. The chain can't be rearranged then. See effect_chain.h
+#ifndef STATIC_CHAIN
+#define STATIC_CHAIN 0
+#endif
+// Delay memory shared by the effects that are on. See delay_arena.cpp
+// 10240 samples is 20Kb. Echo on its own gets about 1.4 seconds of 16bit tape
+#define ARENA_SAMPLES 10240
+// Part of the arena Echo leaves free, so the lines of other effects can
+// come on without it having to give memory up. Fits the largest Reverb
+#define ARENA_RESERVE 3072
+// Instances of each effect there can be. Each one's state is static RAM
+// whether it is in the chain or not. See effect_instance.h
+#define EFFECT_COPIES 2
 #define CLIPLEVEL 31000  // Full range is +32767 to -32767 but this is the level we light the LED at.
 #define CLIPHARD 32767
 
@@ -44,8 +66,10 @@
 #define BTN_MASK BTNEFFECT_BIT | BTNSELECT_BIT | ENCBTN_BIT // Mask for buttons
 #define INPUT_MASK ENC_MASK | BTN_MASK // Mask for all inputs
 
-#define VUTICKLEN 16
-#define VUTICKLEN_MASK 0x0f
+#define VU_FRAME_MS 35 // Meters are redrawn this often. Other text only when it changes
+// VU meter time constants in samples, as a power of 2. See vu_track() in isr.pde
+#define VU_PEAK_SHIFT 14 // Peak falls to 1/e in 2^14 samples (~400mS)
+#define VU_POWER_SHIFT 10 // Power is averaged over about 2^10 samples (~25mS)
 
 // Some handy values for screen layout
 #define DISP_FEAT_Y 20  // Start point for features area
@@ -62,8 +86,26 @@
 #define SPI_MOSI 12 // RB1
 #define _DSPI1_MOSI_PIN   12
 // End of stupid Arduino pin numbers
+#define OLED_DMA 3 // DMA channel that flushes the display. Block mode has 0-2. Must match the vector in isr.pde
 
 #define SYS_FREQ 40000000 // PIC OSC frequency
+
+// CPU budget
+// Everything in the Timer1 ISR has to fit in one sample period.
+// Effects are only allowed to be turned on if the sum of their worst case
+// cost fits in what is left once the ISR itself and the main loop are paid for.
+#define CYCLES_PER_SAMPLE (SYS_FREQ / SAMPLERATE)
+#if BLOCKSIZE > 1
+#define ISR_OVERHEAD_CYCLES 60 // Per sample share of DMA ISR entry/exit, clipping, VU & byte split
+#else
+#define ISR_OVERHEAD_CYCLES 200 // Entry/exit, ADC wait, clipping, VU & PWM writes
+#endif
+#define MAINLOOP_RESERVE_CYCLES 100 // Left over so the UI doesn't starve
+#define CYCLE_BUDGET (CYCLES_PER_SAMPLE - ISR_OVERHEAD_CYCLES - MAINLOOP_RESERVE_CYCLES)
+#define CP0_TICK_CYCLES 2 // CP0 Count increments once every 2 SYSCLK
+#ifndef COST_PROFILE
+#define COST_PROFILE 1 // Time each effectISR with CP0 Count and keep the worst case in Effect_t.cost
+#endif
 #define GetSystemClock() SYS_FREQ
 #define GetPeripheralClock()    (GetSystemClock() / (1 << OSCCONbits.PBDIV))
 
@@ -81,24 +123,24 @@ typedef union {
   };
 } ButtonState_t;
 
-// This is used to store the input
+// The main loop's view of the input, built up from input_queue.h events
 typedef struct {
-  struct {
-    int16_t value; // Accumulated value of encoder input. Set to 0 once actioned
-    uint8_t state; // Current state, used in ISR decoding
-  } encoder;
+  int16_t encoder; // Encoder steps to act on
   ButtonState_t btn_state; // 1 = pressed
   ButtonState_t btn_diff; // 1 = different from last time
-  uint32_t btn_timer; // Could use this to determine how long since last input...
 } InputState_t;
 
+// Levels of one VU meter channel, kept up to date by the ISR every sample.
+// Each is a single 32bit word so the UI can read them at any time.
+typedef struct {
+  uint32_t peak; // Decaying peak of abs(sample) with 15bits of fraction
+  uint32_t power; // Leaky average of sample squared. sqrt() it for RMS
+} VUChannel_t;
+
 // This is used to store the input and output VU Meter
 typedef struct {
-  int16_t input[VUTICKLEN];
-  int16_t output[VUTICKLEN];
-  uint8_t peak_in;
-  uint8_t peak_out;
-  uint8_t tick;
+  VUChannel_t input;
+  VUChannel_t output;
 } VUMeter_t;
 
 
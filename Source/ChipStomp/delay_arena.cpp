@@ -0,0 +1,334 @@
+/*
+	Delay memory arena
+
+	Echo, Flanger and Pitchshift all need a delay line, one per instance. Reserving them all
+	statically ties up RAM for effects that are off, which on a 32Kb part
+	caps the echo at well under a second.
+	Instead they share one arena. Each effect takes its delay line in
+	toggleOnOff() and gives it back when turned off.
+	
+	The block list is only ever touched from the main loop. The ISR just sees
+	the pointer/length the effect stored in its DSP state, which is published
+	before the effect is turned on and cleared before the memory is reused.
+	
+	Effects that can use any amount (Echo) take as much as is free, short
+	of ARENA_RESERVE, so running Echo on its own gives a multi-second tape
+	and most effects still come on straight away beside it.
+	When another effect can't fit, the running effects that could make do
+	with less are set EFFECT_RESTART and the newcomer EFFECT_WAITING. They
+	fade out through the bypass like any other effect turning off (never
+	cut at full level), give their memory back in arena_retire(), and the
+	waiting effects, oldest first, take what they need before they come
+	back on with whatever is left. Memory that is already on its way back,
+	from effects fading out, is waited for rather than cut short.
+	An effect that needs a different amount (a new Echo tape or Reverb
+	size) restarts the same way with arena_restart().
+	What each effect needs is its Effect_t.memory, kept up to date by the
+	effect, so the arena knows what to make room for whether or not
+	toggleOnOff() got as far as asking.
+*/
+#include <PLIB.h>
+#include <string.h>
+#include "delay_arena.h"
+
+//******** Private macros ********//
+
+//******** Private function declarations ********//
+
+uint16_t arena_gapStart(uint8_t idx);
+uint16_t arena_gapAfter(uint8_t idx);
+boolean arena_pending();
+boolean arena_makeRoom(uint16_t wanted);
+void arena_wait(Effect_t *effect, uint8_t evicted);
+void arena_unwait(uint8_t idx);
+
+//******** Private variables ********//
+
+// Blocks in use, in order of their start in the arena
+typedef struct {
+	uint16_t start;
+	uint16_t size;
+	uint16_t min; // Least the owner would run with
+	uint8_t stale; // The owner is fading out and wants different memory if it comes back
+	Effect_t *owner;
+} ArenaBlock_t;
+
+ArenaBlock_t *arena_block(Effect_t *owner);
+
+// Effects turned on that are waiting for memory, oldest first
+typedef struct {
+	Effect_t *effect;
+	uint8_t evicted; // Running effects have already made room for it once
+} ArenaWait_t;
+
+static ArenaBlock_t blocks[ARENA_MAX_BLOCKS];
+static uint8_t blockCount = 0;
+static ArenaWait_t waiting[ARENA_MAX_BLOCKS];
+static uint8_t waitCount = 0;
+
+static int16_t arena[ARENA_SAMPLES];
+
+//******** Function definitions ********//
+
+// Start of the gap that follows block idx-1. (idx 0 = start of the arena)
+uint16_t arena_gapStart(uint8_t idx){
+	if(idx == 0) return 0;
+	return blocks[idx-1].start + blocks[idx-1].size;
+}
+
+// Length of the gap between block idx-1 and block idx
+uint16_t arena_gapAfter(uint8_t idx){
+	uint16_t end = (idx < blockCount) ? blocks[idx].start : ARENA_SAMPLES;
+	return end - arena_gapStart(idx);
+}
+
+int16_t *arena_alloc(Effect_t *owner, uint16_t min, uint16_t max, uint16_t *size){
+	uint8_t idx, best = 0, largest = 0;
+	uint16_t gap, bestGap = 0, largestGap = 0;
+	uint16_t start;
+
+	if(blockCount >= ARENA_MAX_BLOCKS) return NULL;
+	// Find the smallest gap that takes max whole and the largest gap
+	for(idx=0; idx <= blockCount; idx++){
+		gap = arena_gapAfter(idx);
+		if(gap >= max && (bestGap == 0 || gap < bestGap)){
+			bestGap = gap;
+			best = idx;
+		}
+		if(gap > largestGap){
+			largestGap = gap;
+			largest = idx;
+		}
+	}
+	if(bestGap){
+		*size = max;
+	}else if(largestGap >= min){
+		best = largest;
+		*size = largestGap;
+	}else{
+		return NULL;
+	}
+
+	// Insert keeping the list in order
+	start = arena_gapStart(best);
+	for(idx=blockCount; idx > best; idx--){
+		blocks[idx] = blocks[idx-1];
+	}
+	blocks[best].start = start;
+	blocks[best].size = *size;
+	blocks[best].min = min;
+	blocks[best].stale = 0;
+	blocks[best].owner = owner;
+	blockCount++;
+
+	memset(&arena[start], 0, *size * sizeof(int16_t));
+	return &arena[start];
+}
+
+void arena_free(int16_t *buffer){
+	uint8_t idx;
+	uint16_t start = buffer - arena;
+	for(idx=0; idx < blockCount; idx++){
+		if(blocks[idx].start == start){
+			blockCount--;
+			for(; idx < blockCount; idx++){
+				blocks[idx] = blocks[idx+1];
+			}
+			return;
+		}
+	}
+}
+
+uint16_t arena_largestFree(){
+	uint8_t idx;
+	uint16_t gap, largestGap = 0;
+	if(blockCount >= ARENA_MAX_BLOCKS) return 0;
+	for(idx=0; idx <= blockCount; idx++){
+		gap = arena_gapAfter(idx);
+		if(gap > largestGap) largestGap = gap;
+	}
+	return largestGap;
+}
+
+uint16_t arena_owned(Effect_t *owner, uint16_t *start){
+	ArenaBlock_t *block = arena_block(owner);
+	if(block == NULL) return 0;
+	*start = block->start;
+	return block->size;
+}
+
+// True while an effect is fading out to give memory back
+boolean arena_pending(){
+	uint8_t idx;
+	for(idx=0; idx < blockCount; idx++){
+		if(blocks[idx].owner->state == EFFECT_FADING || blocks[idx].owner->state == EFFECT_RESTART) return true;
+	}
+	return false;
+}
+
+// Sets the running effects that could do with less memory EFFECT_RESTART,
+// if that would free up wanted samples. Returns false, disturbing nothing, if not
+boolean arena_makeRoom(uint16_t wanted){
+	uint8_t idx;
+	uint32_t room = ARENA_SAMPLES;
+	Effect_t *owner;
+	boolean shrinkable = false;
+	// Each restart takes its block back after the newcomer has taken one
+	if(blockCount >= ARENA_MAX_BLOCKS) return false;
+	for(idx=0; idx < blockCount; idx++){
+		room -= blocks[idx].size;
+		if(blocks[idx].owner->state == EFFECT_ON && blocks[idx].size > blocks[idx].min){
+			room += blocks[idx].size - blocks[idx].min;
+			shrinkable = true;
+		}
+	}
+	if(!shrinkable || room < wanted) return false;
+	for(idx=0; idx < blockCount; idx++){
+		owner = blocks[idx].owner;
+		if(owner->state == EFFECT_ON && blocks[idx].size > blocks[idx].min){
+			// Clear it before the ISR can see the new state
+			owner->faded = 0;
+			owner->state = EFFECT_RESTART;
+		}
+	}
+	return true;
+}
+
+// An effect's block. NULL if it has none
+ArenaBlock_t *arena_block(Effect_t *owner){
+	uint8_t idx;
+	for(idx=0; idx < blockCount; idx++){
+		if(blocks[idx].owner == owner) return &blocks[idx];
+	}
+	return NULL;
+}
+
+// Joins the end of the waiting list. The ISR passes it by until it's on
+void arena_wait(Effect_t *effect, uint8_t evicted){
+	waiting[waitCount].effect = effect;
+	waiting[waitCount].evicted = evicted;
+	waitCount++;
+	effect->bypass = 0;
+	effect->faded = 1;
+	effect->state = EFFECT_WAITING;
+}
+
+// Leaves the waiting list
+void arena_unwait(uint8_t idx){
+	waitCount--;
+	for(; idx < waitCount; idx++){
+		waiting[idx] = waiting[idx+1];
+	}
+}
+
+// Turning off only starts the fade (see effect_bypass.h). The effect keeps
+// its memory until arena_retire() sees the ISR has finished with it, and
+// turning it back on before then just fades it back in.
+// Effects without a delay line always turn on. One that needs memory
+// returns 0 from toggleOnOff() when the arena is full. If anything is
+// fading out it waits for that memory. Otherwise, if the running effects
+// could make room by shrinking, they fade out to restart around it and it
+// waits. Failing that it's refused, and nothing that was running is disturbed.
+boolean arena_toggle(Effect_t *effect){
+	ArenaBlock_t *block;
+	uint8_t idx;
+	if(effect->state == EFFECT_ON){
+		// Clear it before the ISR can see the new state
+		effect->faded = 0;
+		effect->state = EFFECT_FADING;
+		return true;
+	}
+	if(effect->state == EFFECT_RESTART){
+		// Already fading. Just don't come back, unless turned on again
+		block = arena_block(effect);
+		if(block != NULL) block->stale = 1;
+		effect->state = EFFECT_FADING;
+		return true;
+	}
+	if(effect->state == EFFECT_FADING){
+		block = arena_block(effect);
+		if(block != NULL && block->stale){
+			// Its settings changed while fading. Carry on out, then back in
+			effect->faded = 0;
+			effect->state = EFFECT_RESTART;
+		}else{
+			effect->state = EFFECT_ON;
+			effect->faded = 0;
+		}
+		return true;
+	}
+	if(effect->state == EFFECT_WAITING){
+		for(idx=0; waiting[idx].effect != effect; idx++);
+		arena_unwait(idx);
+		effect->state = EFFECT_OFF;
+		return true;
+	}
+	// Fade in from silence
+	effect->bypass = 0;
+	if(effect->toggleOnOff(effect)) return true;
+
+	if(waitCount >= ARENA_MAX_BLOCKS) return false;
+	if(arena_pending()){
+		arena_wait(effect, 0);
+		return true;
+	}
+	if(arena_makeRoom(effect->memory)){
+		arena_wait(effect, 1);
+		return true;
+	}
+	return false;
+}
+
+void arena_restart(Effect_t *effect){
+	ArenaBlock_t *block = arena_block(effect);
+	// Still has its old memory if turned back on before it's faded out
+	if(effect->state == EFFECT_FADING && block != NULL) block->stale = 1;
+	if(effect->state != EFFECT_ON) return;
+	// Clear it before the ISR can see the new state
+	effect->faded = 0;
+	effect->state = EFFECT_RESTART;
+}
+
+// Effects that faded out to restart give their memory back and join the
+// waiting list behind whatever they made room for. Waiting effects are
+// turned on in order if they fit. If some still don't once nothing else is
+// fading, the running effects make room for them once, then they're refused.
+uint8_t arena_retire(Effect_t * const *effects){
+	Effect_t *effect;
+	uint8_t idx, result = 0;
+	for(; *effects != NULL; effects++){
+		effect = *effects;
+		if(!effect->faded) continue;
+		if(effect->state == EFFECT_FADING){
+			effect->toggleOnOff(effect);
+			result |= ARENA_CHANGED;
+		}else if(effect->state == EFFECT_RESTART){
+			effect->toggleOnOff(effect); // Gives its memory back
+			arena_wait(effect, 0);
+			result |= ARENA_CHANGED;
+		}
+	}
+	if(waitCount == 0) return result;
+
+	for(idx=0; idx < waitCount;){
+		effect = waiting[idx].effect;
+		effect->state = EFFECT_OFF;
+		if(effect->toggleOnOff(effect)){
+			// Fades in from its level of 0
+			arena_unwait(idx);
+			result |= ARENA_CHANGED;
+		}else{
+			effect->state = EFFECT_WAITING;
+			idx++;
+		}
+	}
+	if(waitCount == 0 || arena_pending()) return result;
+	if(!waiting[0].evicted && arena_makeRoom(waiting[0].effect->memory)){
+		waiting[0].evicted = 1;
+		return result;
+	}
+	while(waitCount){
+		waiting[--waitCount].effect->state = EFFECT_OFF;
+	}
+	return result | ARENA_CHANGED | ARENA_REFUSED;
+}
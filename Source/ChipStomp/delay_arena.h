@@ -0,0 +1,43 @@
+/*
+	Header for the delay memory arena
+	Delay lines are handed out of one shared block of RAM when an effect is
+	turned on and given back when it is turned off. So memory is only spent
+	on the effects that are actually running.
+*/
+#ifndef __Delay_Arena__
+#define __Delay_Arena__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+
+#define ARENA_MAX_BLOCKS 8 // Most delay lines that can be out at once
+
+// arena_retire() results
+#define ARENA_CHANGED 1 // Effects were turned on or off. The chain needs updating
+#define ARENA_REFUSED 2 // Effects waiting for memory were turned off. There was no room
+
+// Hands out a zeroed delay line of between min and max samples to owner.
+// Fixed size requests (min == max) go in the smallest gap they fit.
+// Anything else gets as much of the largest gap as it'll take.
+// Returns NULL if there isn't a gap of min samples. size gets the length.
+extern int16_t *arena_alloc(Effect_t *owner, uint16_t min, uint16_t max, uint16_t *size);
+// Gives a delay line back
+extern void arena_free(int16_t *buffer);
+// Length of the largest delay line that could be handed out right now
+extern uint16_t arena_largestFree();
+// Length of owner's delay line, 0 if it has none. start gets where it begins
+extern uint16_t arena_owned(Effect_t *owner, uint16_t *start);
+// Turns an effect on or off, making room in the arena if need be.
+// Off fades the effect out first. See effect_bypass.h
+// On may leave it EFFECT_WAITING while running effects fade out to make room.
+// Returns false if the effect couldn't be turned on.
+extern boolean arena_toggle(Effect_t *effect);
+// Has a running effect fade out, give its memory back and take it again,
+// to change how much it needs. One that's off takes it when next turned on.
+extern void arena_restart(Effect_t *effect);
+// Turns off the effects that have finished fading out, giving back their
+// memory, then turns on the effects waiting for it. Returns ARENA_CHANGED
+// and ARENA_REFUSED flags. Call it from the main loop.
+extern uint8_t arena_retire(Effect_t * const *effects);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+	Fixed point DSP primitives
+	Shared by the effects so the same sum is done the same way everywhere.
+	All inline, so a call costs nothing over writing the sum out by hand.
+
+	Formats
+	Q15         : int16 range, 15bits of fraction. Samples and the sine table.
+	              Held in int32 so a product or a difference can't overflow
+	Q16 gain    : uint16, 0 to just under 1. Effect amplitude and mix params
+	Q31         : int32, 31bits of fraction. For coefficients that need it
+	Q2.30       : int32, -2 to just under 2. Biquad coefficients
+	Log         : int32, log2 with 16bits of fraction. 1dB is about 10885
+	Accumulator : dsp_acc_t. GCC keeps it in the MIPS HI/LO pair, so
+	              dsp_mac() is one MADD and extracting it is MFHI/MFLO
+
+	Every shift right is arithmetic so it rounds towards minus infinity,
+	and nothing saturates unless it says so. The M4K core in the PIC32MX
+	has no DSP ASE, so saturation is a pair of compares, not an instruction.
+	Q15 products use the 32bit MUL, which is a cycle cheaper than MULT into
+	HI/LO and doesn't need the halves stitching back together.
+
+	The host sim's -q option checks each of these bit-exact against a
+	reference model written the long way with wide arithmetic.
+*/
+#ifndef __DSP_Fixed__
+#define __DSP_Fixed__
+
+#include <stdint.h>
+#include "config.h"
+
+// 64bit multiply accumulate
+typedef int64_t dsp_acc_t;
+
+#define DSP_SINE_MASK 0x03ff // g_sinewave is 1024 entries
+#define DSP_SINE_SHIFT 8 // Fraction bits of a dsp_sine() position
+#define DSP_CURVE_LEN 257 // Entries in a dsp_curve() table
+#define DSP_LOG_SHIFT 16 // Fraction bits of a dsp_log2() result
+#define DSP_LOG_STEPS 32 // Entries per octave in the log and exp tables
+
+// Smoothing time constants in samples (2^n) for dsp_smooth()
+#define SMOOTH_FAST 6 // ~1.6mS @ 40kHz. Gains and mixes
+
+// log2(1 + n/32) for dsp_log2(), 16bits of fraction
+const int32_t g_log2Table[DSP_LOG_STEPS + 1] = {
+	0, 2909, 5732, 8473, 11136, 13727, 16248, 18704,
+	21098, 23433, 25711, 27936, 30109, 32234, 34312, 36346,
+	38336, 40286, 42196, 44068, 45904, 47705, 49472, 51207,
+	52911, 54584, 56229, 57845, 59434, 60997, 62534, 64047,
+	65536
+};
+
+// 2^(n/32) for dsp_exp2(), 16bits of fraction
+const int32_t g_exp2Table[DSP_LOG_STEPS + 1] = {
+	65536, 66971, 68438, 69936, 71468, 73032, 74632, 76266,
+	77936, 79642, 81386, 83169, 84990, 86851, 88752, 90696,
+	92682, 94711, 96785, 98905, 101070, 103283, 105545, 107856,
+	110218, 112631, 115098, 117618, 120194, 122825, 125515, 128263,
+	131072
+};
+
+//******** Multiply ********//
+
+// Clamps to the int16 range
+inline int32_t dsp_sat16(int32_t value){
+	if(value > 32767) value = 32767;
+	if(value < -32768) value = -32768;
+	return value;
+}
+
+// a x b >> 15. The product has to fit 32bits : Q15 by Q15 always does, and
+// so does Q15 by anything up to 0xffff (a gain of almost 2)
+inline int32_t dsp_mulQ15(int32_t a, int32_t b){
+	return (a * b) >> 15;
+}
+
+// Q15 by a Q16 gain. Same limits as dsp_mulQ15()
+inline int32_t dsp_mulQ16(int32_t a, uint16_t gain){
+	return (a * (int32_t)gain) >> 16;
+}
+
+// Q31 by Q31 via HI/LO. Wraps for -1 x -1 only
+inline int32_t dsp_mulQ31(int32_t a, int32_t b){
+	return (int32_t)(((int64_t)a * b) >> 31);
+}
+
+// acc + a x b. One MADD
+inline dsp_acc_t dsp_mac(dsp_acc_t acc, int32_t a, int32_t b){
+	return acc + (int64_t)a * b;
+}
+
+// acc - a x b. One MSUB
+inline dsp_acc_t dsp_msub(dsp_acc_t acc, int32_t a, int32_t b){
+	return acc - (int64_t)a * b;
+}
+
+// The accumulator shifted down and saturated to the int16 range.
+// Saturating multiply accumulate is dsp_mac()s then this
+inline int32_t dsp_acc16(dsp_acc_t acc, uint8_t shift){
+	acc >>= shift;
+	if(acc > 32767) return 32767;
+	if(acc < -32768) return -32768;
+	return (int32_t)acc;
+}
+
+//******** Interpolation ********//
+
+// Linear interpolation frac/2^bits of the way from a to b. One MUL.
+// a and b are int16 range and bits at most 14, or (b - a) << bits must fit 32bits
+inline int32_t dsp_lerp(int32_t a, int32_t b, uint32_t frac, uint8_t bits){
+	return a + (((b - a) * (int32_t)frac) >> bits);
+}
+
+// Interpolated read of a table whose length is a power of 2 (mask + 1).
+// pos has bits of fraction. Wraps from the last entry back to the first
+inline int32_t dsp_tableLerp(const int16_t *table, uint32_t pos, uint32_t mask, uint8_t bits){
+	uint32_t idx = pos >> bits;
+	return dsp_lerp(table[idx & mask], table[(idx + 1) & mask], pos & ((1 << bits) - 1), bits);
+}
+
+// Sine of a 10.8 position in g_sinewave, full scale Q15
+inline int32_t dsp_sine(uint32_t pos){
+	return dsp_tableLerp(g_sinewave, pos, DSP_SINE_MASK, DSP_SINE_SHIFT);
+}
+
+// Interpolated read of a circular delay line of any size. pos has bits of
+// fraction and can be up to twice size, so a write position plus an offset
+// only needs wrapping here, once
+inline int32_t dsp_delayRead(const int16_t *buffer, uint32_t size, uint32_t pos, uint8_t bits){
+	uint32_t idx = pos >> bits;
+	uint32_t next;
+	if(idx >= size) idx -= size;
+	next = idx + 1;
+	if(next == size) next = 0;
+	return dsp_lerp(buffer[idx], buffer[next], pos & ((1 << bits) - 1), bits);
+}
+
+// Interpolated read of a DSP_CURVE_LEN table spanning the int16 range, for
+// waveshapers and other transfer curves. value is clamped to the int16
+// range first so the curve carries on flat past its ends
+inline int32_t dsp_curve(const int16_t *table, int32_t value){
+	uint32_t pos = (uint32_t)(dsp_sat16(value) + 32768);
+	return dsp_lerp(table[pos >> 8], table[(pos >> 8) + 1], pos & 0xff, 8);
+}
+
+//******** One-pole ********//
+
+// One-pole lowpass : state moves 1/2^shift of the way to in. Returns the new state.
+// (in - state) has to fit 32bits
+inline int32_t dsp_onePole(int32_t *state, int32_t in, uint8_t shift){
+	*state += (in - *state) >> shift;
+	return *state;
+}
+
+// One-pole ramp from current towards target. Call once per sample.
+// current carries 8 fractional bits. Always moves at least one fractional
+// step so it lands exactly on the target rather than stalling just short.
+// Returns the integer part.
+inline int32_t dsp_smooth(int32_t *current, int32_t target, uint8_t shift){
+	int32_t diff = (target << 8) - *current;
+	*current += (diff >> shift) + (diff > 0);
+	return *current >> 8;
+}
+
+//******** Log domain ********//
+// Gains and levels as logs turn division into subtraction and ratios
+// into multiplies by a constant.
+
+// log2 of value with DSP_LOG_SHIFT bits of fraction. 0 reads as 1, so
+// the result is never negative. Within 0.0015dB of the real thing.
+// About 10 cycles : CLZ finds the octave, the next 5 bits pick the table
+// entries and the 16 after them interpolate
+inline int32_t dsp_log2(uint32_t value){
+	uint8_t top;
+	uint32_t norm, idx;
+	if(value == 0) return 0;
+	top = 31 - __builtin_clz(value); // MIPS32 clz instruction
+	norm = value << (31 - top);
+	idx = (norm >> 26) & (DSP_LOG_STEPS - 1);
+	return ((int32_t)top << DSP_LOG_SHIFT) + dsp_lerp(g_log2Table[idx], g_log2Table[idx + 1], (norm >> 10) & 0xffff, 16);
+}
+
+// 2 to the power of a dsp_log2() style log, with 16bits of fraction.
+// Gains from a log : 0 is 1 << 16. log must be under 15 << DSP_LOG_SHIFT
+// for the result to fit. Anything below -16 << DSP_LOG_SHIFT is 0.
+// Within 0.0006dB. About 10 cycles
+inline uint32_t dsp_exp2(int32_t log){
+	int32_t whole = log >> DSP_LOG_SHIFT;
+	uint32_t frac = log & ((1 << DSP_LOG_SHIFT) - 1);
+	uint32_t idx = frac >> 11;
+	uint32_t mantissa = dsp_lerp(g_exp2Table[idx], g_exp2Table[idx + 1], frac & 0x7ff, 11);
+	if(whole >= 0) return mantissa << whole;
+	if(whole <= -17) return 0;
+	return mantissa >> -whole;
+}
+
+//******** Biquad ********//
+
+#define DSP_BIQUAD_SHIFT 30 // Fraction bits of the coefficients
+
+// Coefficients for dsp_biquad(), Q2.30, normalised so a0 is 1. Worked out
+// in the main loop and handed to the ISR whole (see effect_params.h).
+// A boost past x2 doesn't fit, so the b terms can be stored shifted down
+// by shift bits and the input is shifted up to match
+typedef struct {
+	int32_t b0, b1, b2;
+	int32_t a1, a2; // y = b.x - a.y
+	uint8_t shift;
+} dsp_biquad_t;
+
+// One biquad's history. Only touched by the ISR
+typedef struct {
+	int32_t x1, x2; // Last two inputs
+	int32_t y1, y2; // Last two outputs, not saturated so the filter stays linear
+	uint32_t error; // Fraction the last output dropped
+} dsp_biquadState_t;
+
+// Direct Form I biquad. One accumulator for all five products so nothing is
+// rounded until the end. Direct Form I because its state is just past
+// inputs and outputs, so a coefficient change can't leave it holding
+// values that blow up.
+// At low cutoffs the poles crowd towards z = 1 and rounding the output
+// to a whole sample each time is enough to shift the response or leave it
+// stuck on a small constant. So the fraction dropped is added back into
+// the next sample (first order error feedback), which puts the rounding
+// error's spectrum at high frequencies and none of it at DC.
+// Cycles on the M4K, per stage :
+//   Seed HI/LO with the error              2  MTHI, MTLO
+//   Five 32x32 MADD/MSUBs                 10  Two cycles each in the MDU
+//   Loads : 5 coefficients, 5 of state    10  Overlap the MDU where GCC allows
+//   b shift of the three inputs            3
+//   Output : MFHI/MFLO, shift and join     5
+//   Error : mask off the fraction          1
+//   History : 4 stores and the error       5
+// About 36 in all, plus the call when it isn't inlined
+inline int32_t dsp_biquad(dsp_biquadState_t *state, const dsp_biquad_t *coeffs, int32_t in){
+	dsp_acc_t acc = state->error;
+	int32_t out;
+	acc = dsp_mac(acc, in << coeffs->shift, coeffs->b0);
+	acc = dsp_mac(acc, state->x1 << coeffs->shift, coeffs->b1);
+	acc = dsp_mac(acc, state->x2 << coeffs->shift, coeffs->b2);
+	acc = dsp_msub(acc, state->y1, coeffs->a1);
+	acc = dsp_msub(acc, state->y2, coeffs->a2);
+	out = (int32_t)(acc >> DSP_BIQUAD_SHIFT);
+	state->error = (uint32_t)acc & ((1UL << DSP_BIQUAD_SHIFT) - 1);
+	state->x2 = state->x1;
+	state->x1 = in;
+	state->y2 = state->y1;
+	state->y1 = out;
+	return out;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+	Header for the Echo tape encodings
+	The tape runs at 1/8 of the sample rate and is already lo-fi, so storing
+	it in fewer bits costs little and buys a longer delay from the same RAM.
+	  TAPE_PCM16 : Plain 16bit
+	  TAPE_ULAW  : G.711 mu-law 8bit. Twice the tape
+	  TAPE_ALAW  : G.711 A-law 8bit. Twice the tape
+	  TAPE_ADPCM : IMA ADPCM 4bit. Four times the tape. Has to be decoded in
+	               order so the read tap must never skip or go backwards
+	Everything is shifts, compares and small tables so that one encode and
+	one or two decodes fit in the sample where the tape moves on.
+*/
+#ifndef __Echo_Tape__
+#define __Echo_Tape__
+
+#include <stdint.h>
+
+#define TAPE_PCM16 0
+#define TAPE_ULAW 1
+#define TAPE_ALAW 2
+#define TAPE_ADPCM 3
+#define TAPE_MODES 4
+
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 8159 // 14bit magnitude limit
+#define ULAW_SILENCE 0xff
+#define ALAW_SILENCE 0xd5
+
+#define ADPCM_STEPS 89
+
+// IMA ADPCM coder state. The encoder runs its own decoder to stay in step
+typedef struct {
+    int16_t predictor;
+    uint8_t index;
+} TapeAdpcm_t;
+
+extern const int16_t g_adpcmSteps[ADPCM_STEPS];
+extern const int8_t g_adpcmIndex[8];
+
+// Tape samples per int16_t of RAM as a shift
+inline uint8_t tape_shift(uint8_t mode){
+	return (mode == TAPE_PCM16) ? 0 : (mode == TAPE_ADPCM) ? 2 : 1;
+}
+
+// Position of the top set bit (bit length less one). value must be > 0
+inline uint8_t tape_topBit(uint32_t value){
+	return 31 - __builtin_clz(value); // MIPS32 clz instruction
+}
+
+//******** mu-law ********//
+
+inline uint8_t tape_ulawEncode(int16_t sample){
+	int32_t pcm = sample >> 2; // 14bit
+	uint8_t mask = 0xff;
+	uint8_t seg;
+	if(pcm < 0){
+		pcm = -pcm;
+		mask = 0x7f;
+	}
+	if(pcm > ULAW_CLIP) pcm = ULAW_CLIP;
+	pcm += ULAW_BIAS >> 2; // At least 0x21 so seg is never negative
+	seg = tape_topBit(pcm) - 5;
+	if(seg >= 8) return 0x7f ^ mask;
+	return ((seg << 4) | ((pcm >> (seg + 1)) & 0x0f)) ^ mask;
+}
+
+inline int16_t tape_ulawDecode(uint8_t code){
+	int32_t value;
+	code = ~code;
+	value = (((code & 0x0f) << 3) + ULAW_BIAS) << ((code & 0x70) >> 4);
+	return (int16_t)((code & 0x80) ? (ULAW_BIAS - value) : (value - ULAW_BIAS));
+}
+
+//******** A-law ********//
+
+inline uint8_t tape_alawEncode(int16_t sample){
+	int32_t pcm = sample >> 3; // 13bit
+	uint8_t mask = 0xd5;
+	uint8_t seg;
+	if(pcm < 0){
+		pcm = -pcm - 1;
+		mask = 0x55;
+	}
+	// Segment 0 and 1 share the same step size
+	seg = tape_topBit(pcm | 0x1f) - 4;
+	if(seg >= 8) return 0x7f ^ mask;
+	return ((seg << 4) | ((pcm >> (seg ? seg : 1)) & 0x0f)) ^ mask;
+}
+
+inline int16_t tape_alawDecode(uint8_t code){
+	int32_t value;
+	uint8_t seg;
+	code ^= 0x55;
+	value = (code & 0x0f) << 4;
+	seg = (code & 0x70) >> 4;
+	if(seg == 0) value += 8;
+	else value = (value + 0x108) << (seg - 1);
+	return (int16_t)((code & 0x80) ? value : -value);
+}
+
+//******** IMA ADPCM ********//
+
+inline int16_t tape_adpcmDecode(TapeAdpcm_t *state, uint8_t code){
+	int32_t step = g_adpcmSteps[state->index];
+	int32_t diff = step >> 3;
+	int32_t predictor;
+	int8_t index;
+	if(code & 4) diff += step;
+	if(code & 2) diff += step >> 1;
+	if(code & 1) diff += step >> 2;
+	predictor = state->predictor + ((code & 8) ? -diff : diff);
+	if(predictor > 32767) predictor = 32767;
+	if(predictor < -32768) predictor = -32768;
+	index = state->index + g_adpcmIndex[code & 7];
+	if(index < 0) index = 0;
+	if(index >= ADPCM_STEPS) index = ADPCM_STEPS - 1;
+	state->predictor = (int16_t)predictor;
+	state->index = (uint8_t)index;
+	return state->predictor;
+}
+
+inline uint8_t tape_adpcmEncode(TapeAdpcm_t *state, int16_t sample){
+	int32_t step = g_adpcmSteps[state->index];
+	int32_t diff = sample - state->predictor;
+	uint8_t code = 0;
+	if(diff < 0){
+		code = 8;
+		diff = -diff;
+	}
+	if(diff >= step){
+		code |= 4;
+		diff -= step;
+	}
+	step >>= 1;
+	if(diff >= step){
+		code |= 2;
+		diff -= step;
+	}
+	step >>= 1;
+	if(diff >= step) code |= 1;
+	// Track what the decoder will make of it
+	tape_adpcmDecode(state, code);
+	return code;
+}
+
+// Two codes per byte. Low nibble first
+inline uint8_t tape_nibbleRead(const uint8_t *bytes, uint32_t idx){
+	return (idx & 1) ? (bytes[idx >> 1] >> 4) : (bytes[idx >> 1] & 0x0f);
+}
+
+inline void tape_nibbleWrite(uint8_t *bytes, uint32_t idx, uint8_t code){
+	uint8_t *byte = &bytes[idx >> 1];
+	if(idx & 1) *byte = (*byte & 0x0f) | (code << 4);
+	else *byte = (*byte & 0xf0) | code;
+}
+
+#endif
@@ -6,10 +6,13 @@
 */
 #include <PLIB.h>
 #include "effect_bitcrush.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
 
 //******** Private macros ********//
 
 #define FEATURECOUNT 2  // Note : Default feature is 0 : It does nothing
+#define COST 50 // Cycles per sample from the host cost model (make bench), rounded up. Raised at runtime if measured higher
 #define BITS_MAX 16
 #define BITS_MIN 1
 #define RATIO_MIN 1
@@ -18,43 +21,40 @@
 
 //******** Private function declarations ********//
 
-void bitcrush_nextFeature();
-void bitcrush_adjustFeature(int16_t value);
-uint8_t bitcrush_toggleOnOff();
-int32_t bitcrush_effectISR(int32_t value);
-void bitcrush_report();
-uint16_t bitcrush_getHz();
-void bitcrush_ratio_adjust(int16_t value);
-void bitcrush_bits_adjust(int16_t value);
+void bitcrush_nextFeature(Effect_t *effect);
+void bitcrush_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t bitcrush_toggleOnOff(Effect_t *effect);
+int32_t bitcrush_effectISR(Effect_t *effect, int32_t value);
+void bitcrush_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void bitcrush_report(Effect_t *effect);
+uint8_t bitcrush_save(Effect_t *effect, uint8_t *data);
+void bitcrush_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+uint16_t bitcrush_getHz(bitcrush_instance_t *instance);
+void bitcrush_ratio_adjust(bitcrush_instance_t *instance, int16_t value);
+void bitcrush_bits_adjust(bitcrush_instance_t *instance, int16_t value);
 
 //******** Private variables ********//
 
-// Internal state variables
-typedef struct {
-    uint8_t bits; // Number of bits for output
-    uint8_t ratio; // Sample rate ratio
-    uint8_t step; // position within ratio
-    int32_t buffer; // Saved sample
-    int32_t accumulator; // For averaging samples
-} settings_t;
-static settings_t settings = {
-		16
-	,	1
-	, 0
-	, 0
-	, 0
+// Every new instance starts from this
+static const bitcrush_instance_t initial = {
+		{{{
+				16
+			,	1
+		}}}
+	, {
+				0
+			, 0
+			, 0
+		}
 };
+static EffectPool<bitcrush_instance_t> pool;
 
 
 enum features_t {SAFE, BITS, RATIO};
-static const char *featurenames[] = {"Safe", "Bits", "Ratio"};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_NONE, ENC_CURVE_NONE};
 
-static int32_t buffer; // Input buffer
-
-//******** Global variables ********//
-
-// This struct is exposed globally via extern in the header
-Effect_t effect_Bitcrush = {
+// Copied into each instance by bitcrush_create()
+static const Effect_t prototype = {
 		"Bitcrush"
 	, 0
 	, 0
@@ -62,72 +62,68 @@ Effect_t effect_Bitcrush = {
 	, bitcrush_adjustFeature
 	, bitcrush_toggleOnOff
 	, bitcrush_effectISR
+	, bitcrush_processBlock
 	, bitcrush_report
+	, COST
+	, featurecurves
+	, bitcrush_save
+	, bitcrush_load
 };
 
 //******** Function definitions ********//
 
-// This is where the effect is actually processed
-int32_t bitcrush_effectISR(int32_t value){
-	uint8_t shift = 16 - settings.bits;
-	int32_t result;
-  // Sample rate reduction : Done by only updating output every nth sample
-  if(settings.step == 0){
-  	// Save current sample
-  	settings.accumulator += value;
-  	// Calc average of prev N samples
-  	settings.buffer = settings.accumulator / settings.ratio;
-  	result = settings.buffer;
-  	settings.accumulator = 0;
-  }else{
-  	// Use previously saved sample
-  	settings.accumulator += value;
-  	result = settings.buffer;
-  }
-	if(++settings.step >= settings.ratio){
-		settings.step = 0;
-	}
+// New instance for the chain
+Effect_t *bitcrush_create(){
+	return pool.create(&prototype, &initial);
+}
 
-  // Bit depth reduction
-  if(shift){
-  	//Shift right to drop resolution
-  	result >>= shift;
-  	// Shift back up to retain amplitude
-  	result <<= shift;
-  }
+// Per sample entry point for the Timer1 ISR
+int32_t bitcrush_effectISR(Effect_t *effect, int32_t value){
+	return bitcrush_process(effect, value);
+}
 
-  return result;
+// Block entry point. Processes n samples in place
+void bitcrush_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = bitcrush_process(effect, *block);
+		block++;
+	}
 }
 
 // Cycles my features
-void bitcrush_nextFeature(){
+void bitcrush_nextFeature(Effect_t *effect){
 	if(FEATURECOUNT <= 1) return;
-	if(effect_Bitcrush.featureIdx < FEATURECOUNT) {
-		effect_Bitcrush.featureIdx++;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
 	}else{
 		// Skip the safe feature
-		effect_Bitcrush.featureIdx = 1;
+		effect->featureIdx = 1;
 	}
 }
 
 // Turns me on or off
-uint8_t bitcrush_toggleOnOff(){
-	if(effect_Bitcrush.state) effect_Bitcrush.state = 0;
-	else effect_Bitcrush.state = 1;
-	return effect_Bitcrush.state;
+uint8_t bitcrush_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
 }
 
 // Adjust the value of the current feature
 // Receives the encoder delta
-void bitcrush_adjustFeature(int16_t value){
-	features_t feat = (features_t)effect_Bitcrush.featureIdx;
+void bitcrush_adjustFeature(Effect_t *effect, int16_t value){
+	bitcrush_instance_t *instance = (bitcrush_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
 	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
 		case BITS:{
-			bitcrush_bits_adjust((uint16_t)value);	
+			bitcrush_bits_adjust(instance, (uint16_t)value);	
 			break;
 		}
 		case RATIO:{
-			bitcrush_ratio_adjust((uint16_t)value);	
+			bitcrush_ratio_adjust(instance, (uint16_t)value);	
 			break;
 		}
 	}
@@ -137,31 +133,47 @@ void bitcrush_adjustFeature(int16_t value){
 // Ratio determines output sample frequency
 // use an int32 for result to make boundry checking easy
 // Clamps result to within min/max
-void bitcrush_ratio_adjust(int16_t value){
-	int32_t result = settings.ratio - value;
+void bitcrush_ratio_adjust(bitcrush_instance_t *instance, int16_t value){
+	bitcrush_params_t *params = instance->params.edit();
+	int32_t result = params->ratio - value;
 	if(result > RATIO_MAX){
 		result = RATIO_MAX;
 	}else if(result < RATIO_MIN){
 		result = RATIO_MIN;
 	}
-	settings.ratio = (uint8_t)result;
+	params->ratio = (uint8_t)result;
+	instance->params.publish();
 }
 
 // Alters the current number of bits by value (+ or -)
 // Clamps result to within min/max
-void bitcrush_bits_adjust(int16_t value){
-	int32_t result = settings.bits + value;
+void bitcrush_bits_adjust(bitcrush_instance_t *instance, int16_t value){
+	bitcrush_params_t *params = instance->params.edit();
+	int32_t result = params->bits + value;
 	if(result > BITS_MAX){
 		result = BITS_MAX;
 	}else if(result < BITS_MIN){
 		result = BITS_MIN;
 	}
-	settings.bits = (uint8_t)result;
+	params->bits = (uint8_t)result;
+	instance->params.publish();
+}
+
+// Copies my settings out for a preset
+uint8_t bitcrush_save(Effect_t *effect, uint8_t *data){
+	return ((bitcrush_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset
+void bitcrush_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	bitcrush_instance_t *instance = (bitcrush_instance_t *)effect->data;
+	if(instance->params.restore(data, length)) instance->params.publish();
 }
 
 // Sends a string of my state to stdout
-void bitcrush_report(){
-	features_t feat = (features_t)effect_Bitcrush.featureIdx;
+void bitcrush_report(Effect_t *effect){
+	bitcrush_instance_t *instance = (bitcrush_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
 
 	// Write to screen
 	if(feat == BITS){
@@ -171,7 +183,7 @@ void bitcrush_report(){
 		display.setTextColor(1);
 	}
 	display.print("Bits ");
-  display.print(settings.bits, DEC);
+  display.print(instance->params.read()->bits, DEC);
   
   if(feat == RATIO){
 		display.setTextColor(0);
@@ -181,9 +193,9 @@ void bitcrush_report(){
 	}
   display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
   display.print("Ratio ");
-  display.print(settings.ratio, DEC);
+  display.print(instance->params.read()->ratio, DEC);
   display.print(":1 ");
-  display.print(bitcrush_getHz(), DEC);
+  display.print(bitcrush_getHz(instance), DEC);
 	display.print("Hz");
 	
 	display.setTextColor(1);
@@ -192,6 +204,6 @@ void bitcrush_report(){
 }
 
 // Returns the frequency calculated from the step
-uint16_t bitcrush_getHz(){
-	return SAMPLERATE / settings.ratio;
+uint16_t bitcrush_getHz(bitcrush_instance_t *instance){
+	return SAMPLERATE / instance->params.read()->ratio;
 }
\ No newline at end of file
@@ -1,19 +1,80 @@
 /*
 	Header for Bitcrush Effect
 	Each Effect is self contained
-	The only interface declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_Bitcrush__
 #define __Effect_Bitcrush__
 
 #include "config.h"
 #include "Effect_typeDefs.h"
+#include "effect_params.h"
 
-extern Effect_t effect_Bitcrush;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *bitcrush_create();
 
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+// User parameters : Written by the main loop, read by the ISR
+// Both are discrete steps so there is nothing to smooth
+typedef struct {
+    uint8_t bits; // Number of bits for output
+    uint8_t ratio; // Sample rate ratio
+} bitcrush_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    uint8_t step; // position within ratio
+    int32_t buffer; // Saved sample
+    int32_t accumulator; // For averaging samples
+} bitcrush_settings_t;
+
+// One bitcrusher. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<bitcrush_params_t> params;
+    bitcrush_settings_t settings;
+} bitcrush_instance_t;
+
+// This is where the effect is actually processed
+inline int32_t bitcrush_process(Effect_t *effect, int32_t value){
+	bitcrush_instance_t *instance = (bitcrush_instance_t *)effect->data;
+	bitcrush_settings_t *settings = &instance->settings;
+	const bitcrush_params_t *params = instance->params.read();
+	uint8_t shift = 16 - params->bits;
+	int32_t result;
+  // Sample rate reduction : Done by only updating output every nth sample
+  if(settings->step == 0){
+  	// Save current sample
+  	settings->accumulator += value;
+  	// Calc average of prev N samples
+  	settings->buffer = settings->accumulator / params->ratio;
+  	result = settings->buffer;
+  	settings->accumulator = 0;
+  }else{
+  	// Use previously saved sample
+  	settings->accumulator += value;
+  	result = settings->buffer;
+  }
+	if(++settings->step >= params->ratio){
+		settings->step = 0;
+	}
+
+  // Bit depth reduction
+  if(shift){
+  	//Shift right to drop resolution
+  	result >>= shift;
+  	// Shift back up to retain amplitude
+  	result <<= shift;
+  }
+
+  return result;
+}
 
 #endif
@@ -0,0 +1,77 @@
+/*
+	Click free bypass
+
+	Switching an effect in or out between one sample and the next steps the
+	output (a click) and cuts a delay's echoes dead. So the chain doesn't
+	switch, it crossfades. Each effect has a level that the ISR ramps one
+	step a sample towards its state, over BYPASS_ONE samples (~6.4mS):
+	  Normally the level mixes between the dry input and the effect's output.
+	  In tails mode the level is on the effect's input instead. Turning off
+	  mutes what goes in but what is already in the delay carries on
+	  playing, so the echoes ring out.
+
+	Turning an effect off (see arena_toggle()) only sets it EFFECT_FADING.
+	The ISR keeps processing it until the level is down and, in tails mode,
+	its output has stayed under BYPASS_QUIET for the effect's tail length.
+	Then it sets faded and stops calling it, and the main loop turns it off
+	for real with arena_retire(), giving its delay memory back.
+	EFFECT_RESTART is the same, except the output is crossfaded even in
+	tails mode, as the effect is coming straight back on with new memory.
+	An EFFECT_WAITING effect has faded set and its level at 0 so is passed by.
+*/
+#ifndef __Effect_Bypass__
+#define __Effect_Bypass__
+
+#include <stdint.h>
+#include "Effect_typeDefs.h"
+
+#define BYPASS_SHIFT 8
+#define BYPASS_ONE (1 << BYPASS_SHIFT) // Level when on. Also the ramp length in samples
+#define BYPASS_QUIET 16 // A tail this small counts as silent. About -66dBFS, under the ADC's noise
+
+// Runs fx on one sample through the effect's bypass ramp
+// Inlined so the static chain gets its effect's process() inlined too
+inline int32_t bypass_process(Effect_t *effect, int32_t (*fx)(Effect_t*, int32_t), int32_t dry) __attribute__((always_inline));
+inline int32_t bypass_process(Effect_t *effect, int32_t (*fx)(Effect_t*, int32_t), int32_t dry){
+	uint16_t level = effect->bypass;
+	int32_t in, wet;
+
+	if(effect->state == EFFECT_ON){
+		if(level < BYPASS_ONE) effect->bypass = ++level;
+		effect->quiet = 0;
+	}else if(level > 0){
+		effect->bypass = --level;
+	}else if(effect->faded){
+		return dry;
+	}
+
+	if(effect->tails && effect->state != EFFECT_RESTART){
+		in = (dry * level) >> BYPASS_SHIFT;
+		wet = fx(effect, in) - in;
+		if(level == 0 && effect->state != EFFECT_ON){
+			// Muted. Done once the tail has been silent for long enough
+			if(wet > BYPASS_QUIET || wet < -BYPASS_QUIET) effect->quiet = 0;
+			else if(++effect->quiet >= effect->tail) effect->faded = 1;
+		}
+		return dry + wet;
+	}
+	wet = fx(effect, dry);
+	if(level == 0 && effect->state != EFFECT_ON) effect->faded = 1;
+	return dry + (((wet - dry) * level) >> BYPASS_SHIFT);
+}
+
+// Block version. A running effect that has finished ramping gets the whole
+// block at once, otherwise it goes a sample at a time through the ramp
+inline void bypass_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	if(effect->state == EFFECT_ON && effect->bypass == BYPASS_ONE){
+		effect->quiet = 0;
+		effect->processBlock(effect, block, n);
+		return;
+	}
+	while(n--){
+		*block = bypass_process(effect, effect->effectISR, *block);
+		block++;
+	}
+}
+
+#endif
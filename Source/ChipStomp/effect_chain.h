@@ -0,0 +1,71 @@
+/*
+	Compile time effect chain
+	
+	Walking the chain slots costs a state check and an indirect call per
+	effect per sample, and the compiler can't see through any of it. With STATIC_CHAIN set
+	the ISR calls a chain type declared in ChipStomp.pde instead:
+
+		typedef ChainStage<tremolo_process, 0,
+			ChainStage<echo_process, 1> > StaticChain_t;
+
+	Each stage is the effect's inline process() followed by the rest of the
+	chain, so the whole thing collapses into one function. Bit N of the mask
+	is set while the effect in slot N is on or fading out, and the stage
+	goes through the same bypass ramp as the slots walk (effect_bypass.h)
+	Stage N must be the effect in slot N so updateChainMask() lines up. The
+	slots hold one of each effect in g_effectTypes order and can't be
+	rearranged in this build (see effect_slots.cpp).
+
+	With COST_PROFILE each stage times itself with CP0 Count and raises the
+	slot's Effect_t.cost, as the slots walk in isr.pde does. Whoever
+	includes this must have PLIB.h in first for _CP0_GET_COUNT().
+
+	Plain templates only : the chipKIT toolchain doesn't do C++11/constexpr.
+*/
+#ifndef __Effect_Chain__
+#define __Effect_Chain__
+
+#include <stdint.h>
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_bypass.h"
+
+// Terminates a chain
+struct ChainEnd {
+	static inline int32_t process(int32_t value, uint32_t, Effect_t * const *){
+		return value;
+	}
+	static const uint8_t length = 0;
+};
+
+// One stage of the chain. FX must be an inline function visible here
+template <int32_t (*FX)(Effect_t*, int32_t), uint8_t BIT, class Next = ChainEnd>
+struct ChainStage {
+	static inline int32_t process(int32_t value, uint32_t mask, Effect_t * const *slots) __attribute__((always_inline)) {
+#if COST_PROFILE
+		uint32_t start, elapsed; // CP0 Count used to time this stage
+		if((mask >> BIT) & 1){
+			start = _CP0_GET_COUNT();
+			value = bypass_process(slots[BIT], FX, value);
+			// Keep the worst case so the budget check in loop() stays safe
+			elapsed = (_CP0_GET_COUNT() - start) * CP0_TICK_CYCLES;
+			if(elapsed > slots[BIT]->cost) slots[BIT]->cost = (uint16_t)elapsed;
+		}
+#else
+		if((mask >> BIT) & 1) value = bypass_process(slots[BIT], FX, value);
+#endif
+		return Next::process(value, mask, slots);
+	}
+	static const uint8_t length = Next::length + 1;
+};
+
+// Runs a chain over a block in place (see BLOCKSIZE)
+template <class Chain>
+inline void processChainBlock(int32_t *block, uint16_t n, uint32_t mask, Effect_t * const *slots){
+	while(n--){
+		*block = Chain::process(*block, mask, slots);
+		block++;
+	}
+}
+
+#endif
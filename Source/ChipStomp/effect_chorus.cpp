@@ -0,0 +1,304 @@
+/*
+	Chorus functions
+	Up to three voices, each a copy of the input delayed by a slowly
+	swept amount, mixed back in with the input. The small pitch wobbles
+	and timing differences sound like several players rather than one.
+
+	Where the Flanger has a line of its own for its one read head, all the
+	voices here read from one short line that is written once a sample.
+	They share one LFO too, each reading it a fraction of a cycle on from
+	the last. So more voices only cost more reads, never more memory : the
+	line is 2Kb from the delay arena whatever the number of voices.
+*/
+#include <PLIB.h>
+#include "effect_chorus.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+#include "delay_arena.h"
+
+//******** Private macros ********//
+
+#define FEATURECOUNT 4  // Note : Default feature is 0 : It does nothing
+#define FEATURE_LINES 3 // Lines of features that fit under the title
+#define COST 200 // Cycles per sample with all three voices from the host cost model (make bench), rounded up. Raised at runtime if measured higher
+#define DEPTH_MAX 0xffff
+#define DEPTH_MIN 0x0000
+#define RATE_MAX 500 // 5Hz
+#define RATE_MIN 5 // 0.05Hz
+#define MIX_MAX 0xffff
+#define MIX_MIN 0x0000
+
+//******** Private function declarations ********//
+
+void chor_nextFeature(Effect_t *effect);
+void chor_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t chor_toggleOnOff(Effect_t *effect);
+int32_t chor_effectISR(Effect_t *effect, int32_t value);
+void chor_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void chor_report(Effect_t *effect);
+uint8_t chor_save(Effect_t *effect, uint8_t *data);
+void chor_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void chor_depth_adjust(chor_instance_t *instance, int32_t value);
+void chor_rate_adjust(chor_instance_t *instance, int16_t value);
+void chor_voices_adjust(chor_instance_t *instance, int16_t value);
+void chor_mix_adjust(chor_instance_t *instance, int32_t value);
+void chor_setRate(chor_params_t *params);
+void chor_setVoices(chor_params_t *params);
+int32_t chor_stepAndClamp(int32_t value, int32_t step, int32_t min, int32_t max);
+
+//******** Private variables ********//
+
+// Every new instance starts from this. chor_create() works out the step, spread and gain
+static const chor_instance_t initial = {
+		{{{
+				0
+			, 0
+			, 80
+			, DEPTH_MAX / 3
+			, MIX_MAX / 2
+			, 0
+			, 2
+		}}}
+	, {
+				0
+			, 0
+			, (DEPTH_MAX / 3) << 8
+			, 0
+			, NULL
+		}
+};
+static EffectPool<chor_instance_t> pool;
+
+enum features_t {SAFE, DEPTH, RATE, VOICES, MIX};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_COARSE, ENC_CURVE_FINE, ENC_CURVE_NONE, ENC_CURVE_COARSE};
+
+// Copied into each instance by chor_create()
+static const Effect_t prototype = {
+		"Chorus"
+	, 0
+	, 0
+	, chor_nextFeature
+	, chor_adjustFeature
+	, chor_toggleOnOff
+	, chor_effectISR
+	, chor_processBlock
+	, chor_report
+	, COST
+	, featurecurves
+	, chor_save
+	, chor_load
+	, CHOR_BUFFSIZE
+};
+
+//******** Function definitions ********//
+
+// New instance for the chain
+Effect_t *chor_create(){
+	Effect_t *effect = pool.create(&prototype, &initial);
+	chor_instance_t *instance;
+	chor_params_t *params;
+	if(effect){
+		instance = (chor_instance_t *)effect->data;
+		params = instance->params.edit();
+		chor_setRate(params);
+		chor_setVoices(params);
+		instance->params.publish();
+	}
+	return effect;
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t chor_effectISR(Effect_t *effect, int32_t value){
+	return chor_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void chor_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = chor_process(effect, *block);
+		block++;
+	}
+}
+
+// Cycles my features
+void chor_nextFeature(Effect_t *effect){
+	if(FEATURECOUNT <= 1) return;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
+	}else{
+		// Skip the safe feature
+		effect->featureIdx = 1;
+	}
+}
+
+// Turns me on or off
+// The delay line comes from the arena. Refuses to turn on if it's full
+uint8_t chor_toggleOnOff(Effect_t *effect){
+	chor_settings_t *settings = &((chor_instance_t *)effect->data)->settings;
+	int16_t *buffer;
+	uint16_t size;
+	if(effect->state){
+		effect->state = 0;
+		buffer = settings->buffer;
+		settings->buffer = NULL;
+		arena_free(buffer);
+	}else{
+		buffer = arena_alloc(effect, CHOR_BUFFSIZE, CHOR_BUFFSIZE, &size);
+		if(buffer != NULL){
+			settings->position = 0;
+			// Last : The static chain starts using it as soon as this is set
+			settings->buffer = buffer;
+			effect->state = 1;
+		}
+	}
+	return effect->state;
+}
+
+// Adjust the value of the current feature
+// Receives the encoder delta
+void chor_adjustFeature(Effect_t *effect, int16_t value){
+	chor_instance_t *instance = (chor_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
+		case DEPTH:{
+			chor_depth_adjust(instance, (int32_t)value*255);
+			break;
+		}
+		case RATE:{
+			chor_rate_adjust(instance, value);
+			break;
+		}
+		case VOICES:{
+			chor_voices_adjust(instance, value);
+			break;
+		}
+		case MIX:{
+			chor_mix_adjust(instance, (int32_t)value*0xff);
+			break;
+		}
+	}
+}
+
+// value moved by step, clamped to within min/max
+int32_t chor_stepAndClamp(int32_t value, int32_t step, int32_t min, int32_t max){
+	int32_t result = value + step;
+	if(result > max){
+		result = max;
+	}else if(result < min){
+		result = min;
+	}
+	return result;
+}
+
+// Alters how far the voices are swept by value (+ or -)
+void chor_depth_adjust(chor_instance_t *instance, int32_t value){
+	chor_params_t *params = instance->params.edit();
+	params->depth = (uint16_t)chor_stepAndClamp(params->depth, value, DEPTH_MIN, DEPTH_MAX);
+	instance->params.publish();
+}
+
+// Alters the LFO rate by value x 0.05Hz (+ or -)
+void chor_rate_adjust(chor_instance_t *instance, int16_t value){
+	chor_params_t *params = instance->params.edit();
+	params->rate = (uint16_t)chor_stepAndClamp(params->rate, (int32_t)value * 5, RATE_MIN, RATE_MAX);
+	chor_setRate(params);
+	instance->params.publish();
+}
+
+// Adds or takes away a voice. Stops at either end
+void chor_voices_adjust(chor_instance_t *instance, int16_t value){
+	chor_params_t *params = instance->params.edit();
+	params->voices = (uint8_t)chor_stepAndClamp(params->voices, value, 1, CHOR_VOICES);
+	chor_setVoices(params);
+	instance->params.publish();
+}
+
+// Alters the wet level by value (+ or -)
+void chor_mix_adjust(chor_instance_t *instance, int32_t value){
+	chor_params_t *params = instance->params.edit();
+	params->mix = (uint16_t)chor_stepAndClamp(params->mix, value, MIX_MIN, MIX_MAX);
+	chor_setVoices(params);
+	instance->params.publish();
+}
+
+// Works out the LFO phase step from the rate
+void chor_setRate(chor_params_t *params){
+	params->step = (uint32_t)(((uint64_t)params->rate << 32) / (100UL * SAMPLERATE));
+}
+
+// Shares the LFO cycle and the mix out evenly between the voices, so the
+// wet level stays about the same as voices come and go
+void chor_setVoices(chor_params_t *params){
+	params->spread = (uint32_t)(((uint64_t)1 << 32) / params->voices);
+	params->gain = params->mix / params->voices;
+}
+
+// Copies my settings out for a preset
+uint8_t chor_save(Effect_t *effect, uint8_t *data){
+	return ((chor_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset. The step, spread and gain are worked
+// out again rather than trusted
+void chor_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	chor_instance_t *instance = (chor_instance_t *)effect->data;
+	chor_params_t *params = instance->params.restore(data, length);
+	if(params == NULL || params->voices < 1 || params->voices > CHOR_VOICES) return;
+	if(params->rate < RATE_MIN || params->rate > RATE_MAX) return;
+	chor_setRate(params);
+	chor_setVoices(params);
+	instance->params.publish();
+}
+
+// Sends a string of my state to stdout
+void chor_report(Effect_t *effect){
+	chor_instance_t *instance = (chor_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	const chor_params_t *params = instance->params.read();
+	uint8_t line, first, y;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case DEPTH:{
+				// Sweep either side of the centre delay
+				display.print("Depth ");
+				display.print((float)params->depth * CHOR_DEPTH_MAX * 1000 / 65536 / SAMPLERATE, 1);
+				display.print("mS");
+				break;
+			}
+			case RATE:{
+				display.print("Rate ");
+				display.print(params->rate / 100.0, 2);
+				display.print("Hz");
+				break;
+			}
+			case VOICES:{
+				display.print("Voices ");
+				display.print(params->voices, DEC);
+				break;
+			}
+			case MIX:{
+				display.print("Mix ");
+				display.print(percentage(params->mix, MIX_MAX, MIX_MIN), 0);
+				display.print("%");
+				break;
+			}
+		}
+	}
+	display.setTextColor(1);
+}
@@ -0,0 +1,98 @@
+/*
+	Header for Chorus Effect
+	Each Effect is self contained
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
+
+	Effects must provide a struct to comply with Effect_t;
+
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
+*/
+#ifndef __Effect_Chorus__
+#define __Effect_Chorus__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *chor_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define CHOR_BUFFSIZE 1024 // Samples of delay line shared by all the voices
+#define CHOR_CENTRE 512 // Delay at the centre of the sweep. ~13mS @ 40kHz
+#define CHOR_DEPTH_MAX 256 // Most the sweep goes either side of CHOR_CENTRE
+#if CHOR_DEPTH_MAX >= CHOR_CENTRE || CHOR_CENTRE + CHOR_DEPTH_MAX >= CHOR_BUFFSIZE
+#error "The chorus sweep must stay between the write position and the oldest sample"
+#endif
+#define CHOR_VOICES 3 // Most voices reading the line
+#define CHOR_PHASE_SHIFT 14 // Bits of LFO phase below a dsp_sine() position. The full 32bits is one cycle
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint32_t step; // LFO phase added per sample. Set by chor_setRate()
+    uint32_t spread; // LFO phase between voices. Set by chor_setVoices()
+    uint16_t rate; // LFO Hz x 100
+    uint16_t depth; // Sweep either side of CHOR_CENTRE, Q16 of CHOR_DEPTH_MAX
+    uint16_t mix; // Wet level
+    uint16_t gain; // mix shared between the voices. Set by chor_setVoices()
+    uint8_t voices; // 1 to CHOR_VOICES
+} chor_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    uint32_t location; // LFO phase shared by the voices
+    uint16_t position; // Buffer write index
+    int32_t depth; // Smoothed depth with 8bits of fraction
+    int32_t gain; // Smoothed voice gain with 8bits of fraction
+    int16_t *buffer; // From the delay arena while on. NULL when off
+} chor_settings_t;
+
+// One chorus. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<chor_params_t> params;
+    chor_settings_t settings;
+} chor_instance_t;
+
+// This is where the effect is actually processed
+// The Flanger's modulated read, done once for each voice on the same line.
+// The voices are spread evenly round the one LFO, so each is swept away
+// from the others. A voice costs a sine and an interpolated read, ~25 cycles
+inline int32_t chor_process(Effect_t *effect, int32_t value){
+	chor_instance_t *instance = (chor_instance_t *)effect->data;
+	chor_settings_t *settings = &instance->settings;
+	const chor_params_t *params = instance->params.read();
+	int16_t *buffer = settings->buffer;
+	uint32_t phase, centre;
+	uint16_t depth;
+	int32_t wet = 0;
+	uint8_t voice;
+
+	// Can be called for a moment after being turned off
+	if(buffer == NULL) return value;
+
+	depth = (uint16_t)dsp_smooth(&settings->depth, params->depth, SMOOTH_FAST);
+	settings->location += params->step;
+
+	// One write whatever the number of voices
+	buffer[settings->position++] = (int16_t)dsp_sat16(value);
+	if(settings->position >= CHOR_BUFFSIZE) settings->position = 0;
+
+	// Read position CHOR_CENTRE behind, with 8bits of fraction
+	centre = (uint32_t)(settings->position + CHOR_BUFFSIZE - CHOR_CENTRE) << 8;
+	phase = settings->location;
+	for(voice=0; voice < params->voices; voice++){
+		// Sine times depth is Q15 of the full sweep. Times CHOR_DEPTH_MAX
+		// is samples with 15bits of fraction, so >> 7 leaves the 8 read wants
+		wet += dsp_delayRead(buffer, CHOR_BUFFSIZE, centre + ((dsp_mulQ16(dsp_sine(phase >> CHOR_PHASE_SHIFT), depth) * CHOR_DEPTH_MAX) >> 7), 8);
+		phase += params->spread;
+	}
+	// Up to CHOR_VOICES x full scale, so 64bits for the gain
+	return value + (int32_t)(((int64_t)wet * dsp_smooth(&settings->gain, params->gain, SMOOTH_FAST)) >> 16);
+}
+
+#endif
@@ -0,0 +1,307 @@
+/*
+	Compressor functions
+	A compressor with a noise gate in front of it. Over the threshold the
+	level is squashed by the ratio, and the gain that takes off a full
+	scale signal is half given back so the effect isn't just quieter.
+	Under the gate threshold the level falls away steeply, which shuts
+	out hum and hiss between notes. Move it ahead of Echo and Bitcrush
+	so they don't bring the hum up first.
+
+	The level is the envelope of either the peaks or the RMS. It rises
+	quickly and falls at the release rate, which is also how slowly the
+	gate closes.
+
+	Everything the ISR needs is worked out here in the main loop as logs
+	(see dsp_log2() in dsp_fixed.h), so the ISR has no division or float.
+*/
+#include <PLIB.h>
+#include "effect_compressor.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+
+//******** Private macros ********//
+
+#define FEATURECOUNT 5  // Note : Default feature is 0 : It does nothing
+#define FEATURE_LINES 3 // Lines of features that fit under the title
+#define COST 80 // Cycles per sample from the host cost model (make bench), rounded up. Raised at runtime if measured higher
+#define THRESHOLD_MIN -48 // dB
+#define THRESHOLD_MAX 0 // dB
+#define GATE_OFF -55 // dB. The setting below GATE_MIN
+#define GATE_MIN -54 // dB. One LSB of the 10bit ADC, shifted up to 16bits
+#define GATE_MAX -24 // dB
+#define RELEASE_MIN 8 // ~6mS @ 40kHz
+#define RELEASE_MAX 14 // ~410mS @ 40kHz
+#define RATIOS 10
+#define LOG_DB 10885 // One dB as a log : 2^16 / 20log10(2)
+
+//******** Private function declarations ********//
+
+void comp_nextFeature(Effect_t *effect);
+void comp_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t comp_toggleOnOff(Effect_t *effect);
+int32_t comp_effectISR(Effect_t *effect, int32_t value);
+void comp_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void comp_report(Effect_t *effect);
+uint8_t comp_save(Effect_t *effect, uint8_t *data);
+void comp_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void comp_threshold_adjust(comp_instance_t *instance, int16_t value);
+void comp_ratio_adjust(comp_instance_t *instance, int16_t value);
+void comp_release_adjust(comp_instance_t *instance, int16_t value);
+void comp_gate_adjust(comp_instance_t *instance, int16_t value);
+void comp_detect_adjust(comp_instance_t *instance, int16_t value);
+void comp_setCurve(comp_params_t *params);
+int32_t comp_stepAndClamp(int32_t value, int16_t step, int32_t min, int32_t max);
+
+//******** Private variables ********//
+
+// Every new instance starts from this. comp_create() works out the logs
+static const comp_instance_t initial = {
+		{{{
+				-18
+			, GATE_OFF
+			, 4
+			, 11
+			, COMP_PEAK
+		}}}
+	, {
+				0
+			, 0
+		}
+};
+static EffectPool<comp_instance_t> pool;
+
+enum features_t {SAFE, THRESHOLD, RATIO, RELEASE, GATE, DETECT};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_FINE, ENC_CURVE_NONE, ENC_CURVE_NONE, ENC_CURVE_FINE, ENC_CURVE_NONE};
+static const char *rationames[RATIOS] = {"1:1", "1.5:1", "2:1", "3:1", "4:1", "6:1", "8:1", "12:1", "20:1", "Limit"};
+static const uint16_t ratioslopes[RATIOS] = {0, 85, 128, 171, 192, 213, 224, 235, 243, 256}; // 256 x (1 - 1/ratio)
+static const char *detectnames[COMP_DETECTS] = {"Peak", "RMS"};
+
+// Copied into each instance by comp_create()
+static const Effect_t prototype = {
+		"Compressor"
+	, 0
+	, 0
+	, comp_nextFeature
+	, comp_adjustFeature
+	, comp_toggleOnOff
+	, comp_effectISR
+	, comp_processBlock
+	, comp_report
+	, COST
+	, featurecurves
+	, comp_save
+	, comp_load
+};
+
+//******** Function definitions ********//
+
+// New instance for the chain
+Effect_t *comp_create(){
+	Effect_t *effect = pool.create(&prototype, &initial);
+	comp_instance_t *instance;
+	if(effect){
+		instance = (comp_instance_t *)effect->data;
+		comp_setCurve(instance->params.edit());
+		instance->params.publish();
+	}
+	return effect;
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t comp_effectISR(Effect_t *effect, int32_t value){
+	return comp_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void comp_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = comp_process(effect, *block);
+		block++;
+	}
+}
+
+// Cycles my features
+void comp_nextFeature(Effect_t *effect){
+	if(FEATURECOUNT <= 1) return;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
+	}else{
+		// Skip the safe feature
+		effect->featureIdx = 1;
+	}
+}
+
+// Turns me on or off
+uint8_t comp_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
+}
+
+// Adjust the value of the current feature
+// Receives the encoder delta
+void comp_adjustFeature(Effect_t *effect, int16_t value){
+	comp_instance_t *instance = (comp_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
+		case THRESHOLD:{
+			comp_threshold_adjust(instance, value);
+			break;
+		}
+		case RATIO:{
+			comp_ratio_adjust(instance, value);
+			break;
+		}
+		case RELEASE:{
+			comp_release_adjust(instance, value);
+			break;
+		}
+		case GATE:{
+			comp_gate_adjust(instance, value);
+			break;
+		}
+		case DETECT:{
+			comp_detect_adjust(instance, value);
+			break;
+		}
+	}
+}
+
+// Alters the threshold by value dB (+ or -)
+void comp_threshold_adjust(comp_instance_t *instance, int16_t value){
+	comp_params_t *params = instance->params.edit();
+	params->threshold = (int8_t)comp_stepAndClamp(params->threshold, value, THRESHOLD_MIN, THRESHOLD_MAX);
+	comp_setCurve(params);
+	instance->params.publish();
+}
+
+// Picks the next or previous ratio. Stops at either end
+void comp_ratio_adjust(comp_instance_t *instance, int16_t value){
+	comp_params_t *params = instance->params.edit();
+	params->ratio = (uint8_t)comp_stepAndClamp(params->ratio, value, 0, RATIOS - 1);
+	comp_setCurve(params);
+	instance->params.publish();
+}
+
+// Doubles or halves the release time for each step (+ or -)
+void comp_release_adjust(comp_instance_t *instance, int16_t value){
+	comp_params_t *params = instance->params.edit();
+	params->release = (uint8_t)comp_stepAndClamp(params->release, value, RELEASE_MIN, RELEASE_MAX);
+	instance->params.publish();
+}
+
+// Alters the gate threshold by value dB (+ or -). Off below GATE_MIN
+void comp_gate_adjust(comp_instance_t *instance, int16_t value){
+	comp_params_t *params = instance->params.edit();
+	params->gate = (int8_t)comp_stepAndClamp(params->gate, value, GATE_OFF, GATE_MAX);
+	comp_setCurve(params);
+	instance->params.publish();
+}
+
+// Switches between following the peaks and the RMS
+void comp_detect_adjust(comp_instance_t *instance, int16_t value){
+	comp_params_t *params = instance->params.edit();
+	params->detect = (uint8_t)comp_stepAndClamp(params->detect, value, 0, COMP_DETECTS - 1);
+	instance->params.publish();
+}
+
+// value moved by step, clamped to within min/max
+int32_t comp_stepAndClamp(int32_t value, int16_t step, int32_t min, int32_t max){
+	int32_t result = value + step;
+	if(result > max){
+		result = max;
+	}else if(result < min){
+		result = min;
+	}
+	return result;
+}
+
+// Works out the logs the ISR uses from the dB settings
+void comp_setCurve(comp_params_t *params){
+	params->slope = ratioslopes[params->ratio];
+	params->thresholdLog = COMP_FULLSCALE + params->threshold * LOG_DB;
+	params->gateLog = (params->gate == GATE_OFF) ? 0 : COMP_FULLSCALE + params->gate * LOG_DB;
+	// Half what a full scale level loses
+	params->makeup = ((COMP_FULLSCALE - params->thresholdLog) * params->slope) >> 9;
+}
+
+// Copies my settings out for a preset
+uint8_t comp_save(Effect_t *effect, uint8_t *data){
+	return ((comp_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset. The logs are worked out again rather
+// than trusted
+void comp_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	comp_instance_t *instance = (comp_instance_t *)effect->data;
+	comp_params_t *params = instance->params.restore(data, length);
+	if(params == NULL || params->ratio >= RATIOS || params->detect >= COMP_DETECTS) return;
+	if(params->threshold < THRESHOLD_MIN || params->threshold > THRESHOLD_MAX) return;
+	if(params->gate > GATE_MAX) return;
+	if(params->release < RELEASE_MIN || params->release > RELEASE_MAX) return;
+	// Presets from when the gate went lower. Under one LSB it did nothing anyway
+	if(params->gate < GATE_MIN) params->gate = GATE_OFF;
+	comp_setCurve(params);
+	instance->params.publish();
+}
+
+// Sends a string of my state to stdout
+void comp_report(Effect_t *effect){
+	comp_instance_t *instance = (comp_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	const comp_params_t *params = instance->params.read();
+	uint8_t line, first, y;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case THRESHOLD:{
+				display.print("Threshold ");
+				display.print(params->threshold, DEC);
+				display.print("dB");
+				break;
+			}
+			case RATIO:{
+				display.print("Ratio ");
+				display.print(rationames[params->ratio]);
+				break;
+			}
+			case RELEASE:{
+				display.print("Release ");
+				display.print((1000L << params->release) / SAMPLERATE, DEC);
+				display.print("mS");
+				break;
+			}
+			case GATE:{
+				display.print("Gate ");
+				if(params->gate == GATE_OFF){
+					display.print("off");
+				}else{
+					display.print(params->gate, DEC);
+					display.print("dB");
+				}
+				break;
+			}
+			case DETECT:{
+				display.print("Detect ");
+				display.print(detectnames[params->detect]);
+				break;
+			}
+		}
+	}
+	display.setTextColor(1);
+}
@@ -0,0 +1,130 @@
+/*
+	Header for Compressor Effect
+	Each Effect is self contained
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
+
+	Effects must provide a struct to comply with Effect_t;
+
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
+*/
+#ifndef __Effect_Compressor__
+#define __Effect_Compressor__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *comp_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define COMP_FULLSCALE (15L << DSP_LOG_SHIFT) // Log of a full scale level
+#define COMP_ATTACK_SHIFT 4 // Envelope rise ~0.4mS @ 40kHz
+#define COMP_POWER_SHIFT 6 // RMS averaging ~1.6mS @ 40kHz
+#define COMP_ENV_SHIFT 8 // Extra fraction bits of the envelope so a slow release doesn't stall
+#define COMP_GATE_RATIO 4 // dB of cut per dB under the gate threshold
+#define COMP_CONTROL_SHIFT 2 // The gain is worked out every 4 samples. comp_process() has a stage for each
+#define COMP_CONTROL (1 << COMP_CONTROL_SHIFT)
+
+enum compdetect_t {COMP_PEAK, COMP_RMS, COMP_DETECTS};
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    int8_t threshold; // dB below full scale
+    int8_t gate; // dB below full scale. The lowest setting is no gate
+    uint8_t ratio; // Choice of ratio
+    uint8_t release; // Envelope fall time constant, as a shift
+    uint8_t detect; // compdetect_t
+    uint16_t slope; // 1 - 1/ratio with 8bits of fraction. Set by comp_setCurve()
+    int32_t thresholdLog; // Threshold as a log. Set by comp_setCurve()
+    int32_t gateLog; // Gate threshold as a log. 0 when off. Set by comp_setCurve()
+    int32_t makeup; // Log gain back. Set by comp_setCurve()
+} comp_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    int32_t power; // Leaky average of the input squared
+    int32_t envelope; // Log level with COMP_ENV_SHIFT more bits of fraction
+    uint32_t detected; // Peak or sum of squares since the level was last taken
+    int32_t level; // Log level handed from one control stage to the next
+    int32_t gain; // Gain with 16bits of fraction, stepped towards the last one worked out
+    int32_t step; // Added to gain each sample
+    uint8_t count; // Control stage. Counts samples round COMP_CONTROL
+} comp_settings_t;
+
+// One compressor. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<comp_params_t> params;
+    comp_settings_t settings;
+} comp_instance_t;
+
+// This is where the effect is actually processed
+// The level is followed in the log domain, where the one-pole moves by a
+// number of dB rather than a fraction of the level, so the release is
+// even. Then over the threshold each dB of level is cut by slope dB and
+// under the gate each dB is cut by COMP_GATE_RATIO more, all as adds and
+// a multiply. The only conversion back out of logs is the gain itself.
+// The gain is only worked out every COMP_CONTROL samples and stepped
+// evenly between. Each sample keeps the peak or sums the square, applies
+// the gain and does one stage of working out the next : the log, the
+// envelope, the curve, then the gain back out of logs. So no one sample
+// pays for more than one of them, as the ISR has to fit the worst sample.
+// That adds up to 0.2mS to the attack.
+inline int32_t comp_process(Effect_t *effect, int32_t value){
+	comp_instance_t *instance = (comp_instance_t *)effect->data;
+	comp_settings_t *settings = &instance->settings;
+	const comp_params_t *params = instance->params.read();
+	uint32_t magnitude = (value < 0) ? -value : value;
+	int32_t level, over;
+
+	if(magnitude > 32767) magnitude = 32767;
+	if(params->detect == COMP_RMS){
+		// Four squares of up to 2^30 fit 32bits unsigned
+		settings->detected += magnitude * magnitude;
+	}else{
+		// A select rather than a branch. MIPS32 has MOVN for it
+		settings->detected = (magnitude > settings->detected) ? magnitude : settings->detected;
+	}
+
+	// The one-poles run COMP_CONTROL times slower, so move that much further each time
+	switch(settings->count++ & (COMP_CONTROL - 1)){
+		case 0:{
+			if(params->detect == COMP_RMS){
+				// Half the log of the mean square is the log of the RMS
+				level = dsp_log2(dsp_onePole(&settings->power, settings->detected >> COMP_CONTROL_SHIFT, COMP_POWER_SHIFT - COMP_CONTROL_SHIFT)) >> 1;
+			}else{
+				level = dsp_log2(settings->detected);
+			}
+			settings->detected = 0;
+			settings->level = level << COMP_ENV_SHIFT;
+			break;
+		}
+		case 1:{
+			level = settings->level;
+			dsp_onePole(&settings->envelope, level, ((level > settings->envelope) ? COMP_ATTACK_SHIFT : params->release) - COMP_CONTROL_SHIFT);
+			break;
+		}
+		case 2:{
+			level = settings->envelope >> COMP_ENV_SHIFT;
+			settings->level = params->makeup;
+			over = level - params->thresholdLog;
+			if(over > 0) settings->level -= (over * params->slope) >> 8;
+			over = params->gateLog - level;
+			if(over > 0) settings->level -= over * COMP_GATE_RATIO;
+			break;
+		}
+		default:{
+			settings->step = ((int32_t)dsp_exp2(settings->level) - settings->gain) >> COMP_CONTROL_SHIFT;
+			break;
+		}
+	}
+	settings->gain += settings->step;
+	return dsp_sat16((int32_t)(((int64_t)value * settings->gain) >> DSP_LOG_SHIFT));
+}
+
+#endif
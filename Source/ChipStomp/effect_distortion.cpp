@@ -0,0 +1,280 @@
+/*
+	Distortion functions
+	Drives the input into one of a few waveshaper curves : soft clipping,
+	hard clipping, an asymmetric one that adds even harmonics, and a
+	biased fuzz. Drive sets how far up the curve the signal goes, so it is
+	effectively the clipping threshold. Level sets the output volume.
+
+	The curves are tables in flash, interpolated by dsp_curve(), so a curve
+	costs the same whatever its shape. They are generated by curvegen in
+	Source/HostSim into distortion_curves.inc. See effect_distortion.h for
+	the 2x oversampling. The host sim's -a option measures the aliasing it
+	saves and what it costs : about 9dB less aliasing for over twice the
+	cycles. So it can be turned off, and the effect's cost follows it.
+*/
+#include <PLIB.h>
+#include "effect_distortion.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+
+//******** Private macros ********//
+
+#define FEATURECOUNT 4  // Note : Default feature is 0 : It does nothing
+#define FEATURE_LINES 3 // Lines of features that fit under the title
+#define COST 200 // Cycles per sample oversampled from the host cost model (make alias), rounded up. Raised at runtime if measured higher
+#define COST_1X 80 // The same without oversampling
+#define DRIVE_MIN (1 << DIST_DRIVE_SHIFT) // x1
+#define DRIVE_MAX (64 << DIST_DRIVE_SHIFT) // x64, 36dB
+#define LEVEL_MAX 0xffff
+#define LEVEL_MIN 0x0000
+
+//******** Private function declarations ********//
+
+void dist_nextFeature(Effect_t *effect);
+void dist_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t dist_toggleOnOff(Effect_t *effect);
+int32_t dist_effectISR(Effect_t *effect, int32_t value);
+void dist_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void dist_report(Effect_t *effect);
+uint8_t dist_save(Effect_t *effect, uint8_t *data);
+void dist_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void dist_drive_adjust(dist_instance_t *instance, int16_t value);
+void dist_shape_adjust(dist_instance_t *instance, int16_t value);
+void dist_level_adjust(dist_instance_t *instance, int32_t value);
+void dist_oversample_adjust(Effect_t *effect, int16_t value);
+void dist_setCost(Effect_t *effect, uint8_t from, uint8_t to);
+
+//******** Private variables ********//
+
+// Every new instance starts from this
+static const dist_instance_t initial = {
+		{{{
+				4 << DIST_DRIVE_SHIFT
+			,	LEVEL_MAX / 4
+			, DIST_SOFT
+			, 1
+		}}}
+	, {
+				(4 << DIST_DRIVE_SHIFT) << 8
+			,	(LEVEL_MAX / 4) << 8
+		}
+};
+static EffectPool<dist_instance_t> pool;
+
+enum features_t {SAFE, DRIVE, SHAPE, LEVEL, OVERSAMPLE};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_FINE, ENC_CURVE_NONE, ENC_CURVE_COARSE, ENC_CURVE_NONE};
+static const char *shapenames[DIST_SHAPES] = {"Soft", "Hard", "Asym", "Fuzz"};
+
+// Copied into each instance by dist_create()
+static const Effect_t prototype = {
+		"Distortion"
+	, 0
+	, 0
+	, dist_nextFeature
+	, dist_adjustFeature
+	, dist_toggleOnOff
+	, dist_effectISR
+	, dist_processBlock
+	, dist_report
+	, COST
+	, featurecurves
+	, dist_save
+	, dist_load
+};
+
+//******** Global variables ********//
+
+const int16_t dist_curves[DIST_SHAPES][DSP_CURVE_LEN] = {
+	#include "distortion_curves.inc"
+};
+
+//******** Function definitions ********//
+
+// New instance for the chain
+Effect_t *dist_create(){
+	return pool.create(&prototype, &initial);
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t dist_effectISR(Effect_t *effect, int32_t value){
+	return dist_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void dist_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = dist_process(effect, *block);
+		block++;
+	}
+}
+
+// Cycles my features
+void dist_nextFeature(Effect_t *effect){
+	if(FEATURECOUNT <= 1) return;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
+	}else{
+		// Skip the safe feature
+		effect->featureIdx = 1;
+	}
+}
+
+// Turns me on or off
+uint8_t dist_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
+}
+
+// Adjust the value of the current feature
+// Receives the encoder delta
+void dist_adjustFeature(Effect_t *effect, int16_t value){
+	dist_instance_t *instance = (dist_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
+		case DRIVE:{
+			dist_drive_adjust(instance, value);
+			break;
+		}
+		case SHAPE:{
+			dist_shape_adjust(instance, value);
+			break;
+		}
+		case LEVEL:{
+			dist_level_adjust(instance, (int32_t)value*0xff);
+			break;
+		}
+		case OVERSAMPLE:{
+			dist_oversample_adjust(effect, value);
+			break;
+		}
+	}
+}
+
+// Alters the drive by value steps of about half a dB each (+ or -)
+// Clamps result to within min/max
+void dist_drive_adjust(dist_instance_t *instance, int16_t value){
+	dist_params_t *params = instance->params.edit();
+	int32_t result = params->drive + (int32_t)value * ((params->drive >> 4) + 1);
+	if(result > DRIVE_MAX){
+		result = DRIVE_MAX;
+	}else if(result < DRIVE_MIN){
+		result = DRIVE_MIN;
+	}
+	params->drive = (uint16_t)result;
+	instance->params.publish();
+}
+
+// Picks the next or previous curve. Stops at either end
+void dist_shape_adjust(dist_instance_t *instance, int16_t value){
+	dist_params_t *params = instance->params.edit();
+	int32_t result = params->shape + value;
+	if(result >= DIST_SHAPES){
+		result = DIST_SHAPES - 1;
+	}else if(result < 0){
+		result = 0;
+	}
+	params->shape = (uint8_t)result;
+	instance->params.publish();
+}
+
+// Alters the output level by value (+ or -)
+// Clamps result to within min/max
+void dist_level_adjust(dist_instance_t *instance, int32_t value){
+	dist_params_t *params = instance->params.edit();
+	int32_t result = params->level + value;
+	if(result > LEVEL_MAX){
+		result = LEVEL_MAX;
+	}else if(result < LEVEL_MIN){
+		result = LEVEL_MIN;
+	}
+	params->level = (uint16_t)result;
+	instance->params.publish();
+}
+
+// Turns oversampling on (+) or off (-). My cost goes with it
+void dist_oversample_adjust(Effect_t *effect, int16_t value){
+	dist_instance_t *instance = (dist_instance_t *)effect->data;
+	uint8_t from = instance->params.read()->oversample;
+	dist_params_t *params = instance->params.edit();
+	params->oversample = value > 0;
+	dist_setCost(effect, from, params->oversample);
+	instance->params.publish();
+}
+
+// Moves my cost from one oversampling setting's figure to the other's.
+// Anything the ISR has measured over the old figure is kept on top, so a
+// worst case COST_PROFILE has already seen is never forgotten
+void dist_setCost(Effect_t *effect, uint8_t from, uint8_t to){
+	uint16_t cost = from ? COST : COST_1X;
+	uint16_t over = (effect->cost > cost) ? effect->cost - cost : 0;
+	if(from == to) return;
+	effect->cost = (to ? COST : COST_1X) + over;
+}
+
+// Copies my settings out for a preset
+uint8_t dist_save(Effect_t *effect, uint8_t *data){
+	return ((dist_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset
+void dist_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	dist_instance_t *instance = (dist_instance_t *)effect->data;
+	uint8_t from = instance->params.read()->oversample;
+	dist_params_t *params = instance->params.restore(data, length);
+	// A damaged shape would index past the curves
+	if(params == NULL || params->shape >= DIST_SHAPES || params->oversample > 1) return;
+	dist_setCost(effect, from, params->oversample);
+	instance->params.publish();
+}
+
+// Sends a string of my state to stdout
+void dist_report(Effect_t *effect){
+	dist_instance_t *instance = (dist_instance_t *)effect->data;
+	const dist_params_t *params = instance->params.read();
+	features_t feat = (features_t)effect->featureIdx;
+	uint8_t line, first, y;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case DRIVE:{
+				display.print("Drive ");
+				display.print(20 * log10((float)params->drive / DRIVE_MIN), 1);
+				display.print("dB");
+				break;
+			}
+			case SHAPE:{
+				display.print("Shape ");
+				display.print(shapenames[params->shape]);
+				break;
+			}
+			case LEVEL:{
+				display.print("Level ");
+				display.print(percentage(params->level, LEVEL_MAX, LEVEL_MIN), 2);
+				display.print("%");
+				break;
+			}
+			case OVERSAMPLE:{
+				display.print("Oversample ");
+				display.print(params->oversample ? "2x" : "off");
+				break;
+			}
+		}
+	}
+	display.setTextColor(1);
+}
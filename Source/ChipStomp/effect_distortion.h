@@ -0,0 +1,125 @@
+/*
+	Header for Distortion Effect
+	Each Effect is self contained
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
+
+	Effects must provide a struct to comply with Effect_t;
+
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
+*/
+#ifndef __Effect_Distortion__
+#define __Effect_Distortion__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *dist_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define DIST_DRIVE_SHIFT 8 // Fraction bits of the drive gain
+#define DIST_DC_SHIFT 9 // DC blocker corner ~12Hz @ 40kHz
+#define DIST_TAPS 6 // Input and output history of the halfband filters
+
+// Waveshaper curves, generated by curvegen in Source/HostSim
+enum distshape_t {DIST_SOFT, DIST_HARD, DIST_ASYM, DIST_FUZZ, DIST_SHAPES};
+extern const int16_t dist_curves[DIST_SHAPES][DSP_CURVE_LEN];
+
+// 11 tap halfband lowpass, Q15. Every other tap is 0 bar the centre one of
+// 1/2, so only these three are multiplied. They sum to 1/4 for unity gain
+// at DC. Passband flat to 0.03dB up to 10kHz, stopband -47dB from 30kHz
+#define DIST_HB1 9841
+#define DIST_HB3 -2038
+#define DIST_HB5 389
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t drive; // Gain into the shaper with DIST_DRIVE_SHIFT bits of fraction
+    uint16_t level; // Output gain
+    uint8_t shape; // distshape_t
+    uint8_t oversample; // 1 to shape at twice the rate, 0 for straight into the curve
+} dist_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    int32_t drive; // Smoothed drive with 8bits of fraction
+    int32_t level; // Smoothed level with 8bits of fraction
+    int32_t dc; // DC level with 8bits of fraction
+    int32_t in[DIST_TAPS]; // Driven input, newest first
+    int32_t even[DIST_TAPS]; // Shaped even phase at twice the rate, newest first
+    int32_t odd[DIST_TAPS / 2 + 1]; // Shaped odd phase, newest first
+} dist_settings_t;
+
+// One distortion. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<dist_params_t> params;
+    dist_settings_t settings;
+} dist_instance_t;
+
+// This is where the effect is actually processed
+// Shaping makes harmonics that would fold back below 20kHz as inharmonic
+// aliases. So the shaper runs at twice the sample rate : the input is
+// upsampled, each of the two samples shaped, then filtered back down.
+// Both filters are the one halfband split into its two phases. One phase
+// is a plain delay, so each direction costs just the three multiplies.
+// Without oversampling the driven input goes straight into the curve.
+inline int32_t dist_process(Effect_t *effect, int32_t value){
+	dist_instance_t *instance = (dist_instance_t *)effect->data;
+	dist_settings_t *settings = &instance->settings;
+	const dist_params_t *params = instance->params.read();
+	const int16_t *curve = dist_curves[params->shape];
+	int32_t *in = settings->in;
+	int32_t *even = settings->even;
+	int32_t *odd = settings->odd;
+	int32_t drive, level, driven, result;
+	dsp_acc_t acc;
+	uint8_t idx;
+
+	drive = dsp_smooth(&settings->drive, params->drive, SMOOTH_FAST);
+	level = dsp_smooth(&settings->level, params->level, SMOOTH_FAST);
+
+	// An int16 sample by up to x64 fits 32bits. The shaper clamps it
+	driven = (value * drive) >> DIST_DRIVE_SHIFT;
+
+	if(!params->oversample){
+		result = dsp_curve(curve, driven);
+	}else{
+		for(idx=DIST_TAPS-1; idx > 0; idx--){
+			in[idx] = in[idx - 1];
+			even[idx] = even[idx - 1];
+		}
+		for(idx=DIST_TAPS/2; idx > 0; idx--){
+			odd[idx] = odd[idx - 1];
+		}
+		in[0] = driven;
+
+		// Up : The even sample half way between in[2] and in[3] is the filter
+		// with its taps doubled to make up for the zeros stuffed between samples.
+		// The odd one lands on the centre tap so is in[2] itself
+		acc = dsp_mac(0, in[0] + in[5], 2 * DIST_HB5);
+		acc = dsp_mac(acc, in[1] + in[4], 2 * DIST_HB3);
+		acc = dsp_mac(acc, in[2] + in[3], 2 * DIST_HB1);
+		even[0] = dsp_curve(curve, (int32_t)(acc >> 15));
+		odd[0] = dsp_curve(curve, in[2]);
+
+		// Down : Only every other output is needed, so again the filter on the
+		// even samples plus half the odd one at the centre
+		acc = dsp_mac(0, even[0] + even[5], DIST_HB5);
+		acc = dsp_mac(acc, even[1] + even[4], DIST_HB3);
+		acc = dsp_mac(acc, even[2] + even[3], DIST_HB1);
+		acc = dsp_mac(acc, odd[3], 1 << 14);
+		result = (int32_t)(acc >> 15);
+	}
+
+	// Asymmetric curves leave a DC offset that would thump as the input comes and goes
+	result -= dsp_onePole(&settings->dc, result << 8, DIST_DC_SHIFT) >> 8;
+	return dsp_mulQ16(dsp_sat16(result), (uint16_t)level);
+}
+
+#endif
@@ -12,10 +12,10 @@
 //******** Private function declarations ********//
 
 void nextFeature();
-void dummy_adjustFeature(int16_t value);
-uint8_t dummy_toggleOnOff();
+void dummy_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t dummy_toggleOnOff(Effect_t *effect);
 int32_t effectISR(int16_t value);
-void dummy_report();
+void dummy_report(Effect_t *effect);
 
 //******** Private variables ********//
 
@@ -33,7 +33,12 @@ Effect_t effect_dummy = {
 	, dummy_adjustFeature
 	, dummy_toggleOnOff
 	, 0
+	, 0
 	, dummy_report
+	, 0
+	, NULL
+	, NULL
+	, NULL
 };
 /*
 	, nextFeature
@@ -46,20 +51,20 @@ Effect_t effect_dummy = {
 //******** Function definitions ********//
 
 // Cycles my features
-uint8_t dummy_toggleOnOff(){
-	if(effect_dummy.state) effect_dummy.state = 0;
-	else effect_dummy.state = 1;
-	return effect_dummy.state;
+uint8_t dummy_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
 }
 
 // Adjust the value of the current feature
 // Receives the encoder delta
-void dummy_adjustFeature(int16_t value){
+void dummy_adjustFeature(Effect_t *effect, int16_t value){
 	// Currently hard coded to alter the step
 	
 }
 
 // Sends a string of my state to stdout
-void dummy_report(){
+void dummy_report(Effect_t *effect){
 	// Serial.println("Dummy has no state.");
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 /*
 	Echo functions
-	Currently only a single tap.
+	One to four taps on the one tape.
 
 	This echo has a lo-fi "tape" that records the current input. This is then 
 	tapped at an adjustable delay offset and amplitude to introduce an echo.
@@ -16,72 +16,107 @@
 	The advantage of course is that it increases the max echo delay for the same 
 	amount of RAM allocated to the buffer.  4Kb of buffer at 8:1 gives nearly
 	a second of delay.
+	The tape comes from the delay arena when turned on and is as long as the
+	memory the other effects leave free, split evenly if there is more than
+	one echo. The delay control always spans the whole tape.
 	
 	To reduce aliasing I'm storing the input in a small buffer and averaging the 
 	the sum before storing it in the "tape" every Nth sample.  
 	Then I interpolate the output to help recreate missing samples for the taps.
 	I guess the averaging also introduce a small amount of low-pass filter.
 
-	I wonder if I could actually just use 8bit for this, therefore doubling the 
-	length again for the same memory
+	The tape can also be stored 8bit companded or 4bit ADPCM (see echo_tape.h)
+	doubling or quadrupling the length again for the same memory. 
+	Changing the encoding starts a fresh tape.
 
-	Might add additional taps, each at 1/2 amplitude of prev tap. Doesn't seem
-	necessary when using the analog feedback gives a good result.
+	Extra taps sit at rhythmic fractions of the delay (straight, dotted or
+	triplet), each at 1/2 amplitude of the previous tap. They share the tape
+	and the interpolation so four taps cost little more than one, and the
+	taps not in use aren't read at all.
+
+	With tails on, turning the echo off mutes what goes onto the tape and
+	lets the echoes already on it play out (see effect_bypass.h). The tape
+	is only given back once it has played silence for a whole delay.
 
 */
 #include <PLIB.h>
+#include <string.h>
 #include "effect_echo.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+#include "delay_arena.h"
 	
 
 //******** Private macros ********//
 
-#define BUFFSIZE 4096 // int16_t so that's 8kb!
-#define IDXRATIO 8 // Ratio of main sample rate for echo buffer
-#define IDXSHIFT 3 // Number of bits to shift to match IDXRATIO
-#define FEATURECOUNT 2  // Note : Default feature is 0 : It does nothing
+#define FEATURECOUNT 5  // Note : Default feature is 0 : It does nothing
+#define COST 150 // Cycles per sample with ADPCM and all taps from the host cost model (make bench), rounded up. Raised at runtime if measured higher
 #define AMP_MAX 0xffff
 #define AMP_MIN 0x0000
-#define DELAY_MAX (BUFFSIZE - IDXRATIO - 1)
 #define DELAY_MIN 0x0001
 #define DELAY_RANGE 200 // This is the range that the user sees
+#define TAP_GRID 48 // Tap positions are in 48ths of the delay. Fits 16ths, dotted and triplets
+#define TAP_PATTERNS 3
+#define TAP_CHOICES (1 + (ECHO_TAPS - 1) * TAP_PATTERNS) // One tap, or 2 to ECHO_TAPS taps of each pattern
+#define FEATURE_LINES 3 // Lines of features that fit under the title
 
 //******** Private function declarations ********//
 
-void echo_nextFeature();
-void echo_adjustFeature(int16_t value);
-uint8_t echo_toggleOnOff();
-int32_t echo_effectISR(int32_t value);
-void echo_report();
-void echo_delay_adjust(int16_t value);
-void echo_amp_adjust(int16_t value);
-float echo_getDelayMs();
+void echo_nextFeature(Effect_t *effect);
+void echo_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t echo_toggleOnOff(Effect_t *effect);
+int32_t echo_effectISR(Effect_t *effect, int32_t value);
+void echo_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void echo_report(Effect_t *effect);
+uint8_t echo_save(Effect_t *effect, uint8_t *data);
+void echo_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void echo_delay_adjust(Effect_t *effect, int16_t value);
+void echo_amp_adjust(echo_instance_t *instance, int32_t value);
+float echo_getDelayMs(echo_instance_t *instance);
+void echo_tape_adjust(Effect_t *effect, int16_t value);
+void echo_taps_adjust(Effect_t *effect, int16_t value);
+uint8_t echo_claim(Effect_t *effect);
+void echo_release(Effect_t *effect);
+void echo_setTaps(Effect_t *effect, echo_params_t *params);
 uint16_t scaleAndClamp(uint16_t value, uint16_t range, uint16_t min, uint16_t max);
 
 //******** Private variables ********//
 
-// Internal state variables
-typedef struct {
-    uint16_t writepos; // Buffer write index
-    uint16_t amplitude;
-    uint16_t readpos; // Tap read offset position
-    uint16_t delay; // Delay - Scaled user input
-} settings_t;
-static settings_t settings = {
-		0
-	,	AMP_MAX / 2
-	, DELAY_MAX / 2
+// Every new instance starts from this
+static const echo_instance_t initial = {
+		{{{
+				AMP_MAX / 2
+			, 0
+			, DELAY_RANGE / 4
+			, 0
+			, {0}
+			, {ECHO_TAPGAIN_ONE}
+		}}}
+	, {
+				0
+			,	(AMP_MAX / 2) << 8
+			, NULL
+			, 0
+			, TAPE_PCM16
+		}
+	, TAPE_PCM16
 };
+static EffectPool<echo_instance_t> pool;
 
-enum features_t {SAFE, AMP, DELAY};
-static const char *featurenames[] = {"Safe", "Amplitude","Delay"};
-
-static int16_t echo_buffer[BUFFSIZE]; // Main "tape"
-static int16_t echo_lpf[IDXRATIO]; // Input buffer
+enum features_t {SAFE, AMP, DELAY, TAPE, TAPS, TAILS};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_COARSE, ENC_CURVE_FINE, ENC_CURVE_NONE, ENC_CURVE_NONE, ENC_CURVE_NONE};
+static const char *tapenames[] = {"16bit","u-law 8bit","A-law 8bit","ADPCM 4bit"};
+static const char *patternnames[] = {"straight","dotted","triplet"};
 
-//******** Global variables ********//
+// Where each tap sits in TAP_GRIDths of the delay. Tap 0 is always the delay
+static const uint8_t tapfractions[TAP_PATTERNS][ECHO_TAPS] = {
+		{48, 24, 12, 36} // Straight : 8th then 16ths
+	, {48, 36, 18, 9} // Dotted : dotted 8th, 16th, 32nd
+	, {48, 32, 16, 40} // Triplet : 8th triplets then a 16th triplet
+};
 
-// This struct is exposed globally via extern in the header
-Effect_t effect_Echo = {
+// Copied into each instance by echo_create()
+static const Effect_t prototype = {
 		"Echo"
 	, 0
 	, 0
@@ -89,127 +124,220 @@ Effect_t effect_Echo = {
 	, echo_adjustFeature
 	, echo_toggleOnOff
 	, echo_effectISR
+	, echo_processBlock
 	, echo_report
+	, COST
+	, featurecurves
+	, echo_save
+	, echo_load
+	, ECHO_BUFFMIN
+	, 1 // Tails : Echoes ring out when turned off
 };
 
 //******** Function definitions ********//
 
+// New instance for the chain
+Effect_t *echo_create(){
+	return pool.create(&prototype, &initial);
+}
 
-// This is where the effect is actually processed
-// Note this function could be made much more memory efficiant
-// by reusing variables, at the cost of being much hard to read
-int32_t echo_effectISR(int32_t value){
-	uint16_t idx;
-	int16_t sample1, sample2;
-	int32_t result;
-	uint8_t frac, tmp;
-
-	frac = (uint8_t)(settings.writepos & (IDXRATIO-1)); // fetch the lower fractional bits
-	idx = settings.writepos++ >> IDXSHIFT; // Get the upper integer bits
-	// check if writepos has gotten bigger than buffer size
-  if (settings.writepos >= (BUFFSIZE * IDXRATIO)) {
-    settings.writepos = 0; // reset writepos
-  }
-	// store incoming data every nth samples
-  echo_lpf[frac] = (int16_t)value;
-  
-  if(frac == 0){
-  	// Every nth, write the average
-  	result = 0;
-  	for(tmp=0;tmp<IDXRATIO;tmp++){
-  		result += echo_lpf[tmp];
-  	}
-  	result >>= IDXSHIFT;
-  	echo_buffer[idx] = (int16_t)result;
-  }
-  
-  // Get position to read from
-  //idx = settings.writepos + (DELAY_MAX - (settings.readpos >> 8));
-  idx += (DELAY_MAX - settings.readpos);
-  // if we've gone over the table boundary -> wrap it
-  if (idx >= BUFFSIZE) {
-    idx -= BUFFSIZE;
-  }
-  sample1 = echo_buffer[idx];
-  idx++;
-  // check if we've gone over the boundary.
-  if (idx >= BUFFSIZE) {
-    idx = 0;
-  }
-	sample2 = echo_buffer[idx];
-  // Interpolate between samples
-  // multiply each sample by the fractional distance to the actual settings.location  value
-  // scale sample 2
-  sample2 = (sample2 * frac) >> IDXSHIFT;
-  // scale sample 1
-  sample1 = (sample1 * (IDXRATIO - frac )) >> IDXSHIFT;
-  // Add samples together to get an average, result is now in sample2 
-  sample2 += sample1;
-  // Echo value
-  //result = ((sample2 * settings.amplitude) >> 16);
-  result = value + ((sample2 * settings.amplitude) >> 16);
-//  result = value >> 1;
-  return result;
+// Per sample entry point for the Timer1 ISR
+int32_t echo_effectISR(Effect_t *effect, int32_t value){
+	return echo_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void echo_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = echo_process(effect, *block);
+		block++;
+	}
 }
 
 // Cycles my features
-void echo_nextFeature(){
+void echo_nextFeature(Effect_t *effect){
 	if(FEATURECOUNT <= 1) return;
-	if(effect_Echo.featureIdx < FEATURECOUNT) {
-		effect_Echo.featureIdx++;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
 	}else{
 		// Skip the safe feature
-		effect_Echo.featureIdx = 1;
+		effect->featureIdx = 1;
 	}
 }
 
 // Turns me on or off
-uint8_t echo_toggleOnOff(){
-	if(effect_Echo.state) effect_Echo.state = 0;
-	else effect_Echo.state = 1;
-	return effect_Echo.state;
+uint8_t echo_toggleOnOff(Effect_t *effect){
+	if(effect->state){
+		effect->state = 0;
+		echo_release(effect);
+	}else if(echo_claim(effect)){
+		effect->state = 1;
+	}
+	return effect->state;
+}
+
+// Takes as much tape as the arena can spare. Returns 0 if not even ECHO_BUFFMIN
+// Copies of the echo that are on share the arena, or the first on would
+// leave none. Copies that are off don't count, so a lone Echo gets the
+// full tape however many are in the chain. This one is still off here
+uint8_t echo_claim(Effect_t *effect){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_settings_t *settings = &instance->settings;
+	uint8_t tapeMode = instance->tapeMode;
+	uint16_t words;
+	uint8_t idx;
+	echo_params_t *params;
+	echo_tap_t *tap;
+	int16_t *buffer = arena_alloc(effect, ECHO_BUFFMIN, ECHO_BUFFMAX / (pool.on() + 1), &words);
+	if(buffer == NULL) return 0;
+	settings->tape = tapeMode;
+	settings->size = (uint32_t)words << tape_shift(tapeMode);
+	// Arena memory is zeroed. That's silence for 16bit and ADPCM but not G.711
+	if(tapeMode == TAPE_ULAW) memset(buffer, ULAW_SILENCE, words * sizeof(int16_t));
+	if(tapeMode == TAPE_ALAW) memset(buffer, ALAW_SILENCE, words * sizeof(int16_t));
+	// Same delay setting is a different tap on a different length of tape
+	params = instance->params.edit();
+	echo_setTaps(effect, params);
+	instance->params.publish();
+	settings->writepos = 0;
+	settings->mix1 = 0;
+	settings->mix2 = 0;
+	// ADPCM coders all start from silence. Each decoder starts just past
+	// where its first read lands and decodes zeroes (silence) up to the
+	// start of the tape, reaching it in the same state the encoder started in
+	settings->encoder.predictor = 0;
+	settings->encoder.index = 0;
+	for(idx=0; idx < ECHO_TAPS; idx++){
+		tap = &settings->taps[idx];
+		tap->readpos = params->tappos[idx]; // No glide from the old tap
+		tap->gain = params->tapgain[idx] << 8;
+		tap->decoder = settings->encoder;
+		tap->decodepos = ECHO_DELAY_MAX(settings->size) - tap->readpos + 2;
+		tap->tap1 = 0;
+		tap->tap2 = 0;
+		tap->active = 1;
+	}
+	// Last : The static chain starts using the tape as soon as this is set
+	settings->buffer = buffer;
+	return 1;
+}
+
+// Gives the tape back to the arena
+void echo_release(Effect_t *effect){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_settings_t *settings = &instance->settings;
+	int16_t *buffer = settings->buffer;
+	settings->buffer = NULL;
+	settings->size = 0;
+	arena_free(buffer);
+}
+
+// Works out the tap positions for the delay setting on the current tape
+// While off there is no tape. echo_claim() does it when we get one
+void echo_setTaps(Effect_t *effect, echo_params_t *params){
+	uint32_t size = ((echo_instance_t *)effect->data)->settings.size;
+	uint8_t idx, count, pattern;
+	if(size == 0) return;
+	params->readpos = scaleAndClamp(params->delay, DELAY_RANGE, DELAY_MIN, ECHO_DELAY_MAX(size));
+	// Longest the tape can play back silence between echoes, in samples
+	effect->tail = ((uint32_t)params->readpos + ECHO_IDXRATIO + 2) << ECHO_IDXSHIFT;
+	// Choice 0 is a single tap. Then 2 taps in each pattern, 3 taps...
+	count = params->taps ? 2 + (params->taps - 1) / TAP_PATTERNS : 1;
+	pattern = params->taps ? (params->taps - 1) % TAP_PATTERNS : 0;
+	for(idx=0; idx < ECHO_TAPS; idx++){
+		params->tappos[idx] = ((uint32_t)params->readpos * tapfractions[pattern][idx]) / TAP_GRID;
+		params->tapgain[idx] = (idx < count) ? (ECHO_TAPGAIN_ONE >> idx) : 0;
+	}
 }
 
 // Adjust the value of the current feature
 // Receives the encoder delta
-void echo_adjustFeature(int16_t value){
-	features_t feat = (features_t)effect_Echo.featureIdx;
+void echo_adjustFeature(Effect_t *effect, int16_t value){
+	features_t feat = (features_t)effect->featureIdx;
 	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
 		case AMP:{
-			echo_amp_adjust(value*512);	
+			echo_amp_adjust((echo_instance_t *)effect->data, value*512);	
 			break;
 		}
 		case DELAY:{
-			echo_delay_adjust(value);	
+			echo_delay_adjust(effect, value);	
+			break;
+		}
+		case TAPE:{
+			echo_tape_adjust(effect, value);
 			break;
 		}
+		case TAPS:{
+			echo_taps_adjust(effect, value);
+			break;
+		}
+		case TAILS:{
+			// Only takes effect on the next turn off
+			effect->tails = (value > 0);
+			break;
+		}
+	}
+}
+
+// Steps through the tap count and pattern choices
+void echo_taps_adjust(Effect_t *effect, int16_t value){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_params_t *params = instance->params.edit();
+	int16_t result = params->taps + value;
+	if(result >= TAP_CHOICES){
+		result = TAP_CHOICES - 1;
+	}else if(result < 0){
+		result = 0;
 	}
+	params->taps = (uint8_t)result;
+	echo_setTaps(effect, params);
+	instance->params.publish();
+}
+
+// Steps through the tape encodings
+// The tape can't be converted on the fly so a running echo fades out and
+// starts a new one. See arena_restart()
+void echo_tape_adjust(Effect_t *effect, int16_t value){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	int16_t result = instance->tapeMode + (value > 0 ? 1 : -1);
+	if(result >= TAPE_MODES || result < 0) return;
+	instance->tapeMode = (uint8_t)result;
+	arena_restart(effect);
 }
 
 // Alters the current echo delay value by value (+ or -)
 // use an int32 for result to make boundry checking easy
 // Clamps result to min/max
-void echo_delay_adjust(int16_t value){
-	int32_t result = settings.delay + value;
+void echo_delay_adjust(Effect_t *effect, int16_t value){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_params_t *params = instance->params.edit();
+	int32_t result = params->delay + value;
 	if(result > DELAY_RANGE){
 		result = DELAY_RANGE;
 	}else if(result < 0){
 		result = 0;
 	}
-	settings.delay = result;
-	settings.readpos = scaleAndClamp((uint16_t)result, DELAY_RANGE, DELAY_MIN, DELAY_MAX);
+	params->delay = result;
+	echo_setTaps(effect, params);
+	instance->params.publish();
 }
 
 // Alters the Echo amplitude value by value (+ or -)
 // Clamps result to within min/max
-void echo_amp_adjust(int16_t value){
-	int32_t result = settings.amplitude + value;
+void echo_amp_adjust(echo_instance_t *instance, int32_t value){
+	echo_params_t *params = instance->params.edit();
+	int32_t result = params->amplitude + value;
 	if(result > AMP_MAX){
 		result = AMP_MAX;
 	}else if(result < AMP_MIN){
 		result = AMP_MIN;
 	}
-	settings.amplitude = (uint16_t)result;
+	params->amplitude = (uint16_t)result;
+	instance->params.publish();
 }
 
 // accepts a smaller input : outputs the scalled output clamped to within min max
@@ -220,35 +348,92 @@ uint16_t scaleAndClamp(uint16_t value, uint16_t range, uint16_t min, uint16_t ma
 	return (uint16_t)(ratio * outrange);
 }
 
-// Sends a string of my state to stdout
-void echo_report(){
-	features_t feat = (features_t)effect_Echo.featureIdx;
+// Copies my settings, the tape encoding and tails out for a preset
+uint8_t echo_save(Effect_t *effect, uint8_t *data){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	uint8_t length = instance->params.store(data);
+	data[length++] = instance->tapeMode;
+	data[length++] = effect->tails;
+	return length;
+}
 
-	// Write to screen
-	if(feat == AMP){
-		display.setTextColor(0);
-		display.fillRect(0,DISP_FEAT_Y,DISP_FEAT_W,13,1);
-	}else{
-		display.setTextColor(1);
+// Takes my settings from a preset. The taps are worked out again for the
+// tape we have, and a running echo starts a new tape if the encoding changed
+void echo_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_params_t *params;
+	uint8_t mode;
+	if(length != sizeof(echo_params_t) + 2) return;
+	mode = data[sizeof(echo_params_t)];
+	if(mode >= TAPE_MODES) return;
+	params = instance->params.restore(data, sizeof(echo_params_t));
+	echo_setTaps(effect, params);
+	instance->params.publish();
+	effect->tails = data[sizeof(echo_params_t) + 1];
+	if(mode != instance->tapeMode){
+		instance->tapeMode = mode;
+		arena_restart(effect);
 	}
-	display.print("Amp ");
-  display.print(percentage(settings.amplitude, AMP_MAX, AMP_MIN), 2);
-	display.print("%");
+}
 
-  if(feat == DELAY){
-		display.setTextColor(0);
-		display.fillRect(0,DISP_FEAT_Y+14,DISP_FEAT_W,13,1);
-	}else{
-		display.setTextColor(1);
+// Sends a string of my state to stdout
+void echo_report(Effect_t *effect){
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	const echo_params_t *params = instance->params.read();
+	uint8_t line, first, y;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case AMP:{
+				display.print("Amp ");
+				display.print(percentage(params->amplitude, AMP_MAX, AMP_MIN), 2);
+				display.print("%");
+				break;
+			}
+			case DELAY:{
+				display.print("Delay ");
+				display.print(echo_getDelayMs(instance), 0);
+				display.print("mS");
+				break;
+			}
+			case TAPE:{
+				display.print("Tape ");
+				display.print(tapenames[instance->tapeMode]);
+				break;
+			}
+			case TAPS:{
+				display.print("Taps ");
+				if(params->taps == 0){
+					display.print("1");
+				}else{
+					display.print(2 + (params->taps - 1) / TAP_PATTERNS, DEC);
+					display.print(" ");
+					display.print(patternnames[(params->taps - 1) % TAP_PATTERNS]);
+				}
+				break;
+			}
+			case TAILS:{
+				display.print(effect->tails ? "Tails ring out" : "Tails cut");
+				break;
+			}
+		}
 	}
-  display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
-  display.print("Delay ");
-  display.print(echo_getDelayMs(), 0);
-  display.print("mS");
 }
 
 // Returns the delay period from the step
-float echo_getDelayMs(){
-	float result = SAMPLETIME * 8 * settings.readpos;
+float echo_getDelayMs(echo_instance_t *instance){
+	float result = SAMPLETIME * 8 * instance->params.read()->readpos;
 	return result;
 }
@@ -1,18 +1,216 @@
 /*
 	Header for Echo Effect
 	Each Effect is self contained
-	The only interface declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_Echo__
 #define __Effect_Echo__
 
 #include "config.h"
 #include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+#include "echo_tape.h"
 
-extern Effect_t effect_Echo;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *echo_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define ECHO_BUFFMIN 1024 // Least RAM we'll run with in int16_t (~200mS of 16bit tape)
+#define ECHO_BUFFMAX (ARENA_SAMPLES - ARENA_RESERVE) // Otherwise take as much as is free, short of the reserve
+#define ECHO_IDXRATIO 8 // Ratio of main sample rate for echo buffer
+#define ECHO_IDXSHIFT 3 // Number of bits to shift to match ECHO_IDXRATIO
+#define ECHO_DELAY_MAX(size) ((size) - ECHO_IDXRATIO - 1)
+
+#define ECHO_TAPS 4 // Read taps on the one tape
+#define ECHO_TAPGAIN_ONE 256 // Tap gain of 1
+#define ECHO_CATCHUP 4 // Most ADPCM codes a tap decodes per tape sample. The tap moves up to 2
+
+// User parameters : Written by the main loop, read by the ISR
+// readpos, delay and the taps are published together so never disagree
+typedef struct {
+    uint16_t amplitude;
+    uint16_t readpos; // Tap read offset position
+    uint16_t delay; // Delay - Scaled user input
+    uint8_t taps; // Tap count and pattern as picked by the user
+    uint16_t tappos[ECHO_TAPS]; // Offset of each tap. tappos[0] == readpos
+    uint16_t tapgain[ECHO_TAPS]; // Gain of each tap. 0 = unused. tapgain[0] never is
+} echo_params_t;
+
+// One read tap. Each has its own ADPCM decoder as it has to decode in order
+typedef struct {
+    uint16_t readpos; // Tap offset. Follows the param one tape sample at a time
+    int32_t gain; // Smoothed gain with 8bits of fraction
+    TapeAdpcm_t decoder; // ADPCM state at this tap
+    uint32_t decodepos; // Next tape sample the ADPCM decoder will read
+    int16_t tap1, tap2; // Decoded tape samples either side of the tap
+    uint8_t active; // Read at the last tape sample. Unused taps aren't, once silent
+} echo_tap_t;
+
+// Internal state : Only touched by the ISR
+// buffer is NULL while off. It comes from the delay arena when turned on
+typedef struct {
+    uint32_t writepos; // Buffer write index
+    int32_t amplitude; // Smoothed amplitude with 8bits of fraction
+    int16_t *buffer; // The "tape"
+    uint32_t size; // Length of the tape in tape samples
+    uint8_t tape; // Encoding. See echo_tape.h
+    TapeAdpcm_t encoder; // ADPCM state at the write head
+    echo_tap_t taps[ECHO_TAPS];
+    int32_t mix1, mix2; // Sum of the taps either side, ready to interpolate
+    int16_t lpf[ECHO_IDXRATIO]; // Input averaged down to the tape rate
+} echo_settings_t;
+
+// One echo. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<echo_params_t> params;
+    echo_settings_t settings;
+    uint8_t tapeMode; // Encoding used for the next tape. Only the main loop touches this
+} echo_instance_t;
+
+// Stores a tape sample in the current encoding
+inline void echo_tapeWrite(echo_settings_t *settings, uint32_t idx, int16_t sample){
+	int16_t *buffer = settings->buffer;
+	uint8_t *bytes = (uint8_t *)buffer;
+	switch(settings->tape){
+		case TAPE_PCM16: buffer[idx] = sample; break;
+		case TAPE_ULAW: bytes[idx] = tape_ulawEncode(sample); break;
+		case TAPE_ALAW: bytes[idx] = tape_alawEncode(sample); break;
+		case TAPE_ADPCM: tape_nibbleWrite(bytes, idx, tape_adpcmEncode(&settings->encoder, sample)); break;
+	}
+}
+
+// Decodes tape samples idx and idx+1 into the tap's tap1 and tap2
+// Returns 0 if an ADPCM decoder is still catching up with its tap
+inline uint8_t echo_tapeRead(echo_settings_t *settings, uint32_t idx, echo_tap_t *tap){
+	int16_t *buffer = settings->buffer;
+	uint8_t *bytes = (uint8_t *)buffer;
+	uint32_t next = idx + 1;
+	uint8_t count;
+	if(next >= settings->size) next = 0;
+	switch(settings->tape){
+		case TAPE_PCM16:{
+			tap->tap1 = buffer[idx];
+			tap->tap2 = buffer[next];
+			break;
+		}
+		case TAPE_ULAW:{
+			tap->tap1 = tape_ulawDecode(bytes[idx]);
+			tap->tap2 = tape_ulawDecode(bytes[next]);
+			break;
+		}
+		case TAPE_ALAW:{
+			tap->tap1 = tape_alawDecode(bytes[idx]);
+			tap->tap2 = tape_alawDecode(bytes[next]);
+			break;
+		}
+		case TAPE_ADPCM:{
+			// The decoder follows the tap in order, leaving the last two it
+			// decoded in tap1/tap2. The tap moves 0, 1 or 2 each time, so a
+			// decoder that has been resynced further back gains a little each time
+			if(++next >= settings->size) next = 0;
+			for(count=0; tap->decodepos != next; count++){
+				if(count == ECHO_CATCHUP) return 0;
+				tap->tap1 = tap->tap2;
+				tap->tap2 = tape_adpcmDecode(&tap->decoder, tape_nibbleRead(bytes, tap->decodepos));
+				if(++tap->decodepos >= settings->size) tap->decodepos = 0;
+			}
+			break;
+		}
+	}
+	return 1;
+}
+
+// This is where the effect is actually processed
+// The tape only moves every ECHO_IDXRATIO samples so that is when it is
+// written and read. In between just interpolates the two tap samples.
+inline int32_t echo_process(Effect_t *effect, int32_t value){
+	uint32_t idx, readidx;
+	int32_t result, mix1, mix2, gain;
+	uint8_t frac, tmp;
+	echo_tap_t *tap;
+	echo_instance_t *instance = (echo_instance_t *)effect->data;
+	echo_settings_t *settings = &instance->settings;
+	const echo_params_t *params = instance->params.read();
+	int16_t *buffer = settings->buffer;
+	uint32_t size = settings->size;
+
+	// Can be called for a moment after being turned off
+	if(buffer == NULL) return value;
+
+	frac = (uint8_t)(settings->writepos & (ECHO_IDXRATIO-1)); // fetch the lower fractional bits
+	idx = settings->writepos++ >> ECHO_IDXSHIFT; // Get the upper integer bits
+	// check if writepos has gotten bigger than buffer size
+  if (settings->writepos >= (size << ECHO_IDXSHIFT)) {
+    settings->writepos = 0; // reset writepos
+  }
+	// store incoming data every nth samples
+  settings->lpf[frac] = (int16_t)value;
+  
+  if(frac == 0){
+  	// Every nth, write the average
+  	result = 0;
+  	for(tmp=0;tmp<ECHO_IDXRATIO;tmp++){
+  		result += settings->lpf[tmp];
+  	}
+  	result >>= ECHO_IDXSHIFT;
+  	echo_tapeWrite(settings, idx, (int16_t)result);
+
+  	// Only the taps in use are read, so fewer taps cost less. Their gains
+  	// are summed here so the per sample interpolation is only done once
+  	// for all of them.
+  	mix1 = 0;
+  	mix2 = 0;
+  	for(tmp=0;tmp<ECHO_TAPS;tmp++){
+  		tap = &settings->taps[tmp];
+  		if(params->tapgain[tmp] == 0 && tap->gain == 0){
+  			// Unused and faded out. Sits at its delay ready to come back
+  			tap->readpos = params->tappos[tmp];
+  			tap->active = 0;
+  			continue;
+  		}
+  		if(!tap->active){
+  			// Its ADPCM decoder stopped. Tap 0 is always in use and reads
+  			// furthest back, so take over its decoder and catch up from there
+  			tap->decoder = settings->taps[0].decoder;
+  			tap->decodepos = settings->taps[0].decodepos;
+  			tap->tap1 = settings->taps[0].tap1;
+  			tap->tap2 = settings->taps[0].tap2;
+  			tap->active = 1;
+  		}
+	  	// The tap glides to a new delay at up to tape speed rather than jumping
+	  	// across the tape. So it never skips or reverses and ADPCM stays in step
+	  	if(tap->readpos < params->tappos[tmp]) tap->readpos++;
+	  	else if(tap->readpos > params->tappos[tmp]) tap->readpos--;
+
+		  // Get position to read from
+		  readidx = idx + (ECHO_DELAY_MAX(size) - tap->readpos);
+		  // if we've gone over the table boundary -> wrap it
+		  if (readidx >= size) {
+		    readidx -= size;
+		  }
+		  // Silent until its decoder has caught up
+		  if(!echo_tapeRead(settings, readidx, tap)) continue;
+		  gain = dsp_smooth(&tap->gain, params->tapgain[tmp], SMOOTH_FAST);
+		  mix1 += tap->tap1 * gain;
+		  mix2 += tap->tap2 * gain;
+  	}
+  	settings->mix1 = mix1 >> 8;
+  	settings->mix2 = mix2 >> 8;
+  }
+
+  // Interpolate between the last two tape samples by how far the tape has moved since
+  mix2 = dsp_lerp(settings->mix1, settings->mix2, frac, ECHO_IDXSHIFT);
+  // Echo value. Taps can add up to nearly twice full scale so halve the amplitude to stay in 32bits
+  return value + dsp_mulQ15(mix2, dsp_smooth(&settings->amplitude, params->amplitude, SMOOTH_FAST) >> 1);
+}
 
 #endif
@@ -0,0 +1,381 @@
+/*
+	Filter functions
+	One biquad : low pass, high pass, band pass, notch, low shelf or high
+	shelf, with cutoff and Q. Shelves also have a gain.
+
+	The coefficients are worked out here in the main loop, in float, each
+	time a feature changes and published with the rest of the parameters.
+	The ISR only ever runs dsp_biquad() (see dsp_fixed.h) with whichever
+	complete set it picks up, which costs about the same as the Tremolo.
+*/
+#include <PLIB.h>
+#include "effect_filter.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+
+//******** Private macros ********//
+
+#define FEATURECOUNT 4  // Note : Default feature is 0 : It does nothing
+#define FEATURE_LINES 3 // Lines of features that fit under the title
+#define COST 80 // Cycles per sample from the host cost model (make bench), rounded up. Raised at runtime if measured higher
+#define CUTOFF_MIN 20 // Hz
+#define CUTOFF_MAX 16000 // Hz. The bilinear transform squashes everything above this towards Nyquist
+#define Q_MIN 50 // 0.5
+#define Q_MAX 1200 // 12
+#define GAIN_MIN -12 // dB
+#define GAIN_MAX 12 // dB. A high shelf this high has b terms of almost 8, so shift 2
+#define FILT_ONE ((float)(1L << DSP_BIQUAD_SHIFT)) // 1.0 in Q2.30
+#define FILT_TWOPI 6.2831853f
+
+//******** Private function declarations ********//
+
+void filt_nextFeature(Effect_t *effect);
+void filt_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t filt_toggleOnOff(Effect_t *effect);
+int32_t filt_effectISR(Effect_t *effect, int32_t value);
+void filt_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void filt_report(Effect_t *effect);
+uint8_t filt_save(Effect_t *effect, uint8_t *data);
+void filt_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void filt_type_adjust(filt_instance_t *instance, int16_t value);
+void filt_cutoff_adjust(filt_instance_t *instance, int16_t value);
+void filt_q_adjust(filt_instance_t *instance, int16_t value);
+void filt_gain_adjust(filt_instance_t *instance, int16_t value);
+void filt_design(filt_params_t *params);
+int64_t filt_fixed(float value);
+
+//******** Private variables ********//
+
+// Every new instance starts from this. filt_create() works out the coefficients
+static const filt_instance_t initial = {
+		{{{
+				2000
+			, 71
+			, 0
+			, FILT_LOWPASS
+			, {0}
+		}}}
+	, {
+			{0}
+		}
+};
+static EffectPool<filt_instance_t> pool;
+
+enum features_t {SAFE, TYPE, CUTOFF, QFACTOR, GAIN};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_NONE, ENC_CURVE_FINE, ENC_CURVE_FINE, ENC_CURVE_NONE};
+static const char *typenames[FILT_TYPES] = {"Low pass", "High pass", "Band pass", "Notch", "Low shelf", "High shelf"};
+
+// Copied into each instance by filt_create()
+static const Effect_t prototype = {
+		"Filter"
+	, 0
+	, 0
+	, filt_nextFeature
+	, filt_adjustFeature
+	, filt_toggleOnOff
+	, filt_effectISR
+	, filt_processBlock
+	, filt_report
+	, COST
+	, featurecurves
+	, filt_save
+	, filt_load
+};
+
+//******** Function definitions ********//
+
+// New instance for the chain
+Effect_t *filt_create(){
+	Effect_t *effect = pool.create(&prototype, &initial);
+	filt_instance_t *instance;
+	if(effect){
+		instance = (filt_instance_t *)effect->data;
+		filt_design(instance->params.edit());
+		instance->params.publish();
+	}
+	return effect;
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t filt_effectISR(Effect_t *effect, int32_t value){
+	return filt_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void filt_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = filt_process(effect, *block);
+		block++;
+	}
+}
+
+// Cycles my features
+void filt_nextFeature(Effect_t *effect){
+	if(FEATURECOUNT <= 1) return;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
+	}else{
+		// Skip the safe feature
+		effect->featureIdx = 1;
+	}
+}
+
+// Turns me on or off
+uint8_t filt_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
+}
+
+// Adjust the value of the current feature
+// Receives the encoder delta
+void filt_adjustFeature(Effect_t *effect, int16_t value){
+	filt_instance_t *instance = (filt_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
+		case TYPE:{
+			filt_type_adjust(instance, value);
+			break;
+		}
+		case CUTOFF:{
+			filt_cutoff_adjust(instance, value);
+			break;
+		}
+		case QFACTOR:{
+			filt_q_adjust(instance, value);
+			break;
+		}
+		case GAIN:{
+			filt_gain_adjust(instance, value);
+			break;
+		}
+	}
+}
+
+// Picks the next or previous filter type. Stops at either end
+void filt_type_adjust(filt_instance_t *instance, int16_t value){
+	filt_params_t *params = instance->params.edit();
+	int32_t result = params->type + value;
+	if(result >= FILT_TYPES){
+		result = FILT_TYPES - 1;
+	}else if(result < 0){
+		result = 0;
+	}
+	params->type = (uint8_t)result;
+	filt_design(params);
+	instance->params.publish();
+}
+
+// Alters the cutoff by value steps of about a quarter semitone each (+ or -)
+// Clamps result to within min/max
+void filt_cutoff_adjust(filt_instance_t *instance, int16_t value){
+	filt_params_t *params = instance->params.edit();
+	int32_t result = params->cutoff + (int32_t)value * ((params->cutoff >> 6) + 1);
+	if(result > CUTOFF_MAX){
+		result = CUTOFF_MAX;
+	}else if(result < CUTOFF_MIN){
+		result = CUTOFF_MIN;
+	}
+	params->cutoff = (uint16_t)result;
+	filt_design(params);
+	instance->params.publish();
+}
+
+// Alters Q by value steps of about 6% each (+ or -)
+// Clamps result to within min/max
+void filt_q_adjust(filt_instance_t *instance, int16_t value){
+	filt_params_t *params = instance->params.edit();
+	int32_t result = params->q + (int32_t)value * ((params->q >> 4) + 1);
+	if(result > Q_MAX){
+		result = Q_MAX;
+	}else if(result < Q_MIN){
+		result = Q_MIN;
+	}
+	params->q = (uint16_t)result;
+	filt_design(params);
+	instance->params.publish();
+}
+
+// Alters the shelf gain by value dB (+ or -)
+// Clamps result to within min/max
+void filt_gain_adjust(filt_instance_t *instance, int16_t value){
+	filt_params_t *params = instance->params.edit();
+	int32_t result = params->gain + value;
+	if(result > GAIN_MAX){
+		result = GAIN_MAX;
+	}else if(result < GAIN_MIN){
+		result = GAIN_MIN;
+	}
+	params->gain = (int8_t)result;
+	filt_design(params);
+	instance->params.publish();
+}
+
+// Works out the biquad coefficients from the type, cutoff, Q and gain
+// using the formulas in Robert Bristow-Johnson's Audio EQ Cookbook.
+// At low cutoffs a1 and a2 sit just inside -2 and 1, closer than float
+// can resolve. So they are worked out as their distance from -2 and 1,
+// which float holds to full precision, using 1 - cos(w) = 2sin(w/2)^2.
+// Where the zeros have to land exactly (on DC or Nyquist, or on the
+// notch frequency) the b terms are made from the ones already rounded.
+void filt_design(filt_params_t *params){
+	dsp_biquad_t *coeffs = &params->coeffs;
+	float w = FILT_TWOPI * params->cutoff / SAMPLERATE;
+	float half = sin(w / 2);
+	float versine = 2 * half * half; // 1 - cos(w)
+	float cosine = cos(w);
+	float alpha = sin(w) * 50 / params->q; // sin(w) / 2Q
+	float amp = pow(10, params->gain / 40.0);
+	float beta = 2 * sqrt(amp) * alpha;
+	float a0, dist1, dist2, b[3] = {0, 0, 0};
+	uint8_t idx;
+
+	coeffs->shift = 0;
+	switch(params->type){
+		case FILT_LOWPASS:{
+			a0 = 1 + alpha;
+			coeffs->b0 = (int32_t)filt_fixed(versine / 2 / a0);
+			coeffs->b1 = 2 * coeffs->b0;
+			coeffs->b2 = coeffs->b0;
+			dist1 = 2 * (versine + alpha) / a0;
+			dist2 = 2 * alpha / a0;
+			break;
+		}
+		case FILT_HIGHPASS:{
+			a0 = 1 + alpha;
+			coeffs->b0 = (int32_t)filt_fixed((2 - versine) / 2 / a0);
+			coeffs->b1 = -2 * coeffs->b0;
+			coeffs->b2 = coeffs->b0;
+			dist1 = 2 * (versine + alpha) / a0;
+			dist2 = 2 * alpha / a0;
+			break;
+		}
+		case FILT_BANDPASS:{
+			// 0dB at the centre
+			a0 = 1 + alpha;
+			coeffs->b0 = (int32_t)filt_fixed(alpha / a0);
+			coeffs->b1 = 0;
+			coeffs->b2 = -coeffs->b0;
+			dist1 = 2 * (versine + alpha) / a0;
+			dist2 = 2 * alpha / a0;
+			break;
+		}
+		case FILT_NOTCH:{
+			// b0 and b2 are 1 / a0 = (1 + a2) / 2, and b1 is a1. Set after a1 and a2
+			a0 = 1 + alpha;
+			dist1 = 2 * (versine + alpha) / a0;
+			dist2 = 2 * alpha / a0;
+			break;
+		}
+		case FILT_LOWSHELF:{
+			a0 = (amp + 1) + (amp - 1) * cosine + beta;
+			b[0] = amp * ((amp + 1) - (amp - 1) * cosine + beta) / a0;
+			b[1] = 2 * amp * ((amp - 1) - (amp + 1) * cosine) / a0;
+			b[2] = amp * ((amp + 1) - (amp - 1) * cosine - beta) / a0;
+			dist1 = (4 * versine + 2 * beta) / a0;
+			dist2 = 2 * beta / a0;
+			break;
+		}
+		default:{
+			// High shelf
+			a0 = (amp + 1) - (amp - 1) * cosine + beta;
+			b[0] = amp * ((amp + 1) + (amp - 1) * cosine + beta) / a0;
+			b[1] = -2 * amp * ((amp - 1) + (amp + 1) * cosine) / a0;
+			b[2] = amp * ((amp + 1) + (amp - 1) * cosine - beta) / a0;
+			dist1 = (4 * amp * versine + 2 * beta) / a0;
+			dist2 = 2 * beta / a0;
+			break;
+		}
+	}
+	coeffs->a1 = (int32_t)(filt_fixed(dist1) - filt_fixed(2));
+	coeffs->a2 = (int32_t)(filt_fixed(1) - filt_fixed(dist2));
+
+	if(params->type == FILT_NOTCH){
+		coeffs->b0 = (int32_t)((filt_fixed(1) + coeffs->a2) >> 1);
+		coeffs->b1 = coeffs->a1;
+		coeffs->b2 = coeffs->b0;
+	}else if(params->type >= FILT_LOWSHELF){
+		// Boosts can take the b terms past 2
+		while(fabs(b[0]) >= 1.999f || fabs(b[1]) >= 1.999f || fabs(b[2]) >= 1.999f){
+			coeffs->shift++;
+			for(idx=0; idx < 3; idx++) b[idx] /= 2;
+		}
+		coeffs->b0 = (int32_t)filt_fixed(b[0]);
+		coeffs->b1 = (int32_t)filt_fixed(b[1]);
+		coeffs->b2 = (int32_t)filt_fixed(b[2]);
+	}
+}
+
+// Q2.30 from a float, rounded. Wide enough for the distances, which go up to 4
+int64_t filt_fixed(float value){
+	return (int64_t)floor(value * FILT_ONE + 0.5f);
+}
+
+// Copies my settings out for a preset
+uint8_t filt_save(Effect_t *effect, uint8_t *data){
+	return ((filt_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset. The coefficients are worked out again
+// rather than trusted
+void filt_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	filt_instance_t *instance = (filt_instance_t *)effect->data;
+	filt_params_t *params = instance->params.restore(data, length);
+	if(params == NULL || params->type >= FILT_TYPES) return;
+	if(params->cutoff < CUTOFF_MIN || params->cutoff > CUTOFF_MAX) return;
+	if(params->q < Q_MIN || params->q > Q_MAX) return;
+	if(params->gain < GAIN_MIN || params->gain > GAIN_MAX) return;
+	filt_design(params);
+	instance->params.publish();
+}
+
+// Sends a string of my state to stdout
+void filt_report(Effect_t *effect){
+	filt_instance_t *instance = (filt_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	const filt_params_t *params = instance->params.read();
+	uint8_t line, first, y;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case TYPE:{
+				display.print(typenames[params->type]);
+				break;
+			}
+			case CUTOFF:{
+				display.print("Cutoff ");
+				display.print(params->cutoff, DEC);
+				display.print("Hz");
+				break;
+			}
+			case QFACTOR:{
+				display.print("Q ");
+				display.print(params->q / 100.0, 2);
+				break;
+			}
+			case GAIN:{
+				display.print("Gain ");
+				if(params->gain > 0) display.print("+");
+				display.print(params->gain, DEC);
+				display.print("dB");
+				break;
+			}
+		}
+	}
+	display.setTextColor(1);
+}
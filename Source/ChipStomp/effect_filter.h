@@ -0,0 +1,58 @@
+/*
+	Header for Filter Effect
+	Each Effect is self contained
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
+
+	Effects must provide a struct to comply with Effect_t;
+
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
+*/
+#ifndef __Effect_Filter__
+#define __Effect_Filter__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *filt_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+enum filttype_t {FILT_LOWPASS, FILT_HIGHPASS, FILT_BANDPASS, FILT_NOTCH, FILT_LOWSHELF, FILT_HIGHSHELF, FILT_TYPES};
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t cutoff; // Hz. Centre frequency for band pass and notch
+    uint16_t q; // Q x 100
+    int8_t gain; // dB. Shelves only
+    uint8_t type; // filttype_t
+    dsp_biquad_t coeffs; // Worked out from the above by filt_design()
+} filt_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    dsp_biquadState_t biquad;
+} filt_settings_t;
+
+// One filter. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<filt_params_t> params;
+    filt_settings_t settings;
+} filt_instance_t;
+
+// This is where the effect is actually processed
+// The coefficients come in one set with the rest of the parameters, so
+// the ISR never sees half of an update. They aren't smoothed : Direct
+// Form I takes a step in them without ringing up
+inline int32_t filt_process(Effect_t *effect, int32_t value){
+	filt_instance_t *instance = (filt_instance_t *)effect->data;
+	const filt_params_t *params = instance->params.read();
+	return dsp_sat16(dsp_biquad(&instance->settings.biquad, &params->coeffs, value));
+}
+
+#endif
@@ -1,18 +1,84 @@
 /*
 	Header for FLanger Effect
 	Each Effect is self contained
-	The only interface declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_Flanger__
 #define __Effect_Flanger__
 
 #include "config.h"
 #include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
 
-extern Effect_t effect_Flanger;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *flng_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define FLNG_POSITION_MAX 0x0003ffff  
+#define FLNG_BUFFSIZE 2000
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t amplitude;
+    uint16_t step;
+} flng_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    uint32_t location; // Sinewave lookup index (24b.8b)
+    uint16_t position; // Buffer read/write index
+    int32_t amplitude; // Smoothed amplitude with 8bits of fraction
+    int16_t *buffer; // From the delay arena while on. NULL when off
+} flng_settings_t;
+
+// One flanger. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<flng_params_t> params;
+    flng_settings_t settings;
+} flng_instance_t;
+
+// This is where the effect is actually processed
+// Note this function could be made much more memory efficiant
+// by reusing variables, at the cost of being much hard to read
+inline int32_t flng_process(Effect_t *effect, int32_t value){
+	int32_t sine, offset;
+	flng_instance_t *instance = (flng_instance_t *)effect->data;
+	flng_settings_t *settings = &instance->settings;
+	const flng_params_t *params = instance->params.read();
+	int16_t *buffer = settings->buffer;
+
+	// Can be called for a moment after being turned off
+	if(buffer == NULL) return value;
+
+  settings->location += params->step;
+  // if we've gone over the table boundary -> loop back
+  settings->location &= FLNG_POSITION_MAX;
+  // Interpolate between the two table entries either side of location
+  sine = dsp_sine(settings->location);
+  // Flanger offset in samples with 8bits of fraction
+  offset = dsp_mulQ16(sine, (uint16_t)dsp_smooth(&settings->amplitude, params->amplitude, SMOOTH_FAST));
+
+	// store incoming data
+  buffer[settings->position++] = (int16_t)value;
+  // check if position has gotten bigger than buffer size
+  if (settings->position >= FLNG_BUFFSIZE) {
+    settings->position = 0; // reset position
+  }
+
+  // Now do the Flanger effect
+	// fetch delayed data with sinusoidal offset, interpolated between the
+	// samples either side. Half the buffer behind at the centre of the sweep
+  // TODO : Add the mix here!
+  return dsp_delayRead(buffer, FLNG_BUFFSIZE, ((uint32_t)(settings->position + (FLNG_BUFFSIZE/2)) << 8) + offset, 8);
+}
 
 #endif
@@ -0,0 +1,54 @@
+/*
+	Effect instances
+
+	An effect keeps its user params and DSP state in an instance struct
+	rather than file statics, so it can be in the chain more than once with
+	different settings. Its delay line pointer is part of that state and
+	comes from the arena per instance (see delay_arena.h).
+
+	There is no heap, so each effect has a fixed pool of EFFECT_COPIES
+	instances. create() takes a free one, copies the effect's prototype
+	Effect_t into it and resets the state from a const initial copy.
+	Effect_t.data points at the state and is NULL while the instance is free.
+*/
+#ifndef __Effect_Instance__
+#define __Effect_Instance__
+
+#include <stdint.h>
+#include "config.h"
+#include "Effect_typeDefs.h"
+
+template <class T, uint8_t N = EFFECT_COPIES>
+struct EffectPool {
+	Effect_t effects[N];
+	T data[N];
+
+	// A new instance. NULL if all N are in use
+	inline Effect_t *create(const Effect_t *prototype, const T *initial){
+		uint8_t idx;
+		for(idx=0; idx < N; idx++){
+			if(effects[idx].data != NULL) continue;
+			data[idx] = *initial;
+			effects[idx] = *prototype;
+			effects[idx].copy = idx + 1;
+			effects[idx].data = &data[idx];
+			return &effects[idx];
+		}
+		return NULL;
+	}
+	// Instances on or waiting to come on. See effect_isOn()
+	inline uint8_t on() const {
+		uint8_t idx, count = 0;
+		for(idx=0; idx < N; idx++){
+			if(effects[idx].data != NULL && effect_isOn(&effects[idx])) count++;
+		}
+		return count;
+	}
+};
+
+// Hands an instance back to its pool. It must be off and out of the chain
+inline void effect_destroy(Effect_t *effect){
+	effect->data = NULL;
+}
+
+#endif
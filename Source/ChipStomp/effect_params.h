@@ -0,0 +1,51 @@
+/*
+	Parameter hand-over between the main loop and the audio ISR
+
+	adjustFeature() runs in the main loop and can be interrupted by the ISR
+	half way through updating a multi-field set of parameters. So parameters
+	are double buffered : the main loop edits the idle copy then publishes it
+	with a single byte write. The ISR can't be interrupted by the main loop
+	so whatever copy it picks up at the start of a sample is consistent.
+
+	The ISR then ramps towards the published values with dsp_smooth() (see
+	dsp_fixed.h) so an encoder detent doesn't produce a step (zipper noise).
+*/
+#ifndef __Effect_Params__
+#define __Effect_Params__
+
+#include <stdint.h>
+#include <string.h>
+
+template <class T>
+struct ParamBuffer {
+	T set[2];
+	volatile uint8_t active;
+
+	// ISR side : the current consistent set
+	inline const T *read() const {
+		return &set[active];
+	}
+	// Main loop side : the idle copy primed with the current values
+	inline T *edit(){
+		set[active ^ 1] = set[active];
+		return &set[active ^ 1];
+	}
+	// Main loop side : make the edited copy live
+	inline void publish(){
+		active ^= 1;
+	}
+	// Main loop side : copies the live values out for a preset. Returns the length
+	inline uint8_t store(uint8_t *data) const {
+		memcpy(data, read(), sizeof(T));
+		return sizeof(T);
+	}
+	// Main loop side : the idle copy filled from a preset, ready to publish.
+	// NULL if the preset was stored with a different layout
+	inline T *restore(const uint8_t *data, uint8_t length){
+		if(length != sizeof(T)) return NULL;
+		memcpy(&set[active ^ 1], data, sizeof(T));
+		return &set[active ^ 1];
+	}
+};
+
+#endif
@@ -1,18 +1,105 @@
 /*
 	Header for PitchShift Effect
 	Each Effect is self contained
-	The only interface declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_PitchShift__
 #define __Effect_PitchShift__
 
 #include "config.h"
 #include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
 
-extern Effect_t effect_Pitchshift;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *pitch_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define PITCH_BUFFER_SIZE 512 // * int16_t
+#define PITCH_WRAP_SHIFT 4
+#define PITCH_WRAP_SIZE (1 << PITCH_WRAP_SHIFT) // How much overlap there is to reduce glitching
+#define PITCH_READPOS_MAX_MASK ((PITCH_BUFFER_SIZE << 8)-1)
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t mix;
+    uint16_t step; // Playback rate (0x0100 = 1 step)
+} pitch_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    int32_t mix; // Smoothed mix with 8bits of fraction
+    uint16_t writepos; // Buffer write index
+    uint32_t readpos; // Tap read offset position int + 8bit fractional
+    int16_t *buffer; // Sample grain from the delay arena while on. NULL when off
+} pitch_settings_t;
+
+// One pitch shifter. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<pitch_params_t> params;
+    pitch_settings_t settings;
+} pitch_instance_t;
+
+// This is where the effect is actually processed
+// We can't alter the input sample rate nor the final output sample rate.
+// So to pitch shift we have a "playhead" that can increment at a fractional rate
+// To avoid glitching when the record and play heads pass we cross fade for a few samples
+// The initial plan was to grab two samples from the input buffer N and N+1 and interpolates between 
+// them to produce a reasonable approx of what the actual sample might be.
+// But that didn't work out well so SCREW IT! 
+// This super naive single un-interpolated sample version sounds far better than the clever interpolated one.
+
+inline int32_t pitch_process(Effect_t *effect, int32_t value){
+	uint16_t idx, diff;
+	int16_t sample;
+	pitch_instance_t *instance = (pitch_instance_t *)effect->data;
+	pitch_settings_t *settings = &instance->settings;
+	const pitch_params_t *params = instance->params.read();
+	int16_t *buffer = settings->buffer;
+
+	// Can be called for a moment after being turned off
+	if(buffer == NULL) return value;
+
+	// We always write at a constant rate
+	buffer[settings->writepos] = (int16_t)value;
+	
+	idx = settings->readpos >> 8; // Get the upper integer bits
+	if(idx > PITCH_BUFFER_SIZE) idx = 0;
+  // Increment the read position : Note use of 8bits of fractional
+  // This allows the reading to be done at a different rate than writing
+  // The step isn't smoothed : a jump in rate is already click free
+  settings->readpos += params->step;
+  settings->readpos &= PITCH_READPOS_MAX_MASK; // Fast wrap around
+
+	// Grab a sample
+	sample = buffer[idx];
+
+	// Difference between record and play heads : Used to determine if we should xfade
+	diff = ( idx - settings->writepos + PITCH_BUFFER_SIZE ) % PITCH_BUFFER_SIZE;
+	if(diff < PITCH_WRAP_SIZE){
+    // We need to cross-fade
+		// From the sample just written towards the play head's, by how far
+		// apart they are over the length of the wrap
+		sample = (int16_t)dsp_lerp(buffer[settings->writepos], sample, diff, PITCH_WRAP_SHIFT);
+  }
+
+  // Increment write position : check if position has gotten bigger than buffer size
+  settings->writepos++;
+	if (settings->writepos >= PITCH_BUFFER_SIZE) {
+    settings->writepos = 0; // reset
+  }
+
+  // Handle mixing
+  // TODO : Actually mix the original signal with the mdified.
+ 	return dsp_mulQ16(sample, (uint16_t)dsp_smooth(&settings->mix, params->mix, SMOOTH_FAST));
+}
 
 #endif
@@ -0,0 +1,353 @@
+/*
+	Reverb functions
+	Four feedback combs in parallel into two allpasses in series, the
+	classic Schroeder layout as used by Freeverb, in mono.
+
+	A reverb at the full sample rate wants tens of Kb of delay line, which
+	isn't there once the Echo has its tape. So like the Echo the lines run
+	at a quarter of the rate, 10kHz, which takes the bandwidth down to 5kHz.
+	A reverb's tail is mostly dark anyway, and more so on a bass. The input
+	is averaged down to the line rate and the output interpolated back up,
+	the same cheap filtering the Echo does.
+
+	Size scales every line together. A Studio takes ~2.7Kb from the delay
+	arena when turned on, a Cave twice that. Changing the size while on
+	starts the reverb afresh with new lines.
+	Decay is the comb feedback and Damping low passes it, so that highs die
+	away sooner than lows, as they do in a real room.
+
+	With tails on (the default) turning the reverb off lets it die away
+	rather than cutting it dead (see effect_bypass.h).
+*/
+#include <PLIB.h>
+#include "effect_reverb.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+#include "delay_arena.h"
+
+//******** Private macros ********//
+
+#define FEATURECOUNT 4  // Note : Default feature is 0 : It does nothing
+#define FEATURE_LINES 3 // Lines of features that fit under the title
+#define COST 110 // Cycles per sample from the host cost model (make bench), rounded up. Raised at runtime if measured higher
+#define DECAY_MIN 0x8000 // Feedback of 0.5
+#define DECAY_MAX 0xf800 // Feedback of 0.97
+#define DAMPING_MIN 0x0000
+#define DAMPING_MAX 0xe000
+#define MIX_MAX 0xffff
+#define MIX_MIN 0x0000
+#define SIZES 5
+#define SIZE_ONE 4 // Line lengths are scaled in quarters
+
+//******** Private function declarations ********//
+
+void revb_nextFeature(Effect_t *effect);
+void revb_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t revb_toggleOnOff(Effect_t *effect);
+int32_t revb_effectISR(Effect_t *effect, int32_t value);
+void revb_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void revb_report(Effect_t *effect);
+uint8_t revb_save(Effect_t *effect, uint8_t *data);
+void revb_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+void revb_decay_adjust(revb_instance_t *instance, int32_t value);
+void revb_damping_adjust(revb_instance_t *instance, int32_t value);
+void revb_mix_adjust(revb_instance_t *instance, int32_t value);
+void revb_size_adjust(Effect_t *effect, int16_t value);
+uint8_t revb_claim(Effect_t *effect);
+void revb_release(Effect_t *effect);
+uint16_t revb_length(uint8_t size, uint8_t line);
+void revb_setSize(Effect_t *effect, uint8_t size);
+uint16_t revb_clampAdd(uint16_t value, int32_t delta, uint16_t min, uint16_t max);
+
+//******** Private variables ********//
+
+// Every new instance starts from this
+static const revb_instance_t initial = {
+		{{{
+				0xd000
+			, 0x6000
+			, MIX_MAX / 3
+		}}}
+	, {
+				NULL
+		}
+	, 2
+};
+static EffectPool<revb_instance_t> pool;
+
+enum features_t {SAFE, DECAY, DAMPING, MIX, SIZE};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_FINE, ENC_CURVE_COARSE, ENC_CURVE_COARSE, ENC_CURVE_NONE};
+static const char *sizenames[SIZES] = {"Small", "Room", "Studio", "Hall", "Cave"};
+static const uint8_t sizescales[SIZES] = {2, 3, 4, 6, 8}; // Quarters
+
+// Line lengths for a Studio at the line rate. Freeverb's, scaled from
+// 44.1kHz and nudged so that no two share a factor at this size
+static const uint16_t linelengths[REVB_LINES] = {253, 269, 290, 307, 127, 101};
+
+// Copied into each instance by revb_create()
+static const Effect_t prototype = {
+		"Reverb"
+	, 0
+	, 0
+	, revb_nextFeature
+	, revb_adjustFeature
+	, revb_toggleOnOff
+	, revb_effectISR
+	, revb_processBlock
+	, revb_report
+	, COST
+	, featurecurves
+	, revb_save
+	, revb_load
+	, 0 // Memory : Depends on the room size. Set by revb_setSize()
+	, 1 // Tails : The reverb dies away when turned off
+};
+
+//******** Function definitions ********//
+
+// New instance for the chain
+Effect_t *revb_create(){
+	Effect_t *effect = pool.create(&prototype, &initial);
+	if(effect) revb_setSize(effect, initial.size);
+	return effect;
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t revb_effectISR(Effect_t *effect, int32_t value){
+	return revb_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void revb_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = revb_process(effect, *block);
+		block++;
+	}
+}
+
+// Cycles my features
+void revb_nextFeature(Effect_t *effect){
+	if(FEATURECOUNT <= 1) return;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
+	}else{
+		// Skip the safe feature
+		effect->featureIdx = 1;
+	}
+}
+
+// Turns me on or off
+uint8_t revb_toggleOnOff(Effect_t *effect){
+	if(effect->state){
+		effect->state = 0;
+		revb_release(effect);
+	}else if(revb_claim(effect)){
+		effect->state = 1;
+	}
+	return effect->state;
+}
+
+// Length of a line for a room size
+uint16_t revb_length(uint8_t size, uint8_t line){
+	return (linelengths[line] * sizescales[size]) / SIZE_ONE;
+}
+
+// Sets the room size and the memory its lines take, so the arena knows
+// what to make room for before the reverb asks
+void revb_setSize(Effect_t *effect, uint8_t size){
+	uint8_t idx;
+	((revb_instance_t *)effect->data)->size = size;
+	effect->memory = 0;
+	for(idx=0; idx < REVB_LINES; idx++){
+		effect->memory += revb_length(size, idx);
+	}
+}
+
+// Takes the lines for the room size from the arena. Returns 0 if they don't fit
+uint8_t revb_claim(Effect_t *effect){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	revb_settings_t *settings = &instance->settings;
+	int16_t *buffer, *line;
+	uint16_t size;
+	uint8_t idx;
+	buffer = arena_alloc(effect, effect->memory, effect->memory, &size);
+	if(buffer == NULL) return 0;
+	line = buffer;
+	for(idx=0; idx < REVB_LINES; idx++){
+		settings->lines[idx] = line;
+		settings->length[idx] = revb_length(instance->size, idx);
+		settings->pos[idx] = 0;
+		line += settings->length[idx];
+	}
+	for(idx=0; idx < REVB_COMBS; idx++){
+		settings->damped[idx] = 0;
+	}
+	settings->phase = 0;
+	settings->sum = 0;
+	settings->in = 0;
+	settings->acc = 0;
+	settings->mix1 = 0;
+	settings->mix2 = 0;
+	// Once quiet for the longest comb's loop, it's died away
+	effect->tail = (uint32_t)settings->length[REVB_COMBS - 1] << REVB_SHIFT;
+	// Last : The static chain starts using the lines as soon as this is set
+	settings->buffer = buffer;
+	return 1;
+}
+
+// Gives the lines back to the arena
+void revb_release(Effect_t *effect){
+	revb_settings_t *settings = &((revb_instance_t *)effect->data)->settings;
+	int16_t *buffer = settings->buffer;
+	settings->buffer = NULL;
+	arena_free(buffer);
+}
+
+// Adjust the value of the current feature
+// Receives the encoder delta
+void revb_adjustFeature(Effect_t *effect, int16_t value){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
+		case DECAY:{
+			revb_decay_adjust(instance, (int32_t)value*256);
+			break;
+		}
+		case DAMPING:{
+			revb_damping_adjust(instance, (int32_t)value*512);
+			break;
+		}
+		case MIX:{
+			revb_mix_adjust(instance, (int32_t)value*0xff);
+			break;
+		}
+		case SIZE:{
+			revb_size_adjust(effect, value);
+			break;
+		}
+	}
+}
+
+// value added to a setting, clamped to within min/max
+uint16_t revb_clampAdd(uint16_t value, int32_t delta, uint16_t min, uint16_t max){
+	int32_t result = value + delta;
+	if(result > max){
+		result = max;
+	}else if(result < min){
+		result = min;
+	}
+	return (uint16_t)result;
+}
+
+// Alters the comb feedback by value (+ or -)
+void revb_decay_adjust(revb_instance_t *instance, int32_t value){
+	revb_params_t *params = instance->params.edit();
+	params->decay = revb_clampAdd(params->decay, value, DECAY_MIN, DECAY_MAX);
+	instance->params.publish();
+}
+
+// Alters the damping by value (+ or -)
+void revb_damping_adjust(revb_instance_t *instance, int32_t value){
+	revb_params_t *params = instance->params.edit();
+	params->damping = revb_clampAdd(params->damping, value, DAMPING_MIN, DAMPING_MAX);
+	instance->params.publish();
+}
+
+// Alters the wet level by value (+ or -)
+void revb_mix_adjust(revb_instance_t *instance, int32_t value){
+	revb_params_t *params = instance->params.edit();
+	params->mix = revb_clampAdd(params->mix, value, MIX_MIN, MIX_MAX);
+	instance->params.publish();
+}
+
+// Steps through the room sizes
+// The lines can't be stretched on the fly so a running reverb fades out
+// and starts afresh. See arena_restart()
+void revb_size_adjust(Effect_t *effect, int16_t value){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	int16_t result = instance->size + (value > 0 ? 1 : -1);
+	if(result >= SIZES || result < 0) return;
+	revb_setSize(effect, (uint8_t)result);
+	arena_restart(effect);
+}
+
+// Copies my settings and the room size out for a preset
+uint8_t revb_save(Effect_t *effect, uint8_t *data){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	uint8_t length = instance->params.store(data);
+	data[length++] = instance->size;
+	return length;
+}
+
+// Takes my settings from a preset. A running reverb starts afresh if the size changed
+void revb_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	uint8_t size;
+	if(length != sizeof(revb_params_t) + 1) return;
+	size = data[sizeof(revb_params_t)];
+	if(size >= SIZES) return;
+	instance->params.restore(data, sizeof(revb_params_t));
+	instance->params.publish();
+	if(size != instance->size){
+		revb_setSize(effect, size);
+		arena_restart(effect);
+	}
+}
+
+// Sends a string of my state to stdout
+void revb_report(Effect_t *effect){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
+	const revb_params_t *params = instance->params.read();
+	uint8_t line, first, y, idx;
+	float loop = 0;
+
+	// More features than lines. Scroll so the selected one is on screen
+	first = (feat > FEATURE_LINES) ? feat - FEATURE_LINES + 1 : 1;
+	for(line=first; line < first + FEATURE_LINES; line++){
+		y = DISP_FEAT_Y + (line - first) * 14;
+		// Write to screen
+		if(feat == line){
+			display.setTextColor(0);
+			display.fillRect(0,y,DISP_FEAT_W,13,1);
+		}else{
+			display.setTextColor(1);
+		}
+		display.setCursor(DISP_FEAT_INDENT,y);
+		switch(line){
+			case DECAY:{
+				// Time to die away by 60dB : each trip round an average comb loses 20log10(decay) dB
+				for(idx=0; idx < REVB_COMBS; idx++){
+					loop += revb_length(instance->size, idx);
+				}
+				loop = loop / REVB_COMBS * REVB_RATIO / SAMPLERATE;
+				display.print("Decay ");
+				display.print(-3 * loop / log10(params->decay / 65536.0), 1);
+				display.print("s");
+				break;
+			}
+			case DAMPING:{
+				display.print("Damping ");
+				display.print(percentage(params->damping, DAMPING_MAX, DAMPING_MIN), 0);
+				display.print("%");
+				break;
+			}
+			case MIX:{
+				display.print("Mix ");
+				display.print(percentage(params->mix, MIX_MAX, MIX_MIN), 0);
+				display.print("%");
+				break;
+			}
+			case SIZE:{
+				display.print("Size ");
+				display.print(sizenames[instance->size]);
+				break;
+			}
+		}
+	}
+	display.setTextColor(1);
+}
@@ -0,0 +1,140 @@
+/*
+	Header for Reverb Effect
+	Each Effect is self contained
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
+
+	Effects must provide a struct to comply with Effect_t;
+
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
+*/
+#ifndef __Effect_Reverb__
+#define __Effect_Reverb__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
+
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *revb_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define REVB_RATIO 4 // Ratio of main sample rate for the reverb lines
+#define REVB_SHIFT 2 // Number of bits to shift to match REVB_RATIO
+#define REVB_COMBS 4 // Parallel feedback combs
+#define REVB_LINES 6 // The combs then two allpasses in series
+#define REVB_HEADROOM 5 // Bits the input is cut by so the combs' resonances fit the int16 lines.
+                        // So the network hears about 11bits. No loss straight after the 10bit ADC,
+                        // but behind Distortion, Filter or Compressor the bottom 5 bits are dropped
+#define REVB_ALLPASS 0x4000 // Allpass feedback, Q15 0.5
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t decay; // Comb feedback, Q16
+    uint16_t damping; // How much the comb feedback is low passed, Q16
+    uint16_t mix; // Wet level
+} revb_params_t;
+
+// Internal state : Only touched by the ISR
+// buffer is NULL while off. It comes from the delay arena when turned on
+typedef struct {
+    int16_t *buffer; // All the lines, one after the other
+    int16_t *lines[REVB_LINES]; // Start of each line in buffer
+    uint16_t length[REVB_LINES]; // Length of each line
+    uint16_t pos[REVB_LINES]; // Read/write index of each line
+    int32_t damped[REVB_COMBS]; // Low passed comb feedback
+    uint8_t phase; // Main rate sample within the reverb rate one
+    int32_t sum; // Input added up over REVB_RATIO samples
+    int32_t in; // The last REVB_RATIO averaged, scaled down by REVB_HEADROOM
+    int32_t acc; // Network output, built up over the phases
+    int32_t mix1, mix2; // Last two network outputs, ready to interpolate
+    int32_t mix; // Smoothed wet level with 8bits of fraction
+} revb_settings_t;
+
+// One reverb. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<revb_params_t> params;
+    revb_settings_t settings;
+    uint8_t size; // Room size for the next claim. Only the main loop touches this
+} revb_instance_t;
+
+// a x b >> shift, rounded towards zero rather than down. Going round a
+// loop, rounding down would leave a small negative value there for ever
+// and the reverb would never die away
+inline int32_t revb_mulZero(int32_t a, int32_t b, uint8_t shift){
+	int32_t product = a * b;
+	return (product + ((product >> 31) & ((1L << shift) - 1))) >> shift;
+}
+
+// Feedback comb with a low pass in the loop, so highs die away first
+inline int32_t revb_comb(revb_settings_t *settings, uint8_t line, const revb_params_t *params){
+	int16_t *sample = &settings->lines[line][settings->pos[line]];
+	int32_t out = *sample;
+	int32_t *damped = &settings->damped[line];
+	// Keeps damping of the way it was and moves the rest towards out
+	*damped = out + revb_mulZero(*damped - out, params->damping >> 1, 15);
+	*sample = (int16_t)dsp_sat16(settings->in + revb_mulZero(*damped, params->decay, 16));
+	if(++settings->pos[line] >= settings->length[line]) settings->pos[line] = 0;
+	return out;
+}
+
+// Schroeder allpass : Thickens the echoes without colouring them
+inline int32_t revb_allpass(revb_settings_t *settings, uint8_t line, int32_t in){
+	int16_t *sample = &settings->lines[line][settings->pos[line]];
+	int32_t delayed = *sample;
+	*sample = (int16_t)dsp_sat16(in + revb_mulZero(delayed, REVB_ALLPASS, 15));
+	if(++settings->pos[line] >= settings->length[line]) settings->pos[line] = 0;
+	return delayed - in;
+}
+
+// This is where the effect is actually processed
+// Like the Echo's tape, the lines only move every REVB_RATIO samples,
+// fed with the average of the input over them. Rather than doing all six
+// lines on one sample and nothing on the rest, the work is spread over
+// the REVB_RATIO samples so no one sample costs much more than another.
+// The output is interpolated between the last two network outputs.
+inline int32_t revb_process(Effect_t *effect, int32_t value){
+	revb_instance_t *instance = (revb_instance_t *)effect->data;
+	revb_settings_t *settings = &instance->settings;
+	const revb_params_t *params = instance->params.read();
+	uint8_t phase = settings->phase;
+	int32_t wet;
+
+	// Can be called for a moment after being turned off
+	if(settings->buffer == NULL) return value;
+
+	settings->phase = (phase + 1) & (REVB_RATIO - 1);
+	switch(phase){
+		case 0:{
+			settings->in = settings->sum >> (REVB_SHIFT + REVB_HEADROOM);
+			settings->sum = 0;
+			settings->acc = revb_comb(settings, 0, params) + revb_comb(settings, 1, params);
+			break;
+		}
+		case 1:{
+			settings->acc += revb_comb(settings, 2, params) + revb_comb(settings, 3, params);
+			break;
+		}
+		case 2:{
+			// Four combs can add up to four times full scale
+			settings->acc = revb_allpass(settings, 4, settings->acc >> 2);
+			break;
+		}
+		default:{
+			settings->mix1 = settings->mix2;
+			settings->mix2 = revb_allpass(settings, 5, settings->acc);
+			break;
+		}
+	}
+	settings->sum += value;
+
+	// The new output lands as phase wraps, so this carries on from where the last one got to
+	wet = dsp_lerp(settings->mix1, settings->mix2, settings->phase, REVB_SHIFT);
+	return value + (dsp_mulQ16(dsp_sat16(wet), (uint16_t)dsp_smooth(&settings->mix, params->mix, SMOOTH_FAST)) << (REVB_HEADROOM - 1));
+}
+
+#endif
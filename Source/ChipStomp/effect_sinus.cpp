@@ -7,10 +7,14 @@
 
 #include <PLIB.h>
 #include "effect_sinus.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
+#include "dsp_fixed.h"
 
 //******** Private macros ********//
 
 #define FEATURECOUNT 2  // Note : Default feature is 0 : It does nothing
+#define COST 150 // Conservative worst case cycles per sample. Raised at runtime if measured higher
 #define WAVE_LEN 0x03ff  // Number of samples
 #define AMP_MAX 0xffff
 #define AMP_MIN 0x0000
@@ -22,14 +26,15 @@
 
 //******** Private function declarations ********//
 
-void sinus_nextFeature();
-void sinus_adjustFeature(int16_t value);
-uint8_t sinus_toggleOnOff();
-int32_t sinus_effectISR(int32_t value);
-void sinus_report();
-float sinus_getHz();
-void sinus_freq_adjust(int16_t value);
-void sinus_amp_adjust(int16_t value);
+void sinus_nextFeature(Effect_t *effect);
+void sinus_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t sinus_toggleOnOff(Effect_t *effect);
+int32_t sinus_effectISR(Effect_t *effect, int32_t value);
+void sinus_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void sinus_report(Effect_t *effect);
+float sinus_getHz(Effect_t *effect);
+void sinus_freq_adjust(Effect_t *effect, int16_t value);
+void sinus_amp_adjust(Effect_t *effect, int32_t value);
 
 //******** Private variables ********//
 
@@ -39,18 +44,19 @@ typedef struct {
     uint16_t amplitude;
     uint16_t step;
 } settings_t;
-static settings_t settings = {
+// Every new instance starts from this
+static const settings_t initial = {
 		0
 	,	AMP_MAX / 2
 	, 55
 };
+static EffectPool<settings_t> pool;
 enum features_t {SAFE, AMP, FREQ};
 static const char *featurenames[] = {"Safe", "Amplitude","Frequency"};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_COARSE, ENC_CURVE_FINE};
 
-//******** Global variables ********//
-
-// This struct is exposed globally via extern in the header
-Effect_t effect_Sinus = {
+// Copied into each instance by sinus_create()
+static const Effect_t prototype = {
 		"Sinus"
 	, 0
 	, 0
@@ -58,17 +64,25 @@ Effect_t effect_Sinus = {
 	, sinus_adjustFeature
 	, sinus_toggleOnOff
 	, sinus_effectISR
+	, sinus_processBlock
 	, sinus_report
+	, COST
+	, featurecurves
+	, NULL
+	, NULL
 };
 
 //******** Function definitions ********//
 
+// New instance for the chain
+Effect_t *sinus_create(){
+	return pool.create(&prototype, &initial);
+}
+
 // This is where the effect is actually processed
-int32_t sinus_effectISR(int32_t value){
-	uint16_t idx, amp;
-	int16_t sine1, sine2;
-	int32_t result;
-	uint8_t frac;
+static inline int32_t sinus_process(Effect_t *effect, int32_t value){
+	int32_t sine;
+	settings_t *settings = (settings_t *)effect->data;
 
   // create a variable frequency and amplitude sinewave.
   // since we will be moving through the lookup table at
@@ -78,80 +92,65 @@ int32_t sinus_effectISR(int32_t value){
   // step through the table at rate determined by step
   // use upper byte of step value to set the rate
   // and have an offset of 1 so there is always an increment.
-  // settings.position  += 1 + (mod1_value >> 8);
-  settings.position  += settings.step;
+  // settings->position  += 1 + (mod1_value >> 8);
+  settings->position  += settings->step;
   // if we've gone over the table boundary -> loop back
-  settings.position  &= POSITION_MAX; // this is a faster way doing the table
+  settings->position  &= POSITION_MAX; // this is a faster way doing the table
                           // wrap around, which is possible
                           // because our table is a multiple of 2^n.
                           // otherwise you would do something like:
-                          // if (settings.position  >= 1024*256) {
-                          //   settings.position  -= 1024*256;
+                          // if (settings->position  >= 1024*256) {
+                          //   settings->position  -= 1024*256;
                           // }
-  // Get the index part
-  idx = (settings.position >> 8);
-  
-  // Retrieve first sine sample sample
-  sine1 = g_sinewave[idx];
-  idx++; // go to next sample
-  // TODO: Check this is actually correct. I'm not sure STEP_MAX is the right value to be using here.
-  idx &= STEP_MAX; // check if we've gone over the boundary.
-                   // we can do this because its a multiple of 2^n,
-                   // otherwise it would be:
-                   // if (idx  >= 1024) {
-                   //   idx  = 0; // reset to 0
-                   // }
-  // get second sample and put it in sine2 
-  sine2  = g_sinewave[idx];
-  
-  // interpolate between samples
-  // multiply each sample by the fractional distance
-  // to the actual settings.position  value
-  frac = (uint8_t)(settings.position & 0x000000ff); // fetch the lower 8b
-  // scale sample 2
-  sine2 = (sine2 * frac) >> 8;
-  // scale sample 1
-  sine1 = (sine1 * (0xff - frac )) >> 8;
+  // Interpolate between the two table entries either side of position.
+  // dsp_sine() wraps the second one at the table length
+  sine = dsp_sine(settings->position);
   
-  // add samples together to get an average
-  // our resultant sinewave is now in sine2 
-  sine2 += sine1;
-  sine2 = (sine2 * settings.amplitude) >> 16;
-  //return sine2;
-  
-  result = value + sine2;
-  return result;
+  return value + dsp_mulQ16(sine, settings->amplitude);
+}
+
+// Per sample entry point for the Timer1 ISR
+int32_t sinus_effectISR(Effect_t *effect, int32_t value){
+	return sinus_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void sinus_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = sinus_process(effect, *block);
+		block++;
+	}
 }
 
 // Cycles my features
-void sinus_nextFeature(){
+void sinus_nextFeature(Effect_t *effect){
 	if(FEATURECOUNT <= 1) return;
-	if(effect_Sinus.featureIdx < FEATURECOUNT) {
-		effect_Sinus.featureIdx++;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
 	}else{
 		// Skip the safe feature
-		effect_Sinus.featureIdx = 1;
+		effect->featureIdx = 1;
 	}
 }
 
 // Turns me on or off
-uint8_t sinus_toggleOnOff(){
-	if(effect_Sinus.state) effect_Sinus.state = 0;
-	else effect_Sinus.state = 1;
+uint8_t sinus_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
 }
 
 // Adjust the value of the current feature
 // Receives the encoder delta
-void sinus_adjustFeature(int16_t value){
+void sinus_adjustFeature(Effect_t *effect, int16_t value){
 	// Currently hard coded to alter the step
-	features_t feat = (features_t)effect_Sinus.featureIdx;
+	features_t feat = (features_t)effect->featureIdx;
 	switch(feat){
 		case AMP:{
-			sinus_amp_adjust((uint16_t)value*0xff);	
+			sinus_amp_adjust(effect, (int32_t)value*0xff);	
 			break;
 		}
 		case FREQ:{
-			sinus_freq_adjust((uint16_t)value);	
+			sinus_freq_adjust(effect, (uint16_t)value);	
 			break;
 		}
 	}
@@ -161,31 +160,34 @@ void sinus_adjustFeature(int16_t value){
 // Step value determines frequency
 // use an int32 for result to make boundry checking easy
 // Clamps result to within min/max
-void sinus_freq_adjust(int16_t value){
-	int32_t result = settings.step + value;
+void sinus_freq_adjust(Effect_t *effect, int16_t value){
+	settings_t *settings = (settings_t *)effect->data;
+	int32_t result = settings->step + value;
 	if(result > STEP_MAX){
 		result = STEP_MAX;
 	}else if(result < STEP_MIN){
 		result = STEP_MIN;
 	}
-	settings.step = (uint16_t)result;
+	settings->step = (uint16_t)result;
 }
 
 // Alters the current Sinus amplitude value by value (+ or -)
 // Clamps result to within min/max
-void sinus_amp_adjust(int16_t value){
-	int32_t result = settings.amplitude + value;
+void sinus_amp_adjust(Effect_t *effect, int32_t value){
+	settings_t *settings = (settings_t *)effect->data;
+	int32_t result = settings->amplitude + value;
 	if(result > AMP_MAX){
 		result = AMP_MAX;
 	}else if(result < AMP_MIN){
 		result = AMP_MIN;
 	}
-	settings.amplitude = (uint16_t)result;
+	settings->amplitude = (uint16_t)result;
 }
 
 // Sends a string of my state to stdout
-void sinus_report(){
-	features_t feat = (features_t)effect_Sinus.featureIdx;
+void sinus_report(Effect_t *effect){
+	settings_t *settings = (settings_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
 	// Write to screen
 	if(feat == AMP){
 		display.setTextColor(0);
@@ -194,7 +196,7 @@ void sinus_report(){
 		display.setTextColor(1);
 	}
 	display.print("Amp ");
-  display.print(percentage(settings.amplitude, AMP_MAX, AMP_MIN), 2);
+  display.print(percentage(settings->amplitude, AMP_MAX, AMP_MIN), 2);
 	display.print("%");
 
   if(feat == FREQ){
@@ -205,13 +207,13 @@ void sinus_report(){
 	}
 	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
   display.print("Freq ");
-  display.print(sinus_getHz(), 2);
+  display.print(sinus_getHz(effect), 2);
 	display.print("Hz");
 }
 
 // Returns the Sinus frequency calculated from the step
-float sinus_getHz(){
-	uint16_t step = settings.step; // This is volatile. Get it once
+float sinus_getHz(Effect_t *effect){
+	uint16_t step = ((settings_t *)effect->data)->step; // This is volatile. Get it once
 	uint8_t idx;
 	uint8_t frac;
 	float result;
@@ -1,11 +1,11 @@
 /*
 	Header for Sinus Effect
 	Each Effect is self contained
-	The only interface declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_Sinus__
 #define __Effect_Sinus__
@@ -13,6 +13,7 @@
 #include "config.h"
 #include "Effect_typeDefs.h"
 
-extern Effect_t effect_Sinus;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *sinus_create();
 
 #endif
@@ -0,0 +1,164 @@
+/*
+	Effect chain slots
+
+	Only ever changed from the main loop. Each change edits the idle copy of
+	g_slots and publishes it in one write, so the ISR either runs the old
+	chain or the new one, never a mix. An effect is only freed once it is
+	off (the ISR skips it) and the chain without it has been published.
+
+	With STATIC_CHAIN the ISR runs a compile time chain that has one of each
+	effect in g_effectTypes order, so the chain can't be rearranged and no
+	effect can be added twice.
+*/
+#include <PLIB.h>
+#include "effect_slots.h"
+#include "effect_instance.h"
+#include "preset.h"
+
+//******** Private function declarations ********//
+
+Effect_t *slots_insert(Effect_t *effect, uint8_t slot);
+
+//******** Global variables ********//
+
+// Starts as an empty chain. setup() adds the effects
+ParamBuffer<EffectSlots_t> g_slots;
+
+//******** Function definitions ********//
+
+uint8_t slots_count(){
+	Effect_t * const *chain = slots_chain();
+	uint8_t count = 0;
+	while(chain[count] != NULL) count++;
+	return count;
+}
+
+uint8_t slots_find(Effect_t *effect){
+	Effect_t * const *chain = slots_chain();
+	uint8_t slot;
+	for(slot=0; chain[slot] != NULL; slot++){
+		if(chain[slot] == effect) return slot;
+	}
+	return SLOTS_NONE;
+}
+
+// Puts effect in the chain at slot, moving the ones from there on along
+Effect_t *slots_insert(Effect_t *effect, uint8_t slot){
+	EffectSlots_t *slots = g_slots.edit();
+	uint8_t idx = slots_count();
+	slots->effect[idx + 1] = NULL;
+	for(; idx > slot; idx--){
+		slots->effect[idx] = slots->effect[idx - 1];
+	}
+	slots->effect[slot] = effect;
+	g_slots.publish();
+	return effect;
+}
+
+Effect_t *slots_add(uint8_t type){
+	Effect_t *effect;
+	uint8_t idx, count = slots_count();
+	if(count >= SLOTS_MAX) return NULL;
+	for(idx=0; idx < type; idx++){
+		if(g_effectTypes[idx] == NULL) return NULL;
+	}
+	if(g_effectTypes[type] == NULL) return NULL;
+#if STATIC_CHAIN
+	for(idx=0; idx < count; idx++){
+		if(slots_chain()[idx]->type == type) return NULL;
+	}
+#endif
+	effect = g_effectTypes[type]();
+	if(effect == NULL) return NULL;
+	effect->type = type;
+	return slots_insert(effect, count);
+}
+
+Effect_t *slots_duplicate(Effect_t *effect){
+	uint8_t settings[PRESET_EFFECT_MAX];
+	uint8_t length, slot = slots_find(effect);
+	Effect_t *copy;
+#if STATIC_CHAIN
+	return NULL;
+#endif
+	if(slot == SLOTS_NONE || slots_count() >= SLOTS_MAX) return NULL;
+	copy = g_effectTypes[effect->type]();
+	if(copy == NULL) return NULL;
+	copy->type = effect->type;
+	copy->featureIdx = effect->featureIdx;
+	// Same sound as the original, the same way a preset would set it
+	if(effect->save && copy->load){
+		length = effect->save(effect, settings);
+		copy->load(copy, settings, length);
+	}
+	return slots_insert(copy, slot + 1);
+}
+
+boolean slots_remove(Effect_t *effect){
+	Effect_t * const *chain = slots_chain();
+	EffectSlots_t *slots;
+	uint8_t idx, others = 0, slot = slots_find(effect);
+	if(slot == SLOTS_NONE || effect->state != EFFECT_OFF) return false;
+	for(idx=0; chain[idx] != NULL; idx++){
+		if(idx != slot && chain[idx]->type == effect->type) others++;
+	}
+	if(others == 0) return false;
+	slots = g_slots.edit();
+	for(idx=slot; slots->effect[idx] != NULL; idx++){
+		slots->effect[idx] = slots->effect[idx + 1];
+	}
+	g_slots.publish();
+	// The ISR only ever sees the chain without it from here on
+	effect_destroy(effect);
+	return true;
+}
+
+boolean slots_move(Effect_t *effect, int8_t step){
+	EffectSlots_t *slots;
+	uint8_t slot = slots_find(effect);
+	int16_t other = (int16_t)slot + step;
+#if STATIC_CHAIN
+	return false;
+#endif
+	if(slot == SLOTS_NONE || other < 0 || other >= slots_count()) return false;
+	slots = g_slots.edit();
+	slots->effect[slot] = slots->effect[other];
+	slots->effect[other] = effect;
+	g_slots.publish();
+	return true;
+}
+
+void slots_arrange(Effect_t * const *order, uint8_t count){
+	Effect_t * const *chain = slots_chain();
+	EffectSlots_t *slots;
+	uint8_t idx, pos, slot = 0;
+#if STATIC_CHAIN
+	return;
+#endif
+	slots = g_slots.edit();
+	for(idx=0; idx < count && slot < SLOTS_MAX; idx++){
+		if(slots_find(order[idx]) != SLOTS_NONE) slots->effect[slot++] = order[idx];
+	}
+	// The rest keep their order
+	for(pos=0; chain[pos] != NULL; pos++){
+		for(idx=0; idx < count && order[idx] != chain[pos]; idx++);
+		if(idx == count) slots->effect[slot++] = chain[pos];
+	}
+	slots->effect[slot] = NULL;
+	g_slots.publish();
+}
+
+uint16_t slots_cost(){
+	uint16_t cost = 0;
+	Effect_t * const *currentAddr = slots_chain();
+	while(*currentAddr != NULL){
+		if((*currentAddr)->state) cost += (*currentAddr)->cost;
+		currentAddr++;
+	}
+	return cost;
+}
+
+boolean slots_budgetAllows(Effect_t *effect){
+	if(effect->state) return true;
+	return (slots_cost() + effect->cost) <= CYCLE_BUDGET;
+}
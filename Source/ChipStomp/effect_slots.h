@@ -0,0 +1,60 @@
+/*
+	Header for the effect chain slots
+	The chain is a NULL terminated array of instances in the order the ISR
+	runs them. It is double buffered like any effect's params (see
+	effect_params.h) : the main loop rearranges the idle copy and publishes
+	it, so the ISR walks the same compact array whatever the order and a
+	rearrangement costs nothing per sample.
+*/
+#ifndef __Effect_Slots__
+#define __Effect_Slots__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_params.h"
+
+#define SLOTS_MAX 12 // Most effects the chain can hold. One of each type plus room for copies
+#define SLOTS_NONE 0xff // Slot of an effect that isn't in the chain
+
+typedef struct {
+	Effect_t *effect[SLOTS_MAX + 1]; // In chain order. NULL after the last
+} EffectSlots_t;
+extern ParamBuffer<EffectSlots_t> g_slots;
+
+// Makes a new instance of an effect. See effect_instance.h
+typedef Effect_t *(*EffectCreate_t)();
+// Every effect that can go in the chain, NULL terminated. Presets store an
+// effect as its position here. Declared next to setup()
+extern const EffectCreate_t g_effectTypes[];
+
+// The chain as it is running. Only the main loop changes it
+inline Effect_t * const *slots_chain(){
+	return g_slots.read()->effect;
+}
+// Number of effects in the chain
+extern uint8_t slots_count();
+// Slot effect is in. SLOTS_NONE if it isn't in the chain
+extern uint8_t slots_find(Effect_t *effect);
+// A new, off instance of g_effectTypes[type] on the end of the chain.
+// NULL if the chain is full or there are no instances left.
+extern Effect_t *slots_add(uint8_t type);
+// A new, off instance of effect with the same settings in the slot after it.
+// NULL if it can't be added
+extern Effect_t *slots_duplicate(Effect_t *effect);
+// Takes an effect that is off out of the chain and frees the instance.
+// Refused if it is the only one of its type, so every effect stays reachable
+extern boolean slots_remove(Effect_t *effect);
+// Swaps effect with the one step slots away (-1 earlier, 1 later).
+// Returns false if that would go off either end
+extern boolean slots_move(Effect_t *effect, int8_t step);
+// Puts count effects at the start of the chain in the given order. The rest
+// follow in the order they were in
+extern void slots_arrange(Effect_t * const *order, uint8_t count);
+// Sum of the worst case cost of the effects in the chain that are running.
+// Effects still fading out are running so count too
+extern uint16_t slots_cost();
+// True if turning effect on won't take the chain over CYCLE_BUDGET.
+// Turning an effect off, or back on while it fades out, is always allowed
+extern boolean slots_budgetAllows(Effect_t *effect);
+
+#endif
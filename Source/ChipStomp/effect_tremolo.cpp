@@ -7,6 +7,8 @@
 */
 #include <PLIB.h>
 #include "effect_tremolo.h"
+#include "effect_instance.h"
+#include "encoder_accel.h"
 
 // TODO : Add support for switching to different waveforms (triangle, saw, square)
 // TODO : Support multiple modulators?
@@ -14,46 +16,48 @@
 //******** Private macros ********//
 
 #define FEATURECOUNT 2  // Note : Default feature is 0 : It does nothing
-#define WAVE_LEN 0x03ff  // Number of samples
+#define COST 60 // Cycles per sample from the host cost model (make bench), rounded up. Raised at runtime if measured higher
 #define AMP_MAX 0xffff
 #define AMP_MIN 0x0000
 #define STEP_MAX 0x01ff
 #define STEP_MIN 0x0001
-#define POSITION_MAX 0x0003ffff  
-#define BASEFREQ SAMPLERATE / WAVE_LEN  // 43hz for 1024 samples @ 44.1khz
+#define BASEFREQ SAMPLERATE / DSP_SINE_MASK  // 43hz for 1024 samples @ 44.1khz
 
 
 //******** Private function declarations ********//
 
-void tremolo_nextFeature();
-void tremolo_adjustFeature(int16_t value);
-uint8_t tremolo_toggleOnOff();
-int32_t tremolo_effectISR(int32_t value);
-void tremolo_report();
-float tremolo_getHz();
-void tremolo_freq_adjust(int16_t value);
-void tremolo_amp_adjust(int16_t value);
+void tremolo_nextFeature(Effect_t *effect);
+void tremolo_adjustFeature(Effect_t *effect, int16_t value);
+uint8_t tremolo_toggleOnOff(Effect_t *effect);
+int32_t tremolo_effectISR(Effect_t *effect, int32_t value);
+void tremolo_processBlock(Effect_t *effect, int32_t *block, uint16_t n);
+void tremolo_report(Effect_t *effect);
+uint8_t tremolo_save(Effect_t *effect, uint8_t *data);
+void tremolo_load(Effect_t *effect, const uint8_t *data, uint8_t length);
+float tremolo_getHz(tremolo_instance_t *instance);
+void tremolo_freq_adjust(tremolo_instance_t *instance, int16_t value);
+void tremolo_amp_adjust(tremolo_instance_t *instance, int32_t value);
 
 //******** Private variables ********//
 
-// Internal state variables
-typedef struct {
-    uint32_t position; // 24bits of position and 8bits of fraction
-    uint16_t amplitude;
-    uint16_t step;
-} settings_t;
-static settings_t settings = {
-		0
-	,	AMP_MAX / 2
-	, 55
+// Every new instance starts from this
+static const tremolo_instance_t initial = {
+		{{{
+				AMP_MAX / 2
+			, 55
+		}}}
+	, {
+				0
+			,	(AMP_MAX / 2) << 8
+		}
 };
-enum features_t {SAFE, AMP, FREQ};
-static const char *featurenames[] = {"Safe", "Amplitude","Frequency"};
+static EffectPool<tremolo_instance_t> pool;
 
-//******** Global variables ********//
+enum features_t {SAFE, AMP, FREQ};
+static const uint8_t featurecurves[] = {ENC_CURVE_NONE, ENC_CURVE_COARSE, ENC_CURVE_FINE};
 
-// This struct is exposed globally via extern in the header
-Effect_t effect_Tremolo = {
+// Copied into each instance by tremolo_create()
+static const Effect_t prototype = {
 		"Tremolo"
 	, 0
 	, 0
@@ -61,107 +65,70 @@ Effect_t effect_Tremolo = {
 	, tremolo_adjustFeature
 	, tremolo_toggleOnOff
 	, tremolo_effectISR
+	, tremolo_processBlock
 	, tremolo_report
+	, COST
+	, featurecurves
+	, tremolo_save
+	, tremolo_load
 };
 
 //******** Function definitions ********//
 
-// Init variables to a known starting point
-void tremolo_init(void){
-
+// New instance for the chain
+Effect_t *tremolo_create(){
+	return pool.create(&prototype, &initial);
 }
 
-// This is where the effect is actually processed
-int32_t tremolo_effectISR(int32_t value){
-	uint16_t idx, amp;
-	int16_t sine1, sine2;
-	int32_t result;
-	uint8_t frac;
 
-  // create a variable frequency and amplitude sinewave.
-  // since we will be moving through the lookup table at
-  // a variable frequency, we wont always land directly
-  // on a single sample.  so we will average between the
-  // two samples closest to us.  this is called interpolation.
-  // step through the table at rate determined by step
-  // use upper byte of step value to set the rate
-  // and have an offset of 1 so there is always an increment.
-  // settings.position  += 1 + (mod1_value >> 8);
-  settings.position  += settings.step;
-  // if we've gone over the table boundary -> loop back
-  settings.position  &= POSITION_MAX; // this is a faster way doing the table
-                          // wrap around, which is possible
-                          // because our table is a multiple of 2^n.
-                          // otherwise you would do something like:
-                          // if (settings.position  >= 1024*256) {
-                          //   settings.position  -= 1024*256;
-                          // }
-  // Get the index part
-  idx = (settings.position >> 8);
-  
-  // Retrieve first sine sample sample
-  sine1 = g_sinewave[idx];
-  idx++; // go to next sample
-  idx &= WAVE_LEN; // check if we've gone over the boundary.
-                   // we can do this because its a multiple of 2^n,
-                   // otherwise it would be:
-                   // if (idx  >= NNNN) {
-                   //   idx  = 0; // reset to 0
-                   // }
-  // get second sample and put it in sine2 
-  sine2  = g_sinewave[idx];
-  
-  // interpolate between samples
-  // multiply each sample by the fractional distance
-  // to the actual settings.position  value
-  frac = (uint8_t)(settings.position & 0x000000ff); // fetch the lower 8b
-  // scale sample 2
-  sine2 = (sine2 * frac) >> 8;
-  // scale sample 1
-  sine1 = (sine1 * (0xff - frac )) >> 8;
-  
-  // add samples together to get an average
-  // our resultant sinewave is now in sine2 
-  sine2 += sine1;
-  sine2 = (sine2 * settings.amplitude) >> 16;
-  //return sine2;
-
-  // Positive bias it
-  amp = (uint16_t)(sine2 + 0x8000);
-  
-  result = (value * amp) >> 15;
-  return result;
+// Per sample entry point for the Timer1 ISR
+int32_t tremolo_effectISR(Effect_t *effect, int32_t value){
+	return tremolo_process(effect, value);
+}
+
+// Block entry point. Processes n samples in place
+void tremolo_processBlock(Effect_t *effect, int32_t *block, uint16_t n){
+	while(n--){
+		*block = tremolo_process(effect, *block);
+		block++;
+	}
 }
 
 // Cycles my features
-void tremolo_nextFeature(){
+void tremolo_nextFeature(Effect_t *effect){
 	if(FEATURECOUNT <= 1) return;
-	if(effect_Tremolo.featureIdx < FEATURECOUNT) {
-		effect_Tremolo.featureIdx++;
+	if(effect->featureIdx < FEATURECOUNT) {
+		effect->featureIdx++;
 	}else{
 		// Skip the safe feature
-		effect_Tremolo.featureIdx = 1;
+		effect->featureIdx = 1;
 	}
 }
 
 // Turns me on or off
-uint8_t tremolo_toggleOnOff(){
-	if(effect_Tremolo.state) effect_Tremolo.state = 0;
-	else effect_Tremolo.state = 1;
+uint8_t tremolo_toggleOnOff(Effect_t *effect){
+	if(effect->state) effect->state = 0;
+	else effect->state = 1;
+	return effect->state;
 }
 
 // Adjust the value of the current feature
 // Receives the encoder delta
-void tremolo_adjustFeature(int16_t value){
+void tremolo_adjustFeature(Effect_t *effect, int16_t value){
 	// Currently hard coded to alter the step
-	features_t feat = (features_t)effect_Tremolo.featureIdx;
+	tremolo_instance_t *instance = (tremolo_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
 	switch(feat){
+		case SAFE:{
+			// Does nothing
+			break;
+		}
 		case AMP:{
-			tremolo_amp_adjust((uint16_t)value*0xff);	
+			tremolo_amp_adjust(instance, (int32_t)value*0xff);	
 			break;
 		}
 		case FREQ:{
-			tremolo_freq_adjust((uint16_t)value);	
+			tremolo_freq_adjust(instance, (uint16_t)value);	
 			break;
 		}
 	}
@@ -171,31 +138,47 @@ void tremolo_adjustFeature(int16_t value){
 // Step value determines frequency
 // use an int32 for result to make boundry checking easy
 // Clamps result to within min/max
-void tremolo_freq_adjust(int16_t value){
-	int32_t result = settings.step + value;
+void tremolo_freq_adjust(tremolo_instance_t *instance, int16_t value){
+	tremolo_params_t *params = instance->params.edit();
+	int32_t result = params->step + value;
 	if(result > STEP_MAX){
 		result = STEP_MAX;
 	}else if(result < STEP_MIN){
 		result = STEP_MIN;
 	}
-	settings.step = (uint16_t)result;
+	params->step = (uint16_t)result;
+	instance->params.publish();
 }
 
 // Alters the current TREMOLO amplitude value by value (+ or -)
 // Clamps result to within min/max
-void tremolo_amp_adjust(int16_t value){
-	int32_t result = settings.amplitude + value;
+void tremolo_amp_adjust(tremolo_instance_t *instance, int32_t value){
+	tremolo_params_t *params = instance->params.edit();
+	int32_t result = params->amplitude + value;
 	if(result > AMP_MAX){
 		result = AMP_MAX;
 	}else if(result < AMP_MIN){
 		result = AMP_MIN;
 	}
-	settings.amplitude = (uint16_t)result;
+	params->amplitude = (uint16_t)result;
+	instance->params.publish();
+}
+
+// Copies my settings out for a preset
+uint8_t tremolo_save(Effect_t *effect, uint8_t *data){
+	return ((tremolo_instance_t *)effect->data)->params.store(data);
+}
+
+// Takes my settings from a preset
+void tremolo_load(Effect_t *effect, const uint8_t *data, uint8_t length){
+	tremolo_instance_t *instance = (tremolo_instance_t *)effect->data;
+	if(instance->params.restore(data, length)) instance->params.publish();
 }
 
 // Sends a string of my state to stdout
-void tremolo_report(){
-	features_t feat = (features_t)effect_Tremolo.featureIdx;
+void tremolo_report(Effect_t *effect){
+	tremolo_instance_t *instance = (tremolo_instance_t *)effect->data;
+	features_t feat = (features_t)effect->featureIdx;
 	// Write to screen
 	if(feat == AMP){
 		display.setTextColor(0);
@@ -204,7 +187,7 @@ void tremolo_report(){
 		display.setTextColor(1);
 	}
 	display.print("Amp ");
-  display.print(percentage(settings.amplitude, AMP_MAX, AMP_MIN), 2);
+  display.print(percentage(instance->params.read()->amplitude, AMP_MAX, AMP_MIN), 2);
 	display.print("%");
 
   if(feat == FREQ){
@@ -215,14 +198,14 @@ void tremolo_report(){
 	}
 	display.setCursor(DISP_FEAT_INDENT,DISP_FEAT_Y+14);
   display.print("Freq ");
-  display.print(tremolo_getHz(), 2);
+  display.print(tremolo_getHz(instance), 2);
 	display.print("Hz");
 
 }
 
 // Returns the TREMOLO frequency calculated from the step
-float tremolo_getHz(){
-	uint16_t step = settings.step; // This is volatile. Get it once
+float tremolo_getHz(tremolo_instance_t *instance){
+	uint16_t step = instance->params.read()->step;
 	uint8_t idx;
 	uint8_t frac;
 	float result;
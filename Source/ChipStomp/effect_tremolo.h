@@ -1,18 +1,81 @@
 /*
 	Header for LFO Effect
 	Each Effect is self contained
-	The only interfac declared is the Effect_t
+	The only interface declared is create(), which hands out an Effect_t,
+	plus the DSP state and process() used by effect_chain.h
 	
 	Effects must provide a struct to comply with Effect_t;		
 
-	Build the array of Effects in the main file (the one with setup() and loop())
+	List create() in g_effectTypes in the main file (the one with setup() and loop())
 */
 #ifndef __Effect_Tremolo__
 #define __Effect_Tremolo__
 
 #include "config.h"
 #include "Effect_typeDefs.h"
+#include "effect_params.h"
+#include "dsp_fixed.h"
 
-extern Effect_t effect_Tremolo;
+// New instance for the chain. NULL if all EFFECT_COPIES are in use
+extern Effect_t *tremolo_create();
+
+//******** DSP ********//
+// The per sample processing is here rather than in the .cpp so that a
+// compile time chain (see effect_chain.h) can inline it.
+
+#define TREMOLO_POSITION_MAX 0x0003ffff  
+
+// User parameters : Written by the main loop, read by the ISR
+typedef struct {
+    uint16_t amplitude;
+    uint16_t step;
+} tremolo_params_t;
+
+// Internal state : Only touched by the ISR
+typedef struct {
+    uint32_t position; // 24bits of position and 8bits of fraction
+    int32_t amplitude; // Smoothed amplitude with 8bits of fraction
+} tremolo_settings_t;
+
+// One tremolo. Effect_t.data points at this
+typedef struct {
+    ParamBuffer<tremolo_params_t> params;
+    tremolo_settings_t settings;
+} tremolo_instance_t;
+
+// This is where the effect is actually processed
+inline int32_t tremolo_process(Effect_t *effect, int32_t value){
+	int32_t sine, amp;
+	tremolo_instance_t *instance = (tremolo_instance_t *)effect->data;
+	tremolo_settings_t *settings = &instance->settings;
+	const tremolo_params_t *params = instance->params.read();
+
+  // create a variable frequency and amplitude sinewave.
+  // since we will be moving through the lookup table at
+  // a variable frequency, we wont always land directly
+  // on a single sample.  so we will average between the
+  // two samples closest to us.  this is called interpolation.
+  // step through the table at rate determined by step
+  // use upper byte of step value to set the rate
+  // and have an offset of 1 so there is always an increment.
+  // settings->position  += 1 + (mod1_value >> 8);
+  settings->position  += params->step;
+  // if we've gone over the table boundary -> loop back
+  settings->position  &= TREMOLO_POSITION_MAX; // this is a faster way doing the table
+                          // wrap around, which is possible
+                          // because our table is a multiple of 2^n.
+                          // otherwise you would do something like:
+                          // if (settings->position  >= 1024*256) {
+                          //   settings->position  -= 1024*256;
+                          // }
+  // Interpolate between the two table entries either side of position
+  sine = dsp_sine(settings->position);
+  sine = dsp_mulQ16(sine, (uint16_t)dsp_smooth(&settings->amplitude, params->amplitude, SMOOTH_FAST));
+
+  // Positive bias it : a gain of 1 +/- the depth
+  amp = sine + 0x8000;
+  
+  return dsp_mulQ15(value, amp);
+}
 
 #endif
@@ -0,0 +1,82 @@
+/*
+	Encoder acceleration
+
+	cn_isr stamps every encoder step with the core timer (see input_queue.h)
+	so the main loop can tell how fast the knob is being turned no matter
+	how late it gets round to the queue. Each step is weighted by a curve
+	picked per feature : turned slowly a step is always worth 1 so fine
+	adjustment is unchanged, turned quickly it is worth up to the curve's
+	max so a flick sweeps the whole of a big range like an amplitude.
+
+	The rate is taken from the time between steps, averaged over the last
+	couple so one bouncy detent doesn't jump the value. Reversing direction
+	or pausing drops straight back to single steps.
+*/
+#ifndef __Encoder_Accel__
+#define __Encoder_Accel__
+
+#include "config.h"
+#include "input_queue.h"
+
+#define ENC_TICKS_PER_SEC (SYS_FREQ / CP0_TICK_CYCLES) // Core timer rate
+#define ENC_PAUSE_TICKS (ENC_TICKS_PER_SEC / 4) // A gap this long starts a new turn
+
+// Curves an effect can give each of its features
+enum encodercurve_t {
+	ENC_CURVE_NONE, // Always single steps. For choices like the tape encoding
+	ENC_CURVE_FINE, // A few hundred positions. Delays and LFO rates
+	ENC_CURVE_COARSE, // Amplitudes. 0 to 0xffff in one flick
+	ENC_CURVES
+};
+
+typedef struct {
+	uint16_t slow; // Steps per second up to which a step is worth 1
+	uint16_t fast; // Steps per second from which a step is worth max
+	uint16_t max; // Most a single step is worth
+} EncoderCurve_t;
+
+static const EncoderCurve_t encoder_curves[ENC_CURVES] = {
+		{0, 1, 1}
+	, {15, 120, 8}
+	, {10, 100, 32}
+};
+
+// Main loop state between steps
+typedef struct {
+	uint32_t time; // Core timer count of the last step
+	uint32_t interval; // Averaged core timer ticks between steps. 0 = new turn
+	int8_t step; // Direction of the last step
+} EncoderAccel_t;
+
+// Returns what the step in event is worth on curve
+inline int16_t encoder_accel(EncoderAccel_t *accel, const InputEvent_t *event, uint8_t curve){
+	const EncoderCurve_t *shape = &encoder_curves[curve < ENC_CURVES ? curve : (uint8_t)ENC_CURVE_NONE];
+	uint32_t interval = event->time - accel->time;
+	uint32_t rate;
+	int16_t weight;
+
+	if(event->step != accel->step || interval >= ENC_PAUSE_TICKS){
+		// A new turn : Don't carry the speed over from the last one
+		accel->interval = 0;
+	}else if(accel->interval == 0){
+		accel->interval = interval;
+	}else{
+		accel->interval = (accel->interval + interval) >> 1;
+	}
+	accel->time = event->time;
+	accel->step = event->step;
+
+	// The first step of a turn has no speed yet
+	if(accel->interval == 0) return event->step;
+	rate = ENC_TICKS_PER_SEC / accel->interval;
+	if(rate <= shape->slow){
+		weight = 1;
+	}else if(rate >= shape->fast){
+		weight = shape->max;
+	}else{
+		weight = 1 + ((shape->max - 1) * (rate - shape->slow)) / (shape->fast - shape->slow);
+	}
+	return event->step * weight;
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+	Input event queue between cn_isr and the main loop
+
+	cn_isr is the only writer and the main loop the only reader, so a ring
+	with an index for each needs no locking or interrupt masking. The ISR
+	fills a slot then moves head on, the loop copies a slot then moves tail
+	on. Each index is a single byte write. Every button change and encoder
+	step is its own event so nothing that arrives while the loop is busy
+	gets lost. A full queue drops the new event and counts it.
+*/
+#ifndef __Input_Queue__
+#define __Input_Queue__
+
+#include "config.h"
+
+#define INPUT_QUEUE_LEN 32 // Must be a power of 2
+#define INPUT_QUEUE_MASK (INPUT_QUEUE_LEN - 1)
+
+enum inputevent_t {INPUT_BUTTONS, INPUT_ENCODER};
+
+typedef struct {
+  uint32_t time; // Core timer count when it happened
+  uint8_t type; // inputevent_t
+  int8_t step; // INPUT_ENCODER : +1 or -1
+  ButtonState_t btn_state; // INPUT_BUTTONS : state after the change, 1 = pressed
+  ButtonState_t btn_diff; // INPUT_BUTTONS : 1 = changed
+} InputEvent_t;
+
+typedef struct {
+  InputEvent_t events[INPUT_QUEUE_LEN];
+  volatile uint8_t head; // Next slot to write. Only cn_isr moves it
+  volatile uint8_t tail; // Next slot to read. Only the main loop moves it
+  volatile uint16_t dropped; // Events lost to a full queue
+  uint8_t enc_state; // Rotary decoder state. Only used in cn_isr
+  ButtonState_t btn_state; // Buttons as cn_isr last saw them
+} InputQueue_t;
+
+// ISR side : Adds an event
+inline void input_push(InputQueue_t *queue, const InputEvent_t *event){
+  uint8_t head = queue->head;
+  if(((head + 1) & INPUT_QUEUE_MASK) == queue->tail){
+    queue->dropped++;
+    return;
+  }
+  queue->events[head] = *event;
+  // Stop the compiler moving the event write after the index
+  asm volatile("" ::: "memory");
+  queue->head = (head + 1) & INPUT_QUEUE_MASK;
+}
+
+// Main loop side : Copies the oldest event without taking it. False if empty
+inline uint8_t input_peek(InputQueue_t *queue, InputEvent_t *event){
+  uint8_t tail = queue->tail;
+  if(tail == queue->head) return false;
+  // Stop the compiler reading the event before the index
+  asm volatile("" ::: "memory");
+  *event = queue->events[tail];
+  return true;
+}
+
+// Main loop side : Takes the event input_peek() returned
+inline void input_pop(InputQueue_t *queue){
+  queue->tail = (queue->tail + 1) & INPUT_QUEUE_MASK;
+}
+
+// Main loop side : True when there is nothing waiting
+inline uint8_t input_empty(InputQueue_t *queue){
+  return queue->tail == queue->head;
+}
+
+#endif
@@ -70,6 +70,29 @@ const unsigned char g_enc_table[7][4] = {
 };
 #endif
 
+/*
+  VU meter
+  Called by the audio ISRs for every input and output sample, so it is kept
+  short and free of branches. Peak is held and decays exponentially, power
+  is a leaky average of the square. Both are single words written once.
+*/
+inline void vu_track(volatile VUChannel_t *channel, int32_t sample){
+  int32_t sign, level, peak, diff, power;
+  // abs()
+  sign = sample >> 31;
+  level = ((sample ^ sign) - sign) << 15;
+  // Let the held peak fall a little then take the larger of it and level
+  peak = channel->peak;
+  peak -= peak >> VU_PEAK_SHIFT;
+  diff = level - peak;
+  peak += diff & ~(diff >> 31);
+  channel->peak = peak;
+  // Samples are at most 2^15 so the square and the difference fit
+  power = channel->power;
+  dsp_onePole(&power, sample * sample, VU_POWER_SHIFT);
+  channel->power = power;
+}
+
 extern "C" {
 /*
 	Change notification
@@ -78,10 +101,12 @@ extern "C" {
     uint8_t btn_state;
     uint8_t btn_diff;
     uint8_t enc_state;
+    InputEvent_t event;
 		// Get the inverse of the port (btn press = low)
     uint16_t state = ~PORTB;
     // AND with the input pins 
     state &= 0b0000001110010000;
+    event.time = _CP0_GET_COUNT();
     // Move the lower byte
     btn_state = (uint8_t)(state & 0x00ff);
     // Get the difference between current and stored state
@@ -89,19 +114,28 @@ extern "C" {
     if(btn_diff){
       // One of the buttons changed
       g_input.btn_state.complete = btn_state;
-      g_input.btn_diff.complete = btn_diff;
+      event.type = INPUT_BUTTONS;
+      event.step = 0;
+      event.btn_state.complete = btn_state;
+      event.btn_diff.complete = btn_diff;
+      input_push(&g_input, &event);
     }
     
     // Handle the encoder RB8 and RB9 : We need them in bit0 & bit1 of this byte
     enc_state = (uint8_t)(state >> 8);
-    g_input.encoder.state = g_enc_table[g_input.encoder.state & 0xf][enc_state];
-    switch(g_input.encoder.state & 0x30){
+    g_input.enc_state = g_enc_table[g_input.enc_state & 0xf][enc_state];
+    event.type = INPUT_ENCODER;
+    event.btn_state.complete = btn_state;
+    event.btn_diff.complete = 0;
+    switch(g_input.enc_state & 0x30){
       case DIR_CW:{
-        g_input.encoder.value--;
+        event.step = -1;
+        input_push(&g_input, &event);
         break;
       }
       case DIR_CCW:{
-        g_input.encoder.value++;
+        event.step = 1;
+        input_push(&g_input, &event);
         break;
       }
     }
@@ -111,6 +145,19 @@ extern "C" {
 }
 
 
+/*
+  Display flush
+  Each time the OLED DMA finishes a block the driver sets up the next one.
+  Lowest priority so it never holds up the audio.
+*/
+extern "C" {
+  void __ISR(_DMA3_VECTOR, ipl1) DmaHandler3() {
+    display.dmaInterrupt();
+  }
+}
+
+
+#if BLOCKSIZE == 1
 // Need to check with LA that the ADC timings used aren't impacting this effect ISR.
 // I've set the ADC timing very generous (I think)...
 
@@ -118,8 +165,13 @@ extern "C" {
   void __ISR(_TIMER_1_VECTOR, ipl3) T1InterruptHandler() {
     int32_t buffer; // ADC Value read here - Buffer is 32bit to allow headroom
     int16_t output; // Actual value written to OC's
+#if !STATIC_CHAIN
     Effect_t *currentEffect;
-    Effect_t **currentAddr = &g_effects[0]; // Get Ptr2ptr in array pos zero
+#if COST_PROFILE
+    uint32_t start, elapsed; // CP0 Count used to time each effect. The static chain times its own stages
+#endif
+#endif
+    Effect_t * const *currentAddr = slots_chain(); // The chain as last published. See effect_slots.h
     //mPORTBSetBits(LCDDC_BIT);
     mT1ClearIntFlag();
     while ( ! mAD1GetIntFlag() ) { 
@@ -130,19 +182,31 @@ extern "C" {
     // ADC result is 10bit signed - boost it up to 16bits
     buffer *= 64;
     
-    // Write input level buffer for VU meter
-    g_meter.input[g_meter.tick] = (int16_t)buffer;
+    // Input VU meter
+    vu_track(&g_meter.input, buffer);
     
     mAD1ClearIntFlag(); //Clear ADC interrupt flag
 
     // Process the effects
-    while(*currentAddr > 0){
+#if STATIC_CHAIN
+    buffer = StaticChain_t::process(buffer, g_chainMask, currentAddr);
+#else
+    while(*currentAddr != NULL){
       currentEffect = *currentAddr;
       if(currentEffect->state > 0){
-        buffer = currentEffect->effectISR(buffer);
+#if COST_PROFILE
+        start = _CP0_GET_COUNT();
+        buffer = bypass_process(currentEffect, currentEffect->effectISR, buffer);
+        // Keep the worst case so the budget check in loop() stays safe
+        elapsed = (_CP0_GET_COUNT() - start) * CP0_TICK_CYCLES;
+        if(elapsed > currentEffect->cost) currentEffect->cost = (uint16_t)elapsed;
+#else
+        buffer = bypass_process(currentEffect, currentEffect->effectISR, buffer);
+#endif
       }      
       currentAddr++;
     }
+#endif
 
     // Hard clipping
     if(buffer > CLIPHARD) buffer = CLIPHARD;
@@ -155,16 +219,102 @@ extern "C" {
       mPORTAClearBits(CLIP_BIT);
     }
 
-    // Write output level buffer for VU meter
-    g_meter.output[g_meter.tick] = (int16_t)buffer;
+    // Output VU meter
+    vu_track(&g_meter.output, buffer);
 
     //convert back to unsigned for feeding to OC's
     output = (uint16_t)(buffer + 0x7fff);
 
-    g_meter.tick++;
-    g_meter.tick &= VUTICKLEN_MASK;
-
     SetDCOC4PWM((uint8_t)(output>>8)); 
     SetDCOC2PWM((uint8_t)(output)); 
   }
-}
\ No newline at end of file
+}
+#else
+/*
+  Block mode
+  Timer1 no longer interrupts. Its interrupt flag triggers three DMA channels
+  once per sample period instead:
+    DMA0 : ADC1BUF0 -> g_adc_block (ping-pong, interrupts when each half fills)
+    DMA1 : g_dac_hi -> OC4RS
+    DMA2 : g_dac_lo -> OC2RS
+  All three step together, so when a half of the input fills the output DMAs
+  have just started playing the other half. The half that just filled is
+  processed into the same half of the output, which is played next time round.
+  Latency is 2 * BLOCKSIZE samples.
+  The buffers are declared in ChipStomp.pde so setup() can see them.
+*/
+
+extern "C" {
+  void __ISR(_DMA0_VECTOR, ipl3) DmaHandler0() {
+    int32_t block[BLOCKSIZE]; // Working buffer - 32bit to allow headroom
+    int32_t buffer;
+    uint16_t output; // Actual value written to OC's
+    uint16_t idx, half;
+    uint8_t clipped = 0;
+#if !STATIC_CHAIN
+    Effect_t *currentEffect;
+#if COST_PROFILE
+    uint32_t start, elapsed; // CP0 Count used to time each effect. The static chain times its own stages
+#endif
+#endif
+    Effect_t * const *currentAddr = slots_chain(); // The chain as last published. See effect_slots.h
+
+    // Work out which half has just been filled
+    half = (DmaChnGetEvFlags(DMA_CHANNEL0) & DMA_EV_DST_FULL) ? BLOCKSIZE : 0;
+    DmaChnClrEvFlags(DMA_CHANNEL0, DMA_EV_ALL_EVNTS);
+    INTClearFlag(INT_SOURCE_DMA(DMA_CHANNEL0));
+
+    for(idx=0; idx < BLOCKSIZE; idx++){
+      // ADC result is 10bit signed - boost it up to 16bits
+      buffer = g_adc_block[half + idx] * 64;
+      block[idx] = buffer;
+      // Input VU meter
+      vu_track(&g_meter.input, buffer);
+    }
+
+    // Process the effects
+#if STATIC_CHAIN
+    processChainBlock<StaticChain_t>(block, BLOCKSIZE, g_chainMask, currentAddr);
+#else
+    while(*currentAddr != NULL){
+      currentEffect = *currentAddr;
+      if(currentEffect->state > 0){
+#if COST_PROFILE
+        start = _CP0_GET_COUNT();
+        bypass_processBlock(currentEffect, block, BLOCKSIZE);
+        // Keep the worst case per sample so the budget check in loop() stays safe
+        elapsed = ((_CP0_GET_COUNT() - start) * CP0_TICK_CYCLES) / BLOCKSIZE;
+        if(elapsed > currentEffect->cost) currentEffect->cost = (uint16_t)elapsed;
+#else
+        bypass_processBlock(currentEffect, block, BLOCKSIZE);
+#endif
+      }
+      currentAddr++;
+    }
+#endif
+
+    for(idx=0; idx < BLOCKSIZE; idx++){
+      buffer = block[idx];
+      // Hard clipping
+      if(buffer > CLIPHARD) buffer = CLIPHARD;
+      if(buffer < -CLIPHARD) buffer = -CLIPHARD;
+      if(buffer > CLIPLEVEL) clipped = 1;
+
+      // Output VU meter
+      vu_track(&g_meter.output, buffer);
+
+      //convert back to unsigned for feeding to OC's
+      output = (uint16_t)(buffer + 0x7fff);
+      g_dac_hi[half + idx] = (uint8_t)(output >> 8);
+      g_dac_lo[half + idx] = (uint8_t)output;
+    }
+
+    // Clip LED stays lit for the whole block
+    if(clipped){
+      mPORTASetBits(CLIP_BIT);
+    }else{
+      mPORTAClearBits(CLIP_BIT);
+    }
+  }
+}
+#endif
@@ -0,0 +1,269 @@
+/*
+	Preset storage
+
+	Layout
+	Each preset is a PresetRecord_t : a small header then one entry per
+	effect, in chain order.
+	  version : PRESET_VERSION it was saved with. Anything else is ignored
+	  count   : Number of entries
+	  length  : Bytes of entries
+	  crc     : CRC-16 CCITT of the header fields above and the entries
+	Each entry is
+	  type     : Position of the effect in g_effectTypes
+	  state    : On/off
+	  length   : Bytes of settings that follow
+	  settings : Whatever the effect's save() wrote
+	An effect ignores settings of a length it doesn't expect, so a preset
+	saved before its layout changed can't scramble it.
+
+	Power cuts
+	All the presets live in one flash page with a sequence number, and
+	there are two pages. A save erases the older page, writes every preset
+	into it (the new one from RAM, the rest copied from the current page)
+	and only then writes the sequence number. Until that last word lands
+	the current page is untouched and is still the one used, so a power cut
+	part way through a save loses nothing but the save.
+	Erased flash reads as 0xff so a page with a sequence number of
+	0xffffffff is one that was never finished.
+
+	Recall
+	The record is copied out of flash into RAM and checked before anything
+	changes. Each entry takes the next instance of its type along the chain,
+	or a new one if there isn't one, and the chain is rearranged so they
+	are in the saved order. Instances the preset doesn't use are turned off
+	and left at the end. The settings then go through each effect's ParamBuffer like
+	any other edit, so the ISR never waits on a recall and dsp_smooth()
+	glides to the new values. Effects are turned off before any are turned
+	on. They fade out like any other (see effect_bypass.h), and an effect
+	being turned on that needs their delay memory waits for it. Effects are
+	then turned on in preset order with the same CPU budget and memory
+	checks as the toggle, so one that doesn't fit is left off and reported.
+
+	Saving stalls the CPU, and with it the audio, for the page erase (~20mS)
+	and the word writes. Recall never touches the NVM controller.
+*/
+#include <PLIB.h>
+#include <string.h>
+#include "preset.h"
+#include "delay_arena.h"
+
+//******** Private macros ********//
+
+#define PRESET_PAGE_WORDS (PRESET_PAGE_SIZE / 4)
+#define PRESET_SLOT_WORDS (PRESET_SLOT_BYTES / 4)
+#define PRESET_SLOT_WORD(slot) (1 + (slot) * PRESET_SLOT_WORDS) // Word 0 is the sequence number
+#define PRESET_HEADER_BYTES 6
+#define PRESET_DATA_BYTES (PRESET_SLOT_BYTES - PRESET_HEADER_BYTES)
+#define PRESET_ENTRY_BYTES 3 // type, state and length before the settings
+#define PRESET_ERASED 0xffffffff
+
+//******** Private function declarations ********//
+
+PRESET_FLASH_CONST volatile uint32_t *preset_current();
+boolean preset_read(uint8_t slot);
+uint16_t preset_crc();
+uint16_t preset_crcByte(uint16_t crc, uint8_t byte);
+Effect_t *preset_instance(uint8_t type, Effect_t * const *claimed, uint8_t count);
+
+//******** Private variables ********//
+
+typedef struct {
+	uint8_t version;
+	uint8_t count;
+	uint16_t length;
+	uint16_t crc;
+	uint8_t data[PRESET_DATA_BYTES];
+} PresetRecord_t;
+
+// Words so it can be copied to and from flash a word at a time
+typedef union {
+	PresetRecord_t record;
+	uint32_t words[PRESET_SLOT_WORDS];
+} PresetSlot_t;
+
+// Fails to compile if the layout doesn't fit
+typedef char preset_slotFits[(sizeof(PresetRecord_t) == PRESET_SLOT_BYTES) ? 1 : -1];
+typedef char preset_pageFits[(PRESET_SLOT_WORD(PRESET_COUNT) <= PRESET_PAGE_WORDS) ? 1 : -1];
+
+// The two pages. Zeroed by programming so both start as empty presets
+static PRESET_FLASH_CONST volatile uint32_t preset_flash[2][PRESET_PAGE_WORDS] __attribute__((aligned(PRESET_PAGE_SIZE))) = {{0}};
+
+// RAM copy of the preset being recalled or saved. Kept off the stack
+static PresetSlot_t preset_buffer;
+
+//******** Function definitions ********//
+
+// The page the presets are in. NULL if neither page was finished
+PRESET_FLASH_CONST volatile uint32_t *preset_current(){
+	uint32_t first = preset_flash[0][0];
+	uint32_t second = preset_flash[1][0];
+	if(first == PRESET_ERASED) return (second == PRESET_ERASED) ? NULL : preset_flash[1];
+	if(second == PRESET_ERASED) return preset_flash[0];
+	// The later one, allowing for the sequence number wrapping
+	return ((int32_t)(second - first) > 0) ? preset_flash[1] : preset_flash[0];
+}
+
+// Copies preset slot into preset_buffer. Returns false if it isn't a good one
+boolean preset_read(uint8_t slot){
+	PRESET_FLASH_CONST volatile uint32_t *page = preset_current();
+	uint8_t idx;
+	if(page == NULL || slot >= PRESET_COUNT) return false;
+	page += PRESET_SLOT_WORD(slot);
+	for(idx=0; idx < PRESET_SLOT_WORDS; idx++){
+		preset_buffer.words[idx] = page[idx];
+	}
+	if(preset_buffer.record.version != PRESET_VERSION) return false;
+	if(preset_buffer.record.length > PRESET_DATA_BYTES) return false;
+	return preset_buffer.record.crc == preset_crc();
+}
+
+// CRC of preset_buffer's header and entries
+uint16_t preset_crc(){
+	PresetRecord_t *record = &preset_buffer.record;
+	uint16_t idx, crc = 0xffff;
+	crc = preset_crcByte(crc, record->version);
+	crc = preset_crcByte(crc, record->count);
+	crc = preset_crcByte(crc, (uint8_t)record->length);
+	crc = preset_crcByte(crc, (uint8_t)(record->length >> 8));
+	for(idx=0; idx < record->length; idx++){
+		crc = preset_crcByte(crc, record->data[idx]);
+	}
+	return crc;
+}
+
+// CRC-16 CCITT one byte at a time. A preset is small enough to not need a table
+uint16_t preset_crcByte(uint16_t crc, uint8_t byte){
+	uint8_t bit;
+	crc ^= (uint16_t)byte << 8;
+	for(bit=0; bit < 8; bit++){
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	}
+	return crc;
+}
+
+// First instance of type along the chain that isn't one of the count
+// already claimed. Adds a new one if there isn't one. NULL if it can't
+Effect_t *preset_instance(uint8_t type, Effect_t * const *claimed, uint8_t count){
+	Effect_t * const *chain = slots_chain();
+	uint8_t pos, idx;
+	for(pos=0; chain[pos] != NULL; pos++){
+		if(chain[pos]->type != type) continue;
+		for(idx=0; idx < count && claimed[idx] != chain[pos]; idx++);
+		if(idx == count) return chain[pos];
+	}
+	return slots_add(type);
+}
+
+boolean preset_used(uint8_t slot){
+	return preset_read(slot);
+}
+
+boolean preset_recall(uint8_t slot, uint16_t *overbudget, uint8_t *outofmemory){
+	Effect_t *order[SLOTS_MAX]; // Instance for each entry
+	uint8_t *entries[SLOTS_MAX];
+	uint8_t settings[PRESET_EFFECT_MAX];
+	uint8_t idx, pos, length, count = 0, *entry, *end;
+	uint16_t cost;
+	Effect_t * const *chain;
+	Effect_t *effect;
+
+	if(!preset_read(slot)) return false;
+	// An instance for each entry, in preset order
+	end = &preset_buffer.record.data[preset_buffer.record.length];
+	entry = preset_buffer.record.data;
+	for(idx=0; idx < preset_buffer.record.count && count < SLOTS_MAX && entry + PRESET_ENTRY_BYTES + entry[2] <= end; idx++){
+		effect = preset_instance(entry[0], order, count);
+		if(effect != NULL){
+			order[count] = effect;
+			entries[count++] = entry;
+		}
+		entry += PRESET_ENTRY_BYTES + entry[2];
+	}
+	slots_arrange(order, count);
+
+	// Off first. They fade out, and an effect being turned on that needs
+	// their delay memory waits for it. See arena_toggle()
+	chain = slots_chain();
+	for(pos=0; chain[pos] != NULL; pos++){
+		effect = chain[pos];
+		if(!effect_isOn(effect)) continue;
+		for(idx=0; idx < count && order[idx] != effect; idx++);
+		if(idx < count){
+			if(!entries[idx][1]) arena_toggle(effect);
+		}else if(effect->load){
+			// Not in the preset. Off, unless it can't be saved
+			arena_toggle(effect);
+		}
+	}
+	for(idx=0; idx < count; idx++){
+		effect = order[idx];
+		if(effect->load == NULL) continue;
+		// A setting can cost more (the distortion's oversampling). One that's
+		// running keeps what it had if the chain would no longer fit, as when
+		// adjusted with the encoder
+		cost = effect->cost;
+		length = effect->state ? effect->save(effect, settings) : 0;
+		effect->load(effect, entries[idx] + PRESET_ENTRY_BYTES, entries[idx][2]);
+		if(effect->state && effect->cost > cost && slots_cost() > CYCLE_BUDGET){
+			*overbudget = effect->cost - cost;
+			effect->load(effect, settings, length);
+		}
+	}
+	for(idx=0; idx < count; idx++){
+		effect = order[idx];
+		if(effect_isOn(effect) || !entries[idx][1]) continue;
+		if(!slots_budgetAllows(effect)){
+			*overbudget = effect->cost;
+		}else if(!arena_toggle(effect)){
+			*outofmemory = true;
+		}
+	}
+	return true;
+}
+
+boolean preset_save(uint8_t slot){
+	Effect_t * const *effects = slots_chain();
+	PRESET_FLASH_CONST volatile uint32_t *current = preset_current();
+	PRESET_FLASH_CONST volatile uint32_t *target;
+	PresetRecord_t *record = &preset_buffer.record;
+	uint8_t settings[PRESET_EFFECT_MAX];
+	uint8_t idx, length, *entry;
+	uint16_t word, pos;
+	uint32_t value;
+
+	if(slot >= PRESET_COUNT) return false;
+	// Build the record. Unused bytes are left as erased flash
+	memset(&preset_buffer, 0xff, sizeof(preset_buffer));
+	record->version = PRESET_VERSION;
+	record->count = 0;
+	record->length = 0;
+	for(idx=0; effects[idx] != NULL; idx++){
+		if(effects[idx]->save == NULL) continue;
+		length = effects[idx]->save(effects[idx], settings);
+		if(record->length + PRESET_ENTRY_BYTES + length > PRESET_DATA_BYTES) return false;
+		entry = &record->data[record->length];
+		entry[0] = effects[idx]->type;
+		entry[1] = effect_isOn(effects[idx]);
+		entry[2] = length;
+		memcpy(entry + PRESET_ENTRY_BYTES, settings, length);
+		record->length += PRESET_ENTRY_BYTES + length;
+		record->count++;
+	}
+	record->crc = preset_crc();
+
+	// Every preset into the page not in use, then the sequence number
+	target = (current == preset_flash[0]) ? preset_flash[1] : preset_flash[0];
+	if(NVMErasePage((void *)target)) return false;
+	for(idx=0; idx < PRESET_COUNT; idx++){
+		for(word=0; word < PRESET_SLOT_WORDS; word++){
+			pos = PRESET_SLOT_WORD(idx) + word;
+			if(idx == slot) value = preset_buffer.words[word];
+			else value = current ? current[pos] : PRESET_ERASED;
+			// Erased words already read 0xffffffff
+			if(value != PRESET_ERASED && NVMWriteWord((void *)&target[pos], value)) return false;
+		}
+	}
+	value = current ? current[0] + 1 : 0;
+	if(value == PRESET_ERASED) value = 0;
+	return NVMWriteWord((void *)target, value) == 0;
+}
@@ -0,0 +1,43 @@
+/*
+	Header for preset storage
+	A preset is every effect's user settings and on/off state, in chain
+	order, so it brings back the order and any copies of an effect too.
+	They are kept in program flash so they survive a power cycle.
+	Recall only reads flash so it can happen at any time, saving stalls the
+	CPU while the flash page is erased and written.
+*/
+#ifndef __Preset__
+#define __Preset__
+
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_slots.h"
+
+#define PRESET_COUNT 5 // Presets the user can pick from
+#define PRESET_VERSION 3 // Bump whenever an effect's settings layout changes
+#define PRESET_PAGE_SIZE 1024 // PIC32MX250 flash erase page in bytes
+#define PRESET_SLOT_BYTES 192 // Flash kept for each preset
+#define PRESET_EFFECT_MAX 48 // Most settings bytes one effect can store
+
+// The CPU can't write program flash directly, only via the NVM controller.
+// The host shim emulates that in RAM so builds with this defined empty.
+#ifndef PRESET_FLASH_CONST
+#define PRESET_FLASH_CONST const
+#endif
+
+// Rearranges the chain to match preset slot, loads the settings then turns
+// effects on and off to match.
+// An effect is left off if it won't fit in the CPU budget (overbudget gets
+// its cost) or the delay arena (outofmemory is set), as when toggled.
+// One already running keeps its settings if the preset's would cost more
+// than the budget has left (overbudget gets the extra).
+// Returns false if the slot is empty or damaged, leaving the chain as it was.
+// Call updateChainMask() afterwards.
+extern boolean preset_recall(uint8_t slot, uint16_t *overbudget, uint8_t *outofmemory);
+// Stores the current chain, settings and states in preset slot.
+// Returns false if the flash wouldn't take it.
+extern boolean preset_save(uint8_t slot);
+// True if preset slot has something in it
+extern boolean preset_used(uint8_t slot);
+
+#endif
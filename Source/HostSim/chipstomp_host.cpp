@@ -0,0 +1,1352 @@
+/*
+	ChipStomp host renderer
+	Runs the firmware's Timer1 ISR and effect chain on a desktop machine.
+	Streams a WAV file through the chain and optionally benchmarks each effect.
+
+	The effects and isr.pde are compiled unmodified against the shims in
+	./shim so what is measured here is the same code that runs on the DP32.
+	Input is quantised to 10bits exactly like the ADC before it reaches the ISR.
+
+	Usage: chipstomp_host [options] [in.wav [out.wav]]
+		in.wav of - uses the generated test signal
+		-e name,name  Effects to enable (default: all). Prefix match on Effect_t name,
+		              name#2 for the second in the chain
+		-p name:feat:delta  Select feature and send an encoder delta to it
+		-c name       Copy an effect into the slot after it, before -e and -p
+		-m name:step  Move an effect step slots along the chain, after any -c
+		-b            Benchmark each effect alone and the full chain
+		-t            Report signal to noise and cost of each echo tape encoding
+		-q            Check the dsp_fixed.h primitives bit-exact against reference models
+		-a            Report the distortion's aliasing and cost with and without oversampling
+		-i count      Benchmark iterations over the input (default 20)
+		-n seconds    Length of the generated test signal when no input is given
+		-k scale      PIC32 cycles per host tick for the cost model (default: calibrated)
+
+	Cost model
+	Each sample's trip through the ISR is timed with the host's cycle counter.
+	The 99th percentile block with only one effect enabled, less the same
+	figure for the bare ISR, is scaled into PIC32 cycles and compared to
+	CYCLE_BUDGET. This is closer to a slow-path average than a true worst case.
+
+	The scale comes from a reference kernel of independent single cycle ALU
+	ops, timed again before every pass as the host's clock wanders. The M4K issues one instruction a
+	cycle, so the kernel's PIC32 cycle count is its op count. The host runs
+	it as fast as it can run anything, several ops a tick, so no code can
+	do more work per tick than the kernel : ticks x scale is an upper bound
+	on the instructions an effect executes, and so on its M4K cycles before
+	stalls. Load-use and multiplier stalls on the M4K are about what the
+	bound loses to x86 instructions doing more work each, and the effects
+	run well under the host's peak, so it errs high. The Effect_t.cost
+	seeds are these figures rounded up. COST_PROFILE on the target still
+	has the last word, and -k overrides the scale to match it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <PLIB.h>
+#include "config.h"
+#include "Effect_typeDefs.h"
+#include "effect_tremolo.h"
+#include "effect_flanger.h"
+#include "effect_echo.h"
+#include "effect_bitcrush.h"
+#include "effect_pitchshift.h"
+#include "effect_distortion.h"
+#include "effect_filter.h"
+#include "effect_compressor.h"
+#include "effect_reverb.h"
+#include "effect_chorus.h"
+#include "effect_slots.h"
+#include "effect_instance.h"
+#include "delay_arena.h"
+#include "preset.h"
+#include "input_queue.h"
+#include "echo_tape.h"
+#include "dsp_fixed.h"
+#include "wavfile.h"
+
+#define CAL_ROUNDS 4096 // Reference kernel loops per timing
+#define CAL_OPS 16 // Single cycle ALU ops per loop of the reference kernel
+#define CAL_PASSES 32 // Best of. Only the fastest shows the host's peak
+#define COST_PERCENTILE 990 // Per mille
+#define COST_BLOCK (BLOCKSIZE > 32 ? BLOCKSIZE : 32) // Samples per timed block
+#define COST_PASSES 25
+
+// Must match g_effectTypes in ChipStomp.pde
+const EffectCreate_t g_effectTypes[] = {
+			tremolo_create
+		, flng_create
+		, pitch_create
+		, bitcrush_create
+		, echo_create
+		, dist_create
+		, filt_create
+		, comp_create
+		, revb_create
+		, chor_create
+		, NULL
+	};
+
+volatile uint32_t g_chainMask;
+InputQueue_t g_input;
+volatile VUMeter_t g_meter;
+Catmacey_SH1106 display;
+
+// Fake peripherals used by the PLIB shim
+volatile uint32_t PORTA;
+volatile uint32_t PORTB;
+volatile int32_t host_adc;
+volatile uint8_t host_oc4;
+volatile uint8_t host_oc2;
+volatile uint32_t host_dma_flags;
+void *host_nvm_page;
+
+#if BLOCKSIZE > 1
+volatile int32_t g_adc_block[2 * BLOCKSIZE];
+volatile uint8_t g_dac_hi[2 * BLOCKSIZE];
+volatile uint8_t g_dac_lo[2 * BLOCKSIZE];
+extern "C" void DmaHandler0();
+#else
+extern "C" void T1InterruptHandler();
+#endif
+
+//******** Arduino core stand-ins ********//
+
+static double now_sec(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void delay(unsigned long ms){
+	struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+unsigned long millis(){
+	return (unsigned long)(now_sec() * 1000);
+}
+
+unsigned long micros(){
+	return (unsigned long)(now_sec() * 1000000);
+}
+
+uint32_t host_cp0_count(){
+	return (uint32_t)(now_sec() * (SYS_FREQ / CP0_TICK_CYCLES));
+}
+
+// Copied from ChipStomp.pde
+float percentage(uint16_t value, uint16_t max, uint16_t min){
+	float result, frac;
+	uint16_t range, offset;
+	range = max - min;
+	offset = value - min;
+	frac = (float)offset/range;
+	result = frac * 100;
+	return result;
+}
+
+//******** Renderer ********//
+
+#if BLOCKSIZE > 1
+// Fills one half of the ADC ping-pong buffer and runs the DMA ISR on it
+// exactly as the DMA half/full interrupt would. n may be short at the end.
+static void render_range(const int16_t *in, int16_t *out, uint32_t n){
+	static uint16_t half = 0;
+	uint16_t idx, count;
+	while(n){
+		count = n < BLOCKSIZE ? n : BLOCKSIZE;
+		for(idx=0; idx < BLOCKSIZE; idx++){
+			// ADC is 10bit signed. Pad a short block with silence
+			g_adc_block[half + idx] = idx < count ? in[idx] >> 6 : 0;
+		}
+		host_dma_flags = half ? DMA_EV_DST_FULL : DMA_EV_DST_HALF_FULL;
+		DmaHandler0();
+		for(idx=0; idx < count; idx++){
+			// Reassemble the two 8bit PWM duty cycles
+			out[idx] = (int16_t)((uint16_t)((g_dac_hi[half + idx] << 8) | g_dac_lo[half + idx]) - 0x7fff);
+		}
+		half ^= BLOCKSIZE;
+		in += count;
+		out += count;
+		n -= count;
+	}
+}
+#else
+// Runs samples through the ISR exactly as the Timer1 interrupt would
+static void render_range(const int16_t *in, int16_t *out, uint32_t n){
+	uint16_t dac;
+	while(n--){
+		// ADC is 10bit signed
+		host_adc = *in++ >> 6;
+		T1InterruptHandler();
+		// Reassemble the two 8bit PWM duty cycles
+		dac = (uint16_t)((host_oc4 << 8) | host_oc2);
+		*out++ = (int16_t)(dac - 0x7fff);
+	}
+}
+#endif
+
+static void render(const WavData_t *in, WavData_t *out){
+	render_range(in->samples, out->samples, in->length);
+}
+
+// Times iterations passes over the input. Returns samples per second
+static double bench(const WavData_t *in, WavData_t *out, int iterations){
+	double start, elapsed;
+	int pass;
+	start = now_sec();
+	for(pass=0; pass < iterations; pass++){
+		render(in, out);
+	}
+	elapsed = now_sec() - start;
+	return ((double)in->length * iterations) / elapsed;
+}
+
+static void bench_report(const char *name, double rate){
+	printf("%-12s %12.0f samples/s %8.1f ns/sample %8.1fx realtime"
+		, name, rate, 1e9 / rate, rate / SAMPLERATE);
+}
+
+// Host ticks for the cost model. TSC where available
+static inline uint64_t host_ticks(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t)(now_sec() * 1e9);
+#endif
+}
+
+static int cmp_cycles(const void *a, const void *b){
+	uint32_t ta = *(const uint32_t *)a, tb = *(const uint32_t *)b;
+	return (ta > tb) - (ta < tb);
+}
+
+// Seeds the reference kernel so the compiler can't work it out
+static volatile uint32_t cal_seed = 1;
+
+// Host ticks for CAL_ROUNDS x CAL_OPS single cycle ALU ops
+// Eight independent chains keep every ALU the host has busy. The empty asm
+// stops the compiler folding or vectorising them, which the M4K couldn't
+static uint64_t calibrate_run(){
+	uint32_t a = cal_seed, b = a + 1, c = a + 2, d = a + 3, e = a + 4, f = a + 5, g = a + 6, h = a + 7;
+	uint64_t start = host_ticks();
+	int round;
+	for(round=0; round < CAL_ROUNDS; round++){
+		a += b; b ^= c; c += d; d ^= e; e += f; f ^= g; g += h; h ^= a;
+		a ^= 0x55; b += 3; c ^= 0x99; d += 5; e ^= 0x11; f += 7; g ^= 0x33; h += 9;
+		__asm__ volatile("" : "+r"(a), "+r"(b), "+r"(c), "+r"(d), "+r"(e), "+r"(f), "+r"(g), "+r"(h));
+	}
+	start = host_ticks() - start;
+	cal_seed = a ^ b ^ c ^ d ^ e ^ f ^ g ^ h;
+	return start;
+}
+
+// PIC32 cycles per host tick, from the reference kernel. See Cost model above
+static double calibrate(){
+	uint64_t best = calibrate_run(), result;
+	int pass;
+	for(pass=1; pass < CAL_PASSES; pass++){
+		result = calibrate_run();
+		if(result < best) best = result;
+	}
+	return (double)CAL_ROUNDS * CAL_OPS / (best ? best : 1);
+}
+
+// PIC32 cycles per host tick right now. Set by -k, otherwise calibrated
+static double g_cycleScale = 0;
+static double cycle_scale(){
+	return g_cycleScale > 0 ? g_cycleScale : calibrate();
+}
+
+// Modelled PIC32 cycles per sample that COST_PERCENTILE of blocks come in under
+// Timing single samples is swamped by the timer read itself so the ISR is
+// timed over short blocks. The percentile keeps slow stretches (an echo
+// write, a pitch crossfade). Each block keeps its fastest of COST_PASSES
+// passes first, as a busy desktop only ever makes things slower.
+static double profile(const WavData_t *in, WavData_t *out, uint32_t *cycles){
+	uint32_t block, blocks = in->length / COST_BLOCK, elapsed;
+	uint64_t start;
+	double scale;
+	int pass;
+	for(pass=0; pass < COST_PASSES; pass++){
+		scale = cycle_scale();
+		for(block=0; block < blocks; block++){
+			start = host_ticks();
+			render_range(in->samples + block * COST_BLOCK, out->samples + block * COST_BLOCK, COST_BLOCK);
+			elapsed = (uint32_t)((host_ticks() - start) * scale);
+			if(pass == 0 || elapsed < cycles[block]) cycles[block] = elapsed;
+		}
+	}
+	qsort(cycles, blocks, sizeof(uint32_t), cmp_cycles);
+	return (double)cycles[(uint64_t)blocks * COST_PERCENTILE / 1000] / COST_BLOCK;
+}
+
+// Modelled PIC32 cycles over the bare ISR
+static uint16_t model_cycles(double cycles, double baseline){
+	cycles = cycles > baseline ? cycles - baseline : 0;
+	return cycles > 0xffff ? 0xffff : (uint16_t)cycles;
+}
+
+//******** Echo tape encodings ********//
+
+// One tape sample in and out of an encoding. Same calls as echo_tapeWrite/Read
+static int16_t tape_roundTrip(uint8_t mode, TapeAdpcm_t *encoder, TapeAdpcm_t *decoder, int16_t sample){
+	switch(mode){
+		case TAPE_ULAW: return tape_ulawDecode(tape_ulawEncode(sample));
+		case TAPE_ALAW: return tape_alawDecode(tape_alawEncode(sample));
+		case TAPE_ADPCM: return tape_adpcmDecode(decoder, tape_adpcmEncode(encoder, sample));
+	}
+	return sample;
+}
+
+// The input is averaged down to the tape rate as echo_process() does, then
+// put through each encoding. Cost is the extra over 16bit per tape sample,
+// which all lands on the one sample in ECHO_IDXRATIO where the tape moves.
+static void tape_report(const WavData_t *in){
+	static const char *names[TAPE_MODES] = {"16bit", "u-law 8bit", "A-law 8bit", "ADPCM 4bit"};
+	uint32_t idx, tap, count = in->length / ECHO_IDXRATIO;
+	int16_t *tape = (int16_t *)malloc(count * sizeof(int16_t));
+	int16_t *decoded = (int16_t *)malloc(count * sizeof(int16_t));
+	TapeAdpcm_t encoder, decoder;
+	double signal, noise, cycles, scale, best, pcm = 0;
+	uint64_t start;
+	int32_t sum;
+	uint8_t mode;
+	int pass;
+
+	for(idx=0; idx < count; idx++){
+		sum = 0;
+		for(tap=0; tap < ECHO_IDXRATIO; tap++){
+			// ADC is 10bit signed
+			sum += (in->samples[idx * ECHO_IDXRATIO + tap] >> 6) * 64;
+		}
+		tape[idx] = (int16_t)(sum >> ECHO_IDXSHIFT);
+	}
+
+	printf("%u tape samples, %d samples of arena for one Echo\n", count, ECHO_BUFFMAX);
+	for(mode=0; mode < TAPE_MODES; mode++){
+		best = 0;
+		for(pass=0; pass < COST_PASSES; pass++){
+			encoder.predictor = 0;
+			encoder.index = 0;
+			decoder = encoder;
+			scale = cycle_scale();
+			start = host_ticks();
+			for(idx=0; idx < count; idx++){
+				decoded[idx] = tape_roundTrip(mode, &encoder, &decoder, tape[idx]);
+			}
+			cycles = (host_ticks() - start) * scale / count;
+			if(pass == 0 || cycles < best) best = cycles;
+		}
+		if(mode == TAPE_PCM16) pcm = best;
+		signal = 0;
+		noise = 0;
+		for(idx=0; idx < count; idx++){
+			signal += (double)tape[idx] * tape[idx];
+			noise += (double)(tape[idx] - decoded[idx]) * (tape[idx] - decoded[idx]);
+		}
+		printf("%-12s", names[mode]);
+		if(noise > 0) printf(" SNR %5.1f dB", 10 * log10(signal / noise));
+		else printf(" SNR    exact");
+		printf("  codec %4u cycles per tape sample  max delay %5.2fs\n"
+			, model_cycles(best, pcm)
+			, (double)((uint32_t)ECHO_BUFFMAX << tape_shift(mode)) * ECHO_IDXRATIO / SAMPLERATE);
+	}
+	free(tape);
+	free(decoded);
+}
+
+//******** Distortion aliasing ********//
+
+#define ALIAS_FREQ 2999 // Hz. Its harmonics fold back well away from each other
+#define ALIAS_LEVEL 16384 // Half scale sine in
+#define ALIAS_HARMONICS 6 // Below 20kHz
+
+// Power at freq Hz in n samples, by Goertzel. A sine of amplitude A gives A^2/2
+static double alias_power(const int32_t *samples, uint32_t n, double freq){
+	double coeff = 2 * cos(2 * M_PI * freq / SAMPLERATE);
+	double s0, s1 = 0, s2 = 0;
+	uint32_t idx;
+	for(idx=0; idx < n; idx++){
+		s0 = samples[idx] + coeff * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	return (s1 * s1 + s2 * s2 - coeff * s1 * s2) * (freq > 0 ? 2.0 : 1.0) / ((double)n * n);
+}
+
+// Everything that isn't DC or a harmonic of ALIAS_FREQ, relative to the
+// fundamental in dB. Aliases plus the rounding noise floor
+static double alias_ratio(const int32_t *samples, uint32_t n){
+	double total = 0, harmonics = 0;
+	uint32_t idx;
+	int harmonic;
+	for(idx=0; idx < n; idx++){
+		total += (double)samples[idx] * samples[idx];
+	}
+	total /= n;
+	total -= alias_power(samples, n, 0);
+	for(harmonic=1; harmonic <= ALIAS_HARMONICS; harmonic++){
+		harmonics += alias_power(samples, n, ALIAS_FREQ * harmonic);
+	}
+	return 10 * log10((total - harmonics) / alias_power(samples, n, ALIAS_FREQ));
+}
+
+// Puts a sine through each distortion curve at two drives, through the
+// whole effect with oversampling off and on. Reports what doesn't belong
+// and the cost of each, which seeds the distortion's COST_1X and COST.
+static void alias_report(){
+	static const uint16_t drives[] = {4 << DIST_DRIVE_SHIFT, 16 << DIST_DRIVE_SHIFT};
+	static const char *names[DIST_SHAPES] = {"Soft", "Hard", "Asym", "Fuzz"};
+	uint32_t idx, count = SAMPLERATE, warmup = SAMPLERATE / 2;
+	int32_t *in = (int32_t *)malloc((warmup + count) * sizeof(int32_t));
+	int32_t *out = (int32_t *)malloc((warmup + count) * sizeof(int32_t));
+	Effect_t *effect = dist_create();
+	dist_instance_t *instance;
+	dist_params_t *params;
+	double cycles, scale, copy, best[2] = {0, 0};
+	uint64_t start;
+	uint8_t drive, shape, oversample;
+	int pass;
+
+	if(effect == NULL){
+		fprintf(stderr, "No distortion instance left for -a\n");
+		exit(1);
+	}
+	instance = (dist_instance_t *)effect->data;
+	for(idx=0; idx < warmup + count; idx++){
+		in[idx] = (int32_t)lround(ALIAS_LEVEL * sin(2 * M_PI * ALIAS_FREQ * idx / SAMPLERATE));
+	}
+	// What a loop over the samples costs on its own
+	copy = 0;
+	for(pass=0; pass < COST_PASSES; pass++){
+		scale = cycle_scale();
+		start = host_ticks();
+		for(idx=0; idx < warmup + count; idx++) out[idx] = in[idx];
+		cycles = (host_ticks() - start) * scale / (warmup + count);
+		if(pass == 0 || cycles < copy) copy = cycles;
+	}
+
+	printf("%dHz sine at half scale. Aliases and noise relative to the fundamental\n", ALIAS_FREQ);
+	printf("Shape  Drive      1x        2x    cost 1x   2x cycles\n");
+	for(shape=0; shape < DIST_SHAPES; shape++){
+		for(drive=0; drive < sizeof(drives) / sizeof(drives[0]); drive++){
+			printf("%-6s x%-3u", names[shape], drives[drive] >> DIST_DRIVE_SHIFT);
+			for(oversample=0; oversample < 2; oversample++){
+				params = instance->params.edit();
+				params->drive = drives[drive];
+				params->level = 0xffff;
+				params->shape = shape;
+				params->oversample = oversample;
+				instance->params.publish();
+
+				for(pass=0; pass < COST_PASSES; pass++){
+					scale = cycle_scale();
+					start = host_ticks();
+					for(idx=0; idx < warmup + count; idx++){
+						out[idx] = effect->effectISR(effect, in[idx]);
+					}
+					cycles = (host_ticks() - start) * scale / (warmup + count);
+					if(pass == 0 || cycles < best[oversample]) best[oversample] = cycles;
+				}
+				printf(" %6.1fdB", alias_ratio(out + warmup, count));
+			}
+			printf(" %8u %4u\n", model_cycles(best[0], copy), model_cycles(best[1], copy));
+		}
+	}
+	effect_destroy(effect);
+	free(in);
+	free(out);
+}
+
+//******** DSP primitives ********//
+
+#define DSP_CASES 1000000 // Random cases per primitive
+
+// Reference models for dsp_fixed.h. Written the long way round in 64bits,
+// with shifts as floor divisions, so they share none of its shortcuts.
+static int64_t ref_floorDiv(int64_t value, int bits){
+	int64_t div = (int64_t)1 << bits;
+	int64_t result = value / div;
+	if(value % div != 0 && value < 0) result--;
+	return result;
+}
+
+static int64_t ref_clamp(int64_t value, int64_t min, int64_t max){
+	return value < min ? min : (value > max ? max : value);
+}
+
+// Weighted average of a and b, frac/2^bits of the way to b
+static int64_t ref_lerp(int64_t a, int64_t b, int64_t frac, int bits){
+	return ref_floorDiv(a * (((int64_t)1 << bits) - frac) + b * frac, bits);
+}
+
+// Repeatable test values. xorshift32
+static uint32_t dsp_random(){
+	static uint32_t state = 2463534242u;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// Somewhere in min to max inclusive, an end or zero one time in eight
+static int32_t dsp_value(int32_t min, int32_t max){
+	uint32_t pick = dsp_random();
+	switch(pick & 7){
+		case 0:
+			switch((pick >> 3) % 5){
+				case 0: return min;
+				case 1: return max;
+				case 2: return (min < max) ? min + 1 : min;
+				case 3: return (min < max) ? max - 1 : max;
+			}
+			return (min <= 0 && max >= 0) ? 0 : min;
+	}
+	return (int32_t)(min + (int64_t)(dsp_random() % ((uint64_t)max - min + 1)));
+}
+
+// Prints the result of one primitive's check. Returns 1 if it failed
+static int dsp_result(const char *name, uint32_t cases, uint32_t fails, const char *first){
+	printf("%-16s %8u cases  ", name, cases);
+	if(fails == 0){
+		printf("exact\n");
+		return 0;
+	}
+	printf("%u MISMATCHED, first %s\n", fails, first);
+	return 1;
+}
+
+// Checks every dsp_fixed.h primitive bit-exact against its reference model
+// over random and edge values in the ranges it documents. Returns the
+// number that failed
+static int dsp_report(){
+	static int16_t buffer[FLNG_BUFFSIZE];
+	char first[128];
+	uint32_t idx, fails, size = FLNG_BUFFSIZE;
+	int32_t a, b, got, state, current, target;
+	int64_t want, acc;
+	dsp_acc_t dacc;
+	uint32_t frac, pos;
+	uint8_t bits, shift, step, count;
+	int failed = 0;
+
+#define DSP_FAIL(...) if(fails++ == 0) snprintf(first, sizeof(first), __VA_ARGS__)
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = (int32_t)dsp_random();
+		got = dsp_sat16(a);
+		want = ref_clamp(a, -32768, 32767);
+		if(got != want) DSP_FAIL("%d", a);
+	}
+	failed += dsp_result("dsp_sat16", DSP_CASES, fails, first);
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = dsp_value(-32768, 32767);
+		b = (idx & 1) ? dsp_value(-32768, 32767) : dsp_value(0, 0xffff);
+		got = dsp_mulQ15(a, b);
+		want = ref_floorDiv((int64_t)a * b, 15);
+		if(got != want) DSP_FAIL("%d x %d", a, b);
+	}
+	failed += dsp_result("dsp_mulQ15", DSP_CASES, fails, first);
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = dsp_value(-32768, 32767);
+		b = dsp_value(0, 0xffff);
+		got = dsp_mulQ16(a, (uint16_t)b);
+		want = ref_floorDiv((int64_t)a * b, 16);
+		if(got != want) DSP_FAIL("%d x %d", a, b);
+	}
+	failed += dsp_result("dsp_mulQ16", DSP_CASES, fails, first);
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = dsp_value(INT32_MIN + 1, INT32_MAX);
+		b = dsp_value(INT32_MIN, INT32_MAX);
+		got = dsp_mulQ31(a, b);
+		want = ref_floorDiv((int64_t)a * b, 31);
+		if(got != want) DSP_FAIL("%d x %d", a, b);
+	}
+	failed += dsp_result("dsp_mulQ31", DSP_CASES, fails, first);
+
+	// Runs of up to 16 products, as a filter or a mix of taps would
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		count = 1 + (dsp_random() & 15);
+		shift = dsp_random() % 32;
+		dacc = 0;
+		acc = 0;
+		for(step=0; step < count; step++){
+			a = dsp_value(INT32_MIN, INT32_MAX);
+			b = dsp_value(-32768, 32767);
+			if(dsp_random() & 1){
+				dacc = dsp_mac(dacc, a, b);
+				acc += (int64_t)a * b;
+			}else{
+				dacc = dsp_msub(dacc, a, b);
+				acc -= (int64_t)a * b;
+			}
+		}
+		got = dsp_acc16(dacc, shift);
+		want = ref_clamp(ref_floorDiv(acc, shift), -32768, 32767);
+		if(got != want) DSP_FAIL("%lld >> %u", (long long)acc, shift);
+	}
+	failed += dsp_result("dsp_mac/acc16", DSP_CASES, fails, first);
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = dsp_value(-32768, 32767);
+		b = dsp_value(-32768, 32767);
+		bits = dsp_random() % 15;
+		frac = dsp_value(0, (1 << bits) - 1);
+		got = dsp_lerp(a, b, frac, bits);
+		want = ref_lerp(a, b, frac, bits);
+		if(got != want) DSP_FAIL("%d to %d by %u/2^%u", a, b, frac, bits);
+	}
+	failed += dsp_result("dsp_lerp", DSP_CASES, fails, first);
+
+	// Every position in the table
+	fails = 0;
+	for(pos=0; pos <= ((DSP_SINE_MASK + 1) << DSP_SINE_SHIFT) - 1; pos++){
+		got = dsp_sine(pos);
+		want = ref_lerp(g_sinewave[(pos >> DSP_SINE_SHIFT) % (DSP_SINE_MASK + 1)]
+			, g_sinewave[((pos >> DSP_SINE_SHIFT) + 1) % (DSP_SINE_MASK + 1)]
+			, pos % (1 << DSP_SINE_SHIFT), DSP_SINE_SHIFT);
+		if(got != want) DSP_FAIL("pos %u", pos);
+	}
+	failed += dsp_result("dsp_sine", pos, fails, first);
+
+	// Random delay line sizes and contents, every wrap
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		if(idx % 1000 == 0){
+			size = dsp_value(2, FLNG_BUFFSIZE);
+			for(pos=0; pos < size; pos++) buffer[pos] = (int16_t)dsp_value(-32768, 32767);
+		}
+		bits = dsp_random() % 15;
+		pos = dsp_value(0, (int32_t)((2 * size) << bits) - 1);
+		got = dsp_delayRead(buffer, size, pos, bits);
+		want = ref_lerp(buffer[(pos >> bits) % size], buffer[((pos >> bits) + 1) % size], pos % (1 << bits), bits);
+		if(got != want) DSP_FAIL("pos %u of %u<<%u", pos, size, bits);
+	}
+	failed += dsp_result("dsp_delayRead", DSP_CASES, fails, first);
+
+	// Random curves. Values well past the int16 range either way
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		if(idx % 1000 == 0){
+			for(pos=0; pos < DSP_CURVE_LEN; pos++) buffer[pos] = (int16_t)dsp_value(-32768, 32767);
+		}
+		a = dsp_value(-(1 << 20), 1 << 20);
+		got = dsp_curve(buffer, a);
+		pos = (uint32_t)(a < -32768 ? 0 : (a > 32767 ? 65535 : a + 32768));
+		want = ref_lerp(buffer[pos >> 8], buffer[(pos >> 8) + 1], pos % 256, 8);
+		if(got != want) DSP_FAIL("%d", a);
+	}
+	failed += dsp_result("dsp_curve", DSP_CASES, fails, first);
+
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		state = dsp_value(-(1 << 30), (1 << 30) - 1);
+		a = dsp_value(-(1 << 30), (1 << 30) - 1);
+		shift = dsp_random() % 16;
+		want = state + ref_floorDiv((int64_t)a - state, shift);
+		got = dsp_onePole(&state, a, shift);
+		if(got != want || state != want) DSP_FAIL("%d to %d >> %u", state, a, shift);
+	}
+	failed += dsp_result("dsp_onePole", DSP_CASES, fails, first);
+
+	// Each ramp is followed until it lands, which it has to do exactly
+	fails = 0;
+	for(idx=0; idx < DSP_CASES / 1000; idx++){
+		current = dsp_value(0, 0xffff) << 8;
+		target = dsp_value(0, 0xffff);
+		acc = current;
+		for(pos=0; pos < 4096; pos++){
+			got = dsp_smooth(&current, target, SMOOTH_FAST);
+			want = ((int64_t)target << 8) - acc;
+			acc += ref_floorDiv(want, SMOOTH_FAST) + (want > 0);
+			want = ref_floorDiv(acc, 8);
+			if(got != want || current != acc){
+				DSP_FAIL("%d to %d step %u", (int32_t)(acc >> 8), target, pos);
+				break;
+			}
+		}
+		if(current != target << 8) DSP_FAIL("%d to %d never landed", current >> 8, target);
+	}
+	failed += dsp_result("dsp_smooth", DSP_CASES / 1000, fails, first);
+
+	// The tables are rebuilt from libm, and the result also has to be
+	// within 0.0015dB (16) of the real log
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		pos = (uint32_t)dsp_value(INT32_MIN, INT32_MAX) >> (dsp_random() % 32);
+		got = dsp_log2(pos);
+		if(pos == 0){
+			want = 0;
+		}else{
+			for(bits=31; !(pos >> bits); bits--);
+			acc = ((int64_t)pos << (31 - bits)) & 0x7fffffff;
+			frac = (uint32_t)(acc >> 26);
+			want = ((int64_t)bits << DSP_LOG_SHIFT) + ref_lerp(llround(65536 * log2(1 + frac / 32.0))
+				, llround(65536 * log2(1 + (frac + 1) / 32.0)), (acc >> 10) & 0xffff, 16);
+		}
+		if(got != want || (pos && fabs(got - 65536 * log2((double)pos)) > 16)) DSP_FAIL("%u", pos);
+	}
+	failed += dsp_result("dsp_log2", DSP_CASES, fails, first);
+
+	// Every log that gives a gain that fits, and some that are too small to.
+	// Also within 0.0006dB of the real thing
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		a = dsp_value(-18 * (1 << DSP_LOG_SHIFT), (15 << DSP_LOG_SHIFT) - 1);
+		got = (int32_t)dsp_exp2(a);
+		frac = (a & 0xffff) >> 11;
+		want = ref_lerp(llround(65536 * exp2(frac / 32.0)), llround(65536 * exp2((frac + 1) / 32.0)), a & 0x7ff, 11);
+		want = ref_floorDiv(want << 17, 17 - ref_floorDiv(a, DSP_LOG_SHIFT));
+		if(got != want || fabs(got - 65536 * exp2(a / 65536.0)) > 1 + got / 15000.0) DSP_FAIL("%d", a);
+	}
+	failed += dsp_result("dsp_exp2", DSP_CASES, fails, first);
+
+	// One step from random coefficients and history. Outputs that have
+	// grown well past int16 are in range, the state keeps them
+	fails = 0;
+	for(idx=0; idx < DSP_CASES; idx++){
+		dsp_biquad_t coeffs = {dsp_value(INT32_MIN, INT32_MAX), dsp_value(INT32_MIN, INT32_MAX)
+			, dsp_value(INT32_MIN, INT32_MAX), dsp_value(INT32_MIN, INT32_MAX), dsp_value(INT32_MIN, INT32_MAX)
+			, (uint8_t)(dsp_random() % 4)};
+		dsp_biquadState_t biquad = {dsp_value(-32768, 32767), dsp_value(-32768, 32767)
+			, dsp_value(-(1 << 20), 1 << 20), dsp_value(-(1 << 20), 1 << 20), (uint32_t)dsp_value(0, (1 << 30) - 1)};
+		dsp_biquadState_t before = biquad;
+		a = dsp_value(-32768, 32767);
+		got = dsp_biquad(&biquad, &coeffs, a);
+		acc = (int64_t)before.error
+			+ ((int64_t)a << coeffs.shift) * coeffs.b0
+			+ ((int64_t)before.x1 << coeffs.shift) * coeffs.b1
+			+ ((int64_t)before.x2 << coeffs.shift) * coeffs.b2
+			- (int64_t)before.y1 * coeffs.a1
+			- (int64_t)before.y2 * coeffs.a2;
+		want = ref_floorDiv(acc, DSP_BIQUAD_SHIFT);
+		if(got != want || biquad.error != (uint64_t)(acc - want * ((int64_t)1 << DSP_BIQUAD_SHIFT))
+			|| biquad.x1 != a || biquad.x2 != before.x1 || biquad.y1 != got || biquad.y2 != before.y1){
+			DSP_FAIL("%d through %d %d %d %d %d << %u", a, coeffs.b0, coeffs.b1, coeffs.b2, coeffs.a1, coeffs.a2, coeffs.shift);
+		}
+	}
+	failed += dsp_result("dsp_biquad", DSP_CASES, fails, first);
+
+#undef DSP_FAIL
+	return failed;
+}
+
+// name is a prefix of the effect's name, with #N to pick the Nth of them
+static Effect_t *find_effect(const char *name, size_t len){
+	Effect_t * const *currentAddr;
+	const char *hash = (const char *)memchr(name, '#', len);
+	size_t prefix = hash ? (size_t)(hash - name) : len;
+	int nth = hash ? atoi(hash + 1) : 1;
+	for(currentAddr = slots_chain(); *currentAddr; currentAddr++){
+		if(prefix && strncasecmp((*currentAddr)->name, name, prefix) == 0 && --nth == 0){
+			return *currentAddr;
+		}
+	}
+	fprintf(stderr, "Unknown effect '%.*s'\n", (int)len, name);
+	exit(1);
+}
+
+// Same as updateChainMask() in ChipStomp.pde
+static void update_chain_mask(){
+	uint32_t mask = 0;
+	uint8_t bit = 0;
+	Effect_t * const *currentAddr;
+	for(currentAddr = slots_chain(); *currentAddr; currentAddr++, bit++){
+		if((*currentAddr)->state) mask |= (1 << bit);
+	}
+	g_chainMask = mask;
+}
+
+// Nothing to fade out between renders. Finishes the fades at once and
+// lets arena_retire() hand the memory round until it's settled
+static uint8_t settle(){
+	Effect_t * const *currentAddr;
+	uint8_t retired, result = 0;
+	do{
+		for(currentAddr = slots_chain(); *currentAddr; currentAddr++){
+			if((*currentAddr)->state == EFFECT_FADING || (*currentAddr)->state == EFFECT_RESTART){
+				(*currentAddr)->bypass = 0;
+				(*currentAddr)->faded = 1;
+			}
+		}
+		retired = arena_retire(slots_chain());
+		result |= retired;
+	}while(retired & ARENA_CHANGED);
+	return result;
+}
+
+static void set_state(Effect_t *effect, uint8_t state){
+	if(effect_isOn(effect) != state){
+		if(!arena_toggle(effect) || (settle() & ARENA_REFUSED)){
+			fprintf(stderr, "No delay memory for %s (largest free %u of %d samples)\n", effect->name, arena_largestFree(), ARENA_SAMPLES);
+			exit(1);
+		}
+		update_chain_mask();
+	}
+}
+
+// Selects feature feat using nextFeature() then sends the encoder delta
+static void adjust(const char *spec){
+	const char *colon = strchr(spec, ':');
+	Effect_t *effect;
+	int feat, delta, guard;
+	if(!colon || sscanf(colon+1, "%d:%d", &feat, &delta) != 2){
+		fprintf(stderr, "Bad -p '%s' (want name:feature:delta)\n", spec);
+		exit(1);
+	}
+	effect = find_effect(spec, colon - spec);
+	for(guard=0; effect->featureIdx != feat && guard < 256; guard++){
+		effect->nextFeature(effect);
+	}
+	if(effect->featureIdx != feat){
+		fprintf(stderr, "%s has no feature %d\n", effect->name, feat);
+		exit(1);
+	}
+	effect->adjustFeature(effect, (int16_t)delta);
+	// A new tape or room size restarts the effect with new memory
+	if(settle() & ARENA_REFUSED){
+		fprintf(stderr, "No delay memory for %s (largest free %u of %d samples)\n", effect->name, arena_largestFree(), ARENA_SAMPLES);
+		exit(1);
+	}
+	update_chain_mask();
+}
+
+// Moves an effect along the chain like turning the encoder with select held
+static void move(const char *spec){
+	const char *colon = strchr(spec, ':');
+	Effect_t *effect;
+	int step;
+	if(!colon || sscanf(colon+1, "%d", &step) != 1){
+		fprintf(stderr, "Bad -m '%s' (want name:step)\n", spec);
+		exit(1);
+	}
+	effect = find_effect(spec, colon - spec);
+	for(; step; step += (step > 0) ? -1 : 1){
+		if(!slots_move(effect, (step > 0) ? 1 : -1)){
+			fprintf(stderr, "Can't move %s any further\n", effect->name);
+			exit(1);
+		}
+	}
+}
+
+// Turns one effect on or off as the footswitch would, then settles. Unlike
+// set_state() a refusal is returned rather than fatal
+static uint8_t arena_step(Effect_t *effect, boolean *accepted){
+	uint8_t result;
+	*accepted = arena_toggle(effect);
+	result = settle();
+	update_chain_mask();
+	return result;
+}
+
+// Walks the arena through a fixed sequence of Echo, Reverb, Chorus and
+// Flanger switching, checking every effect's state and where its delay line
+// sits after each step. Leaves the chain as it found it. Returns the number
+// of steps that failed
+static int arena_report(){
+	static const char *names[] = {"Echo", "Reverb", "Chorus", "Flanger"};
+	enum {ECHO, REVERB, CHORUS, FLANGER, EFFECTS};
+	Effect_t *effects[EFFECTS];
+	uint8_t enabled[SLOTS_MAX];
+	Effect_t * const *currentAddr;
+	char first[128];
+	uint32_t cases, fails;
+	uint16_t start, size, studio, cave;
+	uint8_t idx, feature, result = 0;
+	boolean accepted = true;
+	int failed = 0;
+#if !STATIC_CHAIN
+	Effect_t *reverb2, *flanger2;
+#endif
+
+#define ARENA_FAIL(...) if(fails++ == 0) snprintf(first, sizeof(first), __VA_ARGS__)
+// The effect is in state and its delay line is size samples at start
+#define ARENA_EXPECT(effect, want, at, length) \
+	cases++; \
+	start = 0; \
+	size = arena_owned(effect, &start); \
+	if((effect)->state != (want) || size != (length) || (size && start != (at))) \
+		ARENA_FAIL("%s state %u with %u at %u", (effect)->name, (effect)->state, size, start)
+// The last step's toggle and settle results
+#define ARENA_RESULT(wantAccepted, wantRefused) \
+	cases++; \
+	if(accepted != (wantAccepted) || ((result & ARENA_REFUSED) != 0) != (wantRefused)) \
+		ARENA_FAIL("toggle %s, retire %u", accepted ? "accepted" : "refused", result)
+// Nothing else in the arena
+#define ARENA_FREE(want) \
+	cases++; \
+	if(arena_largestFree() != (want)) ARENA_FAIL("%u free", arena_largestFree())
+
+	// Start with everything off
+	for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+		enabled[idx] = effect_isOn(*currentAddr);
+		set_state(*currentAddr, 0);
+	}
+	for(idx=0; idx < EFFECTS; idx++){
+		effects[idx] = find_effect(names[idx], strlen(names[idx]));
+	}
+	studio = effects[REVERB]->memory;
+	feature = effects[REVERB]->featureIdx;
+
+	// A lone Echo takes all but the reserve. The rest fit in the reserve
+	fails = 0;
+	cases = 0;
+	ARENA_FREE(ARENA_SAMPLES);
+	result = arena_step(effects[ECHO], &accepted);
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[ECHO], EFFECT_ON, 0, ECHO_BUFFMAX);
+	ARENA_FREE(ARENA_RESERVE);
+	result = arena_step(effects[REVERB], &accepted);
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[REVERB], EFFECT_ON, ECHO_BUFFMAX, studio);
+	result = arena_step(effects[CHORUS], &accepted);
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[CHORUS], EFFECT_ON, ECHO_BUFFMAX + studio, CHOR_BUFFSIZE);
+	ARENA_FREE(ARENA_RESERVE - studio - CHOR_BUFFSIZE);
+	failed += dsp_result("arena reserve", cases, fails, first);
+
+	// The Flanger doesn't fit. The Echo fades out to restart and waits
+	// behind it, then takes what's left after it
+	fails = 0;
+	cases = 0;
+	accepted = arena_toggle(effects[FLANGER]);
+	result = 0;
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[FLANGER], EFFECT_WAITING, 0, 0);
+	ARENA_EXPECT(effects[ECHO], EFFECT_RESTART, 0, ECHO_BUFFMAX);
+	result = settle();
+	update_chain_mask();
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[FLANGER], EFFECT_ON, 0, FLNG_BUFFSIZE);
+	ARENA_EXPECT(effects[ECHO], EFFECT_ON, FLNG_BUFFSIZE, ECHO_BUFFMAX - FLNG_BUFFSIZE);
+	ARENA_EXPECT(effects[REVERB], EFFECT_ON, ECHO_BUFFMAX, studio);
+	ARENA_EXPECT(effects[CHORUS], EFFECT_ON, ECHO_BUFFMAX + studio, CHOR_BUFFSIZE);
+	failed += dsp_result("arena evict", cases, fails, first);
+
+	// Two steps up to the Cave while on restarts the Reverb once, at the
+	// new size. It needs the Echo to shrink again
+	fails = 0;
+	cases = 0;
+	while(effects[REVERB]->featureIdx != 4) effects[REVERB]->nextFeature(effects[REVERB]);
+	effects[REVERB]->adjustFeature(effects[REVERB], 1);
+	effects[REVERB]->adjustFeature(effects[REVERB], 1);
+	cave = effects[REVERB]->memory;
+	ARENA_EXPECT(effects[REVERB], EFFECT_RESTART, ECHO_BUFFMAX, studio);
+	result = settle();
+	update_chain_mask();
+	ARENA_RESULT(true, false);
+	ARENA_EXPECT(effects[FLANGER], EFFECT_ON, 0, FLNG_BUFFSIZE);
+	ARENA_EXPECT(effects[REVERB], EFFECT_ON, FLNG_BUFFSIZE, cave);
+	ARENA_EXPECT(effects[ECHO], EFFECT_ON, FLNG_BUFFSIZE + cave, ECHO_BUFFMAX + studio - FLNG_BUFFSIZE - cave);
+	ARENA_EXPECT(effects[CHORUS], EFFECT_ON, ECHO_BUFFMAX + studio, CHOR_BUFFSIZE);
+	failed += dsp_result("arena restart", cases, fails, first);
+
+#if !STATIC_CHAIN
+	// A second Cave squeezes the Echo down to what's left of its old line.
+	// A second Flanger can't be made room for, so is refused with nothing
+	// disturbed. Asked for while the Chorus fades out, it waits for that
+	// memory, still doesn't fit and is refused once the Chorus has gone
+	fails = 0;
+	cases = 0;
+	reverb2 = slots_duplicate(effects[REVERB]);
+	flanger2 = slots_duplicate(effects[FLANGER]);
+	if(reverb2 == NULL || flanger2 == NULL){
+		ARENA_FAIL("no copies");
+	}else{
+		result = arena_step(reverb2, &accepted);
+		ARENA_RESULT(true, false);
+		ARENA_EXPECT(reverb2, EFFECT_ON, FLNG_BUFFSIZE + cave, cave);
+		ARENA_EXPECT(effects[ECHO], EFFECT_ON, FLNG_BUFFSIZE + 2 * cave, ECHO_BUFFMAX + studio - FLNG_BUFFSIZE - 2 * cave);
+		result = arena_step(flanger2, &accepted);
+		ARENA_RESULT(false, false);
+		ARENA_EXPECT(flanger2, EFFECT_OFF, 0, 0);
+		ARENA_EXPECT(effects[ECHO], EFFECT_ON, FLNG_BUFFSIZE + 2 * cave, ECHO_BUFFMAX + studio - FLNG_BUFFSIZE - 2 * cave);
+		arena_toggle(effects[CHORUS]);
+		accepted = arena_toggle(flanger2);
+		result = 0;
+		ARENA_RESULT(true, false);
+		ARENA_EXPECT(flanger2, EFFECT_WAITING, 0, 0);
+		ARENA_EXPECT(effects[CHORUS], EFFECT_FADING, ECHO_BUFFMAX + studio, CHOR_BUFFSIZE);
+		result = settle();
+		update_chain_mask();
+		ARENA_RESULT(true, true);
+		ARENA_EXPECT(flanger2, EFFECT_OFF, 0, 0);
+		ARENA_EXPECT(effects[CHORUS], EFFECT_OFF, 0, 0);
+		ARENA_EXPECT(effects[ECHO], EFFECT_ON, FLNG_BUFFSIZE + 2 * cave, ECHO_BUFFMAX + studio - FLNG_BUFFSIZE - 2 * cave);
+		ARENA_FREE(ARENA_RESERVE - studio);
+		set_state(reverb2, 0);
+		slots_remove(reverb2);
+		slots_remove(flanger2);
+	}
+	failed += dsp_result("arena refuse", cases, fails, first);
+#endif
+
+	// Everything off gives it all back
+	fails = 0;
+	cases = 0;
+	for(currentAddr = slots_chain(); *currentAddr; currentAddr++){
+		set_state(*currentAddr, 0);
+	}
+	for(idx=0; idx < EFFECTS; idx++){
+		ARENA_EXPECT(effects[idx], EFFECT_OFF, 0, 0);
+	}
+	ARENA_FREE(ARENA_SAMPLES);
+	failed += dsp_result("arena free", cases, fails, first);
+
+	// Back to the Studio and the chain as it was
+	effects[REVERB]->adjustFeature(effects[REVERB], -1);
+	effects[REVERB]->adjustFeature(effects[REVERB], -1);
+	effects[REVERB]->featureIdx = feature;
+	for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+		set_state(*currentAddr, enabled[idx]);
+	}
+
+#undef ARENA_FREE
+#undef ARENA_RESULT
+#undef ARENA_EXPECT
+#undef ARENA_FAIL
+	return failed;
+}
+
+// The chain as a preset sees it
+typedef struct {
+	Effect_t *order[SLOTS_MAX];
+	uint8_t on[SLOTS_MAX];
+	uint8_t length[SLOTS_MAX];
+	uint8_t settings[SLOTS_MAX][PRESET_EFFECT_MAX];
+	uint8_t count;
+} ChainSnapshot_t;
+
+static void chain_snapshot(ChainSnapshot_t *snapshot){
+	Effect_t * const *currentAddr;
+	uint8_t idx;
+	for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+		snapshot->order[idx] = *currentAddr;
+		snapshot->on[idx] = effect_isOn(*currentAddr);
+		snapshot->length[idx] = (*currentAddr)->save ? (*currentAddr)->save(*currentAddr, snapshot->settings[idx]) : 0;
+	}
+	snapshot->count = idx;
+}
+
+// Describes the first way the chain differs from snapshot into first.
+// Returns false if it doesn't
+static boolean chain_differs(const ChainSnapshot_t *snapshot, char *first, size_t size){
+	ChainSnapshot_t now;
+	uint8_t idx;
+	chain_snapshot(&now);
+	if(now.count != snapshot->count){
+		snprintf(first, size, "%u effects, not %u", now.count, snapshot->count);
+		return true;
+	}
+	for(idx=0; idx < now.count; idx++){
+		if(now.order[idx] != snapshot->order[idx]){
+			snprintf(first, size, "%s #%u in slot %u, not %s #%u", now.order[idx]->name, now.order[idx]->copy, idx, snapshot->order[idx]->name, snapshot->order[idx]->copy);
+			return true;
+		}
+		if(now.on[idx] != snapshot->on[idx]){
+			snprintf(first, size, "%s #%u %s", now.order[idx]->name, now.order[idx]->copy, now.on[idx] ? "on" : "off");
+			return true;
+		}
+		if(now.length[idx] != snapshot->length[idx] || memcmp(now.settings[idx], snapshot->settings[idx], now.length[idx])){
+			snprintf(first, size, "%s #%u settings", now.order[idx]->name, now.order[idx]->copy);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Saves a reordered chain with a copy in it, scrambles it and recalls it,
+// then damages the save and checks recall leaves the chain alone. Then
+// checks a recall that would take a running Distortion over the CPU
+// budget. Leaves the chain as it found it. Returns the number of steps
+// that failed
+static int preset_report(){
+	static ChainSnapshot_t before, saved;
+	Effect_t *reverb, *dist;
+	char first[128], differs[128];
+	uint32_t cases, fails;
+	uint16_t overbudget, oversampled, single;
+	uint8_t outofmemory, idx;
+	boolean recalled;
+	int failed = 0;
+#if !STATIC_CHAIN
+	Effect_t *echo2;
+#endif
+
+#define PRESET_FAIL(...) if(fails++ == 0) snprintf(first, sizeof(first), __VA_ARGS__)
+
+	chain_snapshot(&before);
+	for(idx=0; idx < before.count; idx++){
+		set_state(before.order[idx], 0);
+	}
+	reverb = find_effect("Reverb", 6);
+	dist = find_effect("Distortion", 10);
+
+	// Reverb first, two Echoes sharing the tape
+	fails = 0;
+	cases = 4;
+#if !STATIC_CHAIN
+	echo2 = slots_duplicate(find_effect("Echo", 4));
+	while(slots_move(reverb, -1));
+#endif
+	set_state(find_effect("Echo", 4), 1);
+	set_state(reverb, 1);
+	set_state(find_effect("Tremolo", 7), 1);
+	adjust("echo:2:-30");
+	adjust("trem:1:40");
+	adjust("reverb:4:1");
+#if !STATIC_CHAIN
+	set_state(echo2, 1);
+	adjust("echo#2:2:20");
+#endif
+	chain_snapshot(&saved);
+	if(!preset_save(0)) PRESET_FAIL("save");
+	// Scrambled
+#if !STATIC_CHAIN
+	while(slots_move(reverb, 1));
+#endif
+	set_state(find_effect("Tremolo", 7), 0);
+	set_state(find_effect("Filter", 6), 1);
+	adjust("echo:2:10");
+	adjust("trem:1:-20");
+	adjust("reverb:4:-1");
+	overbudget = 0;
+	outofmemory = 0;
+	recalled = preset_recall(0, &overbudget, &outofmemory);
+	if(settle() & ARENA_REFUSED) outofmemory = 1;
+	update_chain_mask();
+	if(!recalled) PRESET_FAIL("recall");
+	if(overbudget || outofmemory) PRESET_FAIL("%u cycles over, %s memory", overbudget, outofmemory ? "out of" : "enough");
+	if(chain_differs(&saved, differs, sizeof(differs))) PRESET_FAIL("%s", differs);
+	failed += dsp_result("preset recall", cases, fails, first);
+
+	// One bit flipped in the save. Byte 12 is the first entry's length :
+	// after the page's sequence number and the preset's header
+	fails = 0;
+	cases = 3;
+	((uint8_t *)host_nvm_page)[12] ^= 1;
+	set_state(find_effect("Tremolo", 7), 0);
+	adjust("echo:2:10");
+	chain_snapshot(&saved);
+	if(preset_used(0)) PRESET_FAIL("still used");
+	if(preset_recall(0, &overbudget, &outofmemory)) PRESET_FAIL("recalled");
+	settle();
+	update_chain_mask();
+	if(chain_differs(&saved, differs, sizeof(differs))) PRESET_FAIL("%s", differs);
+	failed += dsp_result("preset damaged", cases, fails, first);
+
+	// Saved oversampled with the chain filled up to the budget at 1x. The
+	// Distortion was turned down to 1x to fit, so recall leaves it there
+	fails = 0;
+	cases = 4;
+	for(idx=0; slots_chain()[idx]; idx++){
+		set_state(slots_chain()[idx], 0);
+	}
+	adjust("dist:4:-1");
+	single = dist->cost;
+	set_state(dist, 1);
+	for(idx=0; slots_chain()[idx]; idx++){
+		if(slots_budgetAllows(slots_chain()[idx])) set_state(slots_chain()[idx], 1);
+	}
+	chain_snapshot(&saved);
+	adjust("dist:4:1");
+	oversampled = dist->cost;
+	if(!preset_save(1)) PRESET_FAIL("save");
+	adjust("dist:4:-1");
+	overbudget = 0;
+	outofmemory = 0;
+	if(!preset_recall(1, &overbudget, &outofmemory)) PRESET_FAIL("recall");
+	settle();
+	update_chain_mask();
+	if(overbudget != oversampled - single) PRESET_FAIL("%u cycles over, not %u", overbudget, oversampled - single);
+	if(slots_cost() > CYCLE_BUDGET) PRESET_FAIL("chain costs %u", slots_cost());
+	if(chain_differs(&saved, differs, sizeof(differs))) PRESET_FAIL("%s", differs);
+	failed += dsp_result("preset budget", cases, fails, first);
+
+	// The chain, its settings and states as they were
+	for(idx=0; slots_chain()[idx]; idx++){
+		set_state(slots_chain()[idx], 0);
+	}
+#if !STATIC_CHAIN
+	slots_remove(echo2);
+#endif
+	slots_arrange(before.order, before.count);
+	for(idx=0; idx < before.count; idx++){
+		if(before.order[idx]->load) before.order[idx]->load(before.order[idx], before.settings[idx], before.length[idx]);
+	}
+	settle();
+	for(idx=0; idx < before.count; idx++){
+		set_state(before.order[idx], before.on[idx]);
+	}
+
+#undef PRESET_FAIL
+	return failed;
+}
+
+// Decaying sawtooth at low E with a little noise. Roughly a plucked bass note
+static void make_test_signal(WavData_t *wav, float seconds){
+	uint32_t idx, period;
+	wav->samplerate = SAMPLERATE;
+	wav->length = (uint32_t)(seconds * SAMPLERATE);
+	wav->samples = (int16_t *)malloc(wav->length * sizeof(int16_t));
+	period = SAMPLERATE / 41;
+	srand(1);
+	for(idx=0; idx < wav->length; idx++){
+		float env = expf(-(float)(idx % SAMPLERATE) / (SAMPLERATE / 3));
+		float saw = (float)(idx % period) / period * 2 - 1;
+		float noise = (float)(rand() % 2001 - 1000) / 1000;
+		wav->samples[idx] = (int16_t)((saw * 0.9f + noise * 0.05f) * env * 24000);
+	}
+}
+
+static void usage(){
+	fprintf(stderr,
+		"Usage: chipstomp_host [-e effects] [-p name:feat:delta] [-c name] [-m name:step] [-b] [-t] [-q] [-a] [-i count] [-n seconds] [-k scale] [in.wav [out.wav]]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]){
+	const char *enable = NULL;
+	const char *inpath = NULL, *outpath = NULL;
+	const char *adjustments[32];
+	const char *copies[SLOTS_MAX];
+	const char *moves[32];
+	int adjustcount = 0, copycount = 0, movecount = 0;
+	int benchmark = 0;
+	int tapes = 0;
+	int dspcheck = 0;
+	int aliasing = 0;
+	int iterations = 20;
+	float seconds = 5;
+	double baseline;
+	uint32_t *cycles;
+	uint16_t cost, chaincost = 0;
+	int idx;
+	WavData_t in, out;
+	Effect_t * const *currentAddr;
+	uint8_t enabled[SLOTS_MAX];
+
+	for(idx=1; idx < argc; idx++){
+		if(!strcmp(argv[idx], "-e") && idx+1 < argc) enable = argv[++idx];
+		else if(!strcmp(argv[idx], "-p") && idx+1 < argc && adjustcount < 32) adjustments[adjustcount++] = argv[++idx];
+		else if(!strcmp(argv[idx], "-c") && idx+1 < argc && copycount < SLOTS_MAX) copies[copycount++] = argv[++idx];
+		else if(!strcmp(argv[idx], "-m") && idx+1 < argc && movecount < 32) moves[movecount++] = argv[++idx];
+		else if(!strcmp(argv[idx], "-b")) benchmark = 1;
+		else if(!strcmp(argv[idx], "-t")) tapes = 1;
+		else if(!strcmp(argv[idx], "-q")) dspcheck = 1;
+		else if(!strcmp(argv[idx], "-a")) aliasing = 1;
+		else if(!strcmp(argv[idx], "-i") && idx+1 < argc) iterations = atoi(argv[++idx]);
+		else if(!strcmp(argv[idx], "-n") && idx+1 < argc) seconds = atof(argv[++idx]);
+		else if(!strcmp(argv[idx], "-k") && idx+1 < argc) g_cycleScale = atof(argv[++idx]);
+		else if(argv[idx][0] == '-' && argv[idx][1]) usage();
+		else if(!inpath) inpath = argv[idx];
+		else if(!outpath) outpath = argv[idx];
+		else usage();
+	}
+
+	if(inpath && strcmp(inpath, "-")){
+		if(wav_read(inpath, &in)) return 1;
+		if(in.samplerate != SAMPLERATE){
+			fprintf(stderr, "Warning: %s is %uHz, effects are tuned for %dHz\n", inpath, in.samplerate, SAMPLERATE);
+		}
+	}else{
+		make_test_signal(&in, seconds);
+	}
+	out.samplerate = in.samplerate;
+	out.length = in.length;
+	out.samples = (int16_t *)malloc(in.length * sizeof(int16_t));
+
+	// Default chain as setup() builds it, then any copies and moves
+	for(idx=0; g_effectTypes[idx]; idx++){
+		slots_add(idx);
+	}
+	// The arena and preset checks expect this chain and leave it as it was
+	if(dspcheck && dsp_report() + arena_report() + preset_report()) return 1;
+	for(idx=0; idx < copycount; idx++){
+		if(!slots_duplicate(find_effect(copies[idx], strlen(copies[idx])))){
+			fprintf(stderr, "Can't copy %s (chain full, no instances left or a static chain)\n", copies[idx]);
+			exit(1);
+		}
+	}
+	for(idx=0; idx < movecount; idx++){
+		move(moves[idx]);
+	}
+
+	// Work out which effects are on
+	for(currentAddr = slots_chain(); *currentAddr; currentAddr++){
+		set_state(*currentAddr, enable ? 0 : 1);
+	}
+	if(enable){
+		const char *name = enable;
+		while(*name){
+			size_t len = strcspn(name, ",");
+			set_state(find_effect(name, len), 1);
+			name += len;
+			if(*name == ',') name++;
+		}
+	}
+	for(idx=0; idx < adjustcount; idx++){
+		adjust(adjustments[idx]);
+	}
+
+	if(benchmark){
+		// Remember the chain, then time each effect on its own
+		for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+			enabled[idx] = (*currentAddr)->state;
+			set_state(*currentAddr, 0);
+		}
+		cycles = (uint32_t *)malloc(in.length * sizeof(uint32_t));
+		printf("%u samples x %d iterations, block size %d, %.2f PIC32 cycles per host tick\n", in.length, iterations, BLOCKSIZE, cycle_scale());
+		bench_report("(bypass)", bench(&in, &out, iterations));
+		baseline = profile(&in, &out, cycles);
+		printf(" bare ISR + harness %5u cycles (ISR allowed %d)\n", model_cycles(baseline, 0), ISR_OVERHEAD_CYCLES);
+		for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+			if(!enabled[idx]) continue;
+			set_state(*currentAddr, 1);
+			bench_report((*currentAddr)->name, bench(&in, &out, iterations));
+			cost = model_cycles(profile(&in, &out, cycles), baseline);
+			chaincost += cost;
+			printf(" cost %5u cycles (seed %u)\n", cost, (*currentAddr)->cost);
+			set_state(*currentAddr, 0);
+		}
+		for(idx=0, currentAddr = slots_chain(); *currentAddr; currentAddr++, idx++){
+			set_state(*currentAddr, enabled[idx]);
+		}
+		bench_report("(chain)", bench(&in, &out, iterations));
+		printf(" cost %5u of %d cycles %s\n", chaincost, CYCLE_BUDGET, chaincost > CYCLE_BUDGET ? "OVER BUDGET" : "fits");
+		free(cycles);
+	}
+
+	if(tapes){
+		tape_report(&in);
+	}
+
+	if(aliasing){
+		alias_report();
+	}
+
+	if(outpath){
+		render(&in, &out);
+		if(wav_write(outpath, &out)) return 1;
+	}
+
+	wav_free(&in);
+	wav_free(&out);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+	Waveshaper curve generator
+	Writes the Distortion effect's curves as DSP_CURVE_LEN entry tables for
+	dsp_curve(), in distshape_t order (see effect_distortion.h).
+
+	Each curve is a function of the input from -1 to 1, scaled so its
+	largest output is CURVE_PEAK. That leaves a little headroom for the
+	halfband filter's overshoot after the shaper.
+
+	Usage: curvegen [-o out.inc]
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "dsp_fixed.h"
+#include "effect_distortion.h"
+
+#define CURVE_PEAK 30000.0
+#define FUZZ_BIAS 0.15 // Offsets the fuzz curve so it clips one side first
+
+// tanh() soft clipping
+static double curve_soft(double x){
+	return tanh(3 * x);
+}
+
+// Flat topped at half scale
+static double curve_hard(double x){
+	x *= 2;
+	return x > 1 ? 1 : (x < -1 ? -1 : x);
+}
+
+// Soft on the way up, hard and lower on the way down. Same slope through
+// the middle so quiet signals are clean. Even harmonics
+static double curve_asym(double x){
+	if(x >= 0) return tanh(3 * x);
+	x *= 5;
+	return (x < -1 ? -1 : x) * 0.6;
+}
+
+// Steep exponential clipping, biased so the two halves clip differently
+static double curve_fuzz_raw(double x){
+	x += FUZZ_BIAS;
+	return (x >= 0 ? 1 : -1) * (1 - exp(-6 * fabs(x)));
+}
+
+static double curve_fuzz(double x){
+	return curve_fuzz_raw(x) - curve_fuzz_raw(0);
+}
+
+typedef double (*Curve_t)(double);
+
+static const Curve_t g_curves[DIST_SHAPES] = {curve_soft, curve_hard, curve_asym, curve_fuzz};
+static const char *g_names[DIST_SHAPES] = {"Soft", "Hard", "Asym", "Fuzz"};
+
+int main(int argc, char *argv[]){
+	FILE *out = stdout;
+	double value, peak;
+	int shape, idx;
+
+	if(argc == 3 && !strcmp(argv[1], "-o")){
+		out = fopen(argv[2], "w");
+		if(!out){
+			perror(argv[2]);
+			return 1;
+		}
+	}else if(argc != 1){
+		fprintf(stderr, "Usage: curvegen [-o out.inc]\n");
+		return 1;
+	}
+
+	fprintf(out, "// Generated by curvegen in Source/HostSim. Don't edit.\n");
+	fprintf(out, "// Distortion waveshaper curves for dsp_curve(), in distshape_t order\n");
+	for(shape=0; shape < DIST_SHAPES; shape++){
+		// Entry idx is the output for an input of idx * 256 - 32768
+		peak = 0;
+		for(idx=0; idx < DSP_CURVE_LEN; idx++){
+			value = fabs(g_curves[shape]((idx - (DSP_CURVE_LEN - 1) / 2.0) / ((DSP_CURVE_LEN - 1) / 2.0)));
+			if(value > peak) peak = value;
+		}
+		fprintf(out, "\t// %s\n\t{", g_names[shape]);
+		for(idx=0; idx < DSP_CURVE_LEN; idx++){
+			value = g_curves[shape]((idx - (DSP_CURVE_LEN - 1) / 2.0) / ((DSP_CURVE_LEN - 1) / 2.0));
+			if(idx % 16 == 0) fprintf(out, "\n\t\t");
+			fprintf(out, "%6d,", (int)lround(value / peak * CURVE_PEAK));
+		}
+		fprintf(out, "\n\t},\n");
+	}
+	if(out != stdout) fclose(out);
+	return 0;
+}
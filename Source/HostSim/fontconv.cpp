@@ -0,0 +1,292 @@
+/*
+	Font converter
+	Cuts the TheDotFactory fonts down to what the firmware prints and adds
+	copies pre-shifted for the y positions the UI draws text at.
+
+	Glyph bitmaps are strips of column bytes, 8 rows to a strip, bit 0 at the
+	top. That is already the SH1106 page layout, so text drawn at a y that is
+	a multiple of 8 goes straight into the page buffer. A copy shifted down by
+	y & 7 lets transparent text drawn at that y do the same. See drawChar().
+
+	Glyphs that no string or character literal in the sources uses are
+	dropped (width 0) and the character range trimmed to what is left.
+	Digits, space, minus and point are always kept for print(number).
+
+	Usage: fontconv [-o out.inc] -f Font[:y,y...] [-f ...] source...
+		-o file       Write the fonts here (default stdout)
+		-f Font:y,y   Convert Font, adding a copy for each y & 7 that isn't 0
+	The flash footprint of each font is reported on stderr.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TheDotFactory.h"
+#include "LiberationSans10.c"
+#include "LiberationMono11.c"
+#include "DejaVuSans12.c"
+
+#define MAX_FONTS 4
+#define MAX_BITMAP 8192
+
+typedef struct {
+	const char *name; // As given to -f
+	const char *symbol; // Prefix of the C names
+	const FONT_INFO *font;
+} KnownFont_t;
+
+static const KnownFont_t g_known[] = {
+		{ "LiberationSans10", "liberationSans_10pt", &liberationSans_10ptFontInfo }
+	, { "LiberationMono11", "liberationMono_11pt", &liberationMono_11ptFontInfo }
+	, { "DejaVuSans12", "dejaVuSans_12pt", &dejaVuSans_12ptFontInfo }
+};
+
+typedef struct {
+	const KnownFont_t *known;
+	uint8_t shifts; // Bit n set when a copy shifted by n is wanted
+} Request_t;
+
+static uint8_t g_used[256]; // Characters the sources print
+
+//******** Source scanning ********//
+
+// Marks the characters of every string and character literal in path
+// Comments are skipped so apostrophes in them don't start a literal
+static int scanSource(const char *path){
+	FILE *fp = fopen(path, "r");
+	int c, prev = 0;
+	char quote = 0;
+	if(!fp){
+		fprintf(stderr, "fontconv: can't read %s\n", path);
+		return 0;
+	}
+	while((c = fgetc(fp)) != EOF){
+		if(quote){
+			if(c == '\\'){
+				// Escapes like \n aren't glyphs. An escaped quote or backslash is
+				c = fgetc(fp);
+				if(c == '"' || c == '\'' || c == '\\') g_used[c] = 1;
+			}else if(c == quote){
+				quote = 0;
+			}else{
+				g_used[(uint8_t)c] = 1;
+			}
+		}else if(c == '/' && prev == '/'){
+			while((c = fgetc(fp)) != EOF && c != '\n');
+			c = 0;
+		}else if(c == '*' && prev == '/'){
+			prev = 0;
+			while((c = fgetc(fp)) != EOF && !(c == '/' && prev == '*')) prev = c;
+			c = 0;
+		}else if(c == '"' || c == '\''){
+			quote = (char)c;
+		}
+		prev = c;
+	}
+	fclose(fp);
+	return 1;
+}
+
+//******** Conversion ********//
+
+// Writes a bitmap array as TheDotFactory does, one strip of a glyph per line
+static void writeBitmap(FILE *out, const char *name, const uint8_t *bitmap, const uint16_t *offsets,
+		const uint8_t *widths, uint8_t first, uint8_t last, uint8_t strips, uint16_t size){
+	uint8_t c, strip, col;
+	const uint8_t *ptr;
+	fprintf(out, "static const unsigned char %s[] = \n{\n", name);
+	for(c = first; c <= last; c++){
+		if(!widths[c]) continue;
+		fprintf(out, "\t// @%u '%c' (%u pixels wide)\n", offsets[c], c, widths[c]);
+		ptr = bitmap + offsets[c];
+		for(strip = 0; strip < strips; strip++){
+			fprintf(out, "\t");
+			for(col = 0; col < widths[c]; col++){
+				fprintf(out, "0x%02x, ", *ptr++);
+			}
+			fprintf(out, "\n");
+		}
+	}
+	if(!size) fprintf(out, "\t0\n"); // No empty arrays
+	fprintf(out, "};\n\n");
+}
+
+// Converts one font into out. Returns its flash footprint in bytes
+static uint32_t convertFont(FILE *out, const Request_t *req){
+	const FONT_INFO *font = req->known->font;
+	const char *sym = req->known->symbol;
+	uint8_t widths[256], shift, first = 255, last = 0, strips, shifted, strip, col;
+	uint16_t offsets[256], copyoffsets[256], size = 0, shiftedsize;
+	uint32_t column, flash, original, copies = 0;
+	static uint8_t bitmap[MAX_BITMAP], copy[MAX_BITMAP];
+	const FONT_CHAR_INFO *info;
+	const uint8_t *src;
+	unsigned c, count = 0, total = 0;
+	uint8_t *dst;
+	char name[64];
+
+	strips = (font->CharacterHeight + 7) / 8;
+	memset(widths, 0, sizeof(widths));
+	memset(offsets, 0, sizeof(offsets));
+	original = 0;
+
+	// Keep the glyphs that are used, packed in order
+	for(c = (uint8_t)font->StartCharacter; c <= (uint8_t)font->EndCharacter; c++){
+		info = &font->Descriptors[c - (uint8_t)font->StartCharacter];
+		original += info->Charwidth * strips + sizeof(FONT_CHAR_INFO);
+		total++;
+		if(!g_used[c] || !info->Charwidth) continue;
+		if(size + info->Charwidth * strips > MAX_BITMAP){
+			fprintf(stderr, "fontconv: %s is too big\n", req->known->name);
+			exit(1);
+		}
+		widths[c] = info->Charwidth;
+		offsets[c] = size;
+		memcpy(&bitmap[size], font->Bitmaps + info->Offset, info->Charwidth * strips);
+		size += info->Charwidth * strips;
+		if(c < first) first = (uint8_t)c;
+		if(c > last) last = (uint8_t)c;
+		count++;
+	}
+	if(!count){
+		fprintf(stderr, "fontconv: nothing uses %s\n", req->known->name);
+		exit(1);
+	}
+
+	fprintf(out, "// %s : %u of %u glyphs, '%c' to '%c'\n", font->FontName, count, total, first, last);
+	snprintf(name, sizeof(name), "%sBitmaps", sym);
+	writeBitmap(out, name, bitmap, offsets, widths, first, last, strips, size);
+	flash = size;
+
+	// Pre-shifted copies. Same glyphs, one more strip if the shift pushes the
+	// bottom row over a page boundary
+	for(shift = 1; shift < 8; shift++){
+		if(!(req->shifts & (1 << shift))) continue;
+		shifted = (font->CharacterHeight + shift + 7) / 8;
+		shiftedsize = 0;
+		for(c = first; c <= last; c++){
+			if(!widths[c]) continue;
+			src = &bitmap[offsets[c]];
+			dst = &copy[(offsets[c] / strips) * shifted];
+			for(col = 0; col < widths[c]; col++){
+				column = 0;
+				for(strip = 0; strip < strips; strip++){
+					column |= (uint32_t)src[strip * widths[c] + col] << (strip * 8);
+				}
+				column <<= shift;
+				for(strip = 0; strip < shifted; strip++){
+					dst[strip * widths[c] + col] = (uint8_t)(column >> (strip * 8));
+				}
+			}
+			shiftedsize += widths[c] * shifted;
+		}
+		// Offsets in the copy are the same column index times its strips
+		for(c = first; c <= last; c++) copyoffsets[c] = (offsets[c] / strips) * shifted;
+		snprintf(name, sizeof(name), "%sBitmaps_%u", sym, shift);
+		writeBitmap(out, name, copy, copyoffsets, widths, first, last, shifted, shiftedsize);
+		copies += shiftedsize;
+	}
+	flash += copies;
+
+	fprintf(out, "const FONT_CHAR_INFO %sDescriptors[] = \n{\n", sym);
+	for(c = first; c <= last; c++){
+		// A backslash ending a comment would continue it onto the next line
+		if(c == '\\') fprintf(out, "\t{%u, %u}, \t\t// backslash\n", widths[c], offsets[c]);
+		else fprintf(out, "\t{%u, %u}, \t\t// %c \n", widths[c], offsets[c], c);
+	}
+	fprintf(out, "};\n\n");
+	flash += (last - first + 1) * sizeof(FONT_CHAR_INFO);
+
+	if(req->shifts){
+		fprintf(out, "static const FONT_SHIFTED %sShifted[] = \n{\n", sym);
+		for(shift = 1; shift < 8; shift++){
+			if(req->shifts & (1 << shift)) fprintf(out, "\t{%u, %sBitmaps_%u},\n", shift, sym, shift);
+		}
+		fprintf(out, "};\n\n");
+		flash += __builtin_popcount(req->shifts) * sizeof(FONT_SHIFTED);
+	}
+
+	fprintf(out, "const FONT_INFO %sFontInfo =\n{\n", sym);
+	fprintf(out, "\t%u, //  Character height\n", font->CharacterHeight);
+	fprintf(out, "\t%u, //  Start character\n", first);
+	fprintf(out, "\t%u, //  End character\n", last);
+	fprintf(out, "\t\"%s\", // Name of font\n", font->FontName);
+	fprintf(out, "\t%sDescriptors, //  Character descriptor array\n", sym);
+	fprintf(out, "\t%sBitmaps, //  Character bitmap array\n", sym);
+	if(req->shifts){
+		fprintf(out, "\t%u, // Pre-shifted copies\n", __builtin_popcount(req->shifts));
+		fprintf(out, "\t%sShifted,\n", sym);
+	}
+	fprintf(out, "};\n\n");
+	flash += sizeof(FONT_INFO);
+	original += sizeof(FONT_INFO);
+
+	fprintf(stderr, "%-18s %3u/%-3u glyphs %6u bytes (was %u)", req->known->name, count, total, flash, original);
+	if(copies) fprintf(stderr, ", %u of it pre-shifted copies", copies);
+	fprintf(stderr, "\n");
+	return flash;
+}
+
+static void usage(){
+	fprintf(stderr, "Usage: fontconv [-o out.inc] -f Font[:y,y...] [-f ...] source...\n");
+	fprintf(stderr, "Fonts:");
+	for(unsigned idx = 0; idx < sizeof(g_known) / sizeof(g_known[0]); idx++){
+		fprintf(stderr, " %s", g_known[idx].name);
+	}
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]){
+	Request_t requests[MAX_FONTS];
+	uint8_t count = 0, sources = 0;
+	const char *outpath = NULL;
+	uint32_t flash = 0;
+	unsigned idx, known;
+	size_t len;
+	char *ys;
+	FILE *out = stdout;
+
+	for(idx = 1; idx < (unsigned)argc; idx++){
+		if(!strcmp(argv[idx], "-o") && idx+1 < (unsigned)argc) outpath = argv[++idx];
+		else if(!strcmp(argv[idx], "-f") && idx+1 < (unsigned)argc && count < MAX_FONTS){
+			ys = strchr(argv[++idx], ':');
+			len = ys ? (size_t)(ys - argv[idx]) : strlen(argv[idx]);
+			for(known = 0; known < sizeof(g_known) / sizeof(g_known[0]); known++){
+				if(strlen(g_known[known].name) == len && !strncmp(g_known[known].name, argv[idx], len)) break;
+			}
+			if(known == sizeof(g_known) / sizeof(g_known[0])) usage();
+			requests[count].known = &g_known[known];
+			requests[count].shifts = 0;
+			while(ys && *ys){
+				requests[count].shifts |= 1 << (atoi(ys + 1) & 7);
+				ys = strchr(ys + 1, ',');
+			}
+			requests[count].shifts &= ~1; // y & 7 == 0 is the font itself
+			count++;
+		}
+		else if(argv[idx][0] == '-') usage();
+		else if(scanSource(argv[idx])) sources++;
+		else return 1;
+	}
+	if(!count || !sources) usage();
+
+	// print(number) can produce any of these
+	for(idx = '0'; idx <= '9'; idx++) g_used[idx] = 1;
+	g_used[(uint8_t)' '] = 1;
+	g_used[(uint8_t)'-'] = 1;
+	g_used[(uint8_t)'.'] = 1;
+
+	if(outpath && !(out = fopen(outpath, "w"))){
+		fprintf(stderr, "fontconv: can't write %s\n", outpath);
+		return 1;
+	}
+	fprintf(out, "// Generated by fontconv in Source/HostSim from the TheDotFactory fonts.\n");
+	fprintf(out, "// Don't edit. Run make there after changing any text the firmware prints.\n\n");
+	fprintf(out, "#include \"TheDotFactory.h\"\n\n");
+	for(idx = 0; idx < count; idx++){
+		flash += convertFont(out, &requests[idx]);
+	}
+	fprintf(stderr, "Fonts total %u bytes of flash\n", flash);
+	if(outpath) fclose(out);
+	return 0;
+}
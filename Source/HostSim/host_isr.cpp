@@ -0,0 +1,49 @@
+/*
+	Compiles the firmware's isr.pde for the host
+	The Arduino IDE concatenates the .pde files into one translation unit,
+	so isr.pde has no includes of its own. Provide what ChipStomp.pde would.
+*/
+#include <PLIB.h>
+#include <Catmacey_SH1106.h>
+#include "config.h"
+#include "input_queue.h"
+#include "Effect_typeDefs.h"
+#include "effect_bypass.h"
+#include "dsp_fixed.h"
+#include "effect_tremolo.h"
+#include "effect_flanger.h"
+#include "effect_echo.h"
+#include "effect_bitcrush.h"
+#include "effect_pitchshift.h"
+#include "effect_distortion.h"
+#include "effect_filter.h"
+#include "effect_compressor.h"
+#include "effect_reverb.h"
+#include "effect_chorus.h"
+#include "effect_slots.h"
+
+extern InputQueue_t g_input;
+extern volatile VUMeter_t g_meter;
+extern volatile uint32_t g_chainMask;
+extern Catmacey_SH1106 display;
+#if STATIC_CHAIN
+// Must match the default chain ChipStomp.pde builds
+#include "effect_chain.h"
+typedef ChainStage<tremolo_process, 0,
+	ChainStage<flng_process, 1,
+	ChainStage<pitch_process, 2,
+	ChainStage<bitcrush_process, 3,
+	ChainStage<echo_process, 4,
+	ChainStage<dist_process, 5,
+	ChainStage<filt_process, 6,
+	ChainStage<comp_process, 7,
+	ChainStage<revb_process, 8,
+	ChainStage<chor_process, 9> > > > > > > > > > StaticChain_t;
+#endif
+#if BLOCKSIZE > 1
+extern volatile int32_t g_adc_block[2 * BLOCKSIZE];
+extern volatile uint8_t g_dac_hi[2 * BLOCKSIZE];
+extern volatile uint8_t g_dac_lo[2 * BLOCKSIZE];
+#endif
+
+#include "isr.pde"
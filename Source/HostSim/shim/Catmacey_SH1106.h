@@ -0,0 +1,35 @@
+/*
+	Host shim for the SH1106 OLED driver
+	The effects only draw their report() into the display buffer, so on the
+	host every drawing call is swallowed.
+*/
+#ifndef Catmacey_SH1106_h
+#define Catmacey_SH1106_h
+
+#include "WProgram.h"
+
+#define BLACK 0
+#define WHITE 1
+#define GREY 2
+#define SPARE 3
+#define GHOST 4
+
+class Catmacey_SH1106 : public Print {
+ public:
+	void clearDisplay(void) {}
+	void display() {}
+	boolean displayAsync() { return true; }
+	boolean isFlushing(void) const { return false; }
+	void dmaInterrupt(void) {}
+	void drawPixel(int16_t, int16_t, uint16_t) {}
+	void drawFastVLine(int16_t, int16_t, int16_t, uint16_t) {}
+	void drawFastHLine(int16_t, int16_t, int16_t, uint16_t) {}
+	void drawRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+	void fillRect(int16_t, int16_t, int16_t, int16_t, uint16_t) {}
+	void setCursor(int16_t, int16_t) {}
+	void setTextColor(uint16_t) {}
+	void setTextColor(uint16_t, uint16_t) {}
+	uint8_t setFont(uint8_t idx) { return idx; }
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+	Host shim for the Microchip peripheral library
+	Peripheral registers are plain variables so that isr.pde can be compiled
+	as is. The ADC result is fed from host_adc and the two PWM duty cycles
+	land in host_oc4/host_oc2 where the renderer reassembles the 16bit output.
+*/
+#ifndef __HostShim_PLIB__
+#define __HostShim_PLIB__
+
+#include <stdint.h>
+#include <string.h>
+
+#define BIT_0  (1 << 0)
+#define BIT_1  (1 << 1)
+#define BIT_2  (1 << 2)
+#define BIT_3  (1 << 3)
+#define BIT_4  (1 << 4)
+#define BIT_5  (1 << 5)
+#define BIT_7  (1 << 7)
+#define BIT_8  (1 << 8)
+#define BIT_9  (1 << 9)
+#define BIT_14 (1 << 14)
+#define BIT_15 (1 << 15)
+
+// Interrupt declarations compile away
+#define __ISR(vector, ipl)
+#define _TIMER_1_VECTOR 4
+#define _CHANGE_NOTICE_VECTOR 34
+#define _CN_IPL_ISR ipl2
+#define _CN_IPL_IPC 2
+
+// Fake peripheral state
+extern volatile uint32_t PORTA;
+extern volatile uint32_t PORTB;
+extern volatile int32_t host_adc;
+extern volatile uint8_t host_oc4;
+extern volatile uint8_t host_oc2;
+
+// Core timer runs at half SYSCLK. On the host it follows wall clock time
+uint32_t host_cp0_count();
+#define _CP0_GET_COUNT() host_cp0_count()
+
+#define mT1ClearIntFlag()
+#define mAD1GetIntFlag() (1)
+#define mAD1ClearIntFlag()
+#define mCNBClearIntFlag()
+#define ReadADC10(buf) (host_adc)
+
+#define mPORTASetBits(bits) (PORTA |= (bits))
+#define mPORTAClearBits(bits) (PORTA &= ~(bits))
+#define mPORTAToggleBits(bits) (PORTA ^= (bits))
+#define mPORTBToggleBits(bits) (PORTB ^= (bits))
+
+// DMA just reports which half of the ping-pong buffer the host filled
+#define DMA_CHANNEL0 0
+#define DMA_EV_DST_HALF_FULL 0x40
+#define DMA_EV_DST_FULL 0x20
+#define DMA_EV_ALL_EVNTS 0xff
+#define INT_SOURCE_DMA(chn) (chn)
+extern volatile uint32_t host_dma_flags;
+#define DmaChnGetEvFlags(chn) (host_dma_flags)
+#define DmaChnClrEvFlags(chn, flags) (host_dma_flags &= ~(flags))
+#define INTClearFlag(src)
+
+// Program flash pages are plain RAM on the host (see PRESET_FLASH_CONST in
+// the Makefile). Like real flash, erasing sets every bit and a write can
+// only clear them. 0 = success
+#define HOST_NVM_PAGE_SIZE 1024
+extern void *host_nvm_page; // Last page erased, so the host can damage a save
+inline unsigned int NVMErasePage(void *address){
+	host_nvm_page = address;
+	memset(address, 0xff, HOST_NVM_PAGE_SIZE);
+	return 0;
+}
+inline unsigned int NVMWriteWord(void *address, unsigned int data){
+	*(volatile uint32_t *)address &= data;
+	return 0;
+}
+
+#define SetDCOC4PWM(dc) (host_oc4 = (uint8_t)(dc))
+#define SetDCOC2PWM(dc) (host_oc2 = (uint8_t)(dc))
+
+#endif
@@ -0,0 +1,46 @@
+/*
+	Host shim for the chipKIT core header
+	Only provides what the effects and isr.pde actually touch so they can
+	be compiled unmodified with a desktop compiler.
+*/
+#ifndef __HostShim_WProgram__
+#define __HostShim_WProgram__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef bool boolean;
+
+#define DEC 10
+#define HEX 16
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+
+#ifndef F_CPU
+#define F_CPU 40000000UL
+#endif
+
+// Text output sink. Drawing and printing are no-ops on the host.
+class Print {
+ public:
+	virtual void write(uint8_t) {}
+	void print(const char *) {}
+	void print(char) {}
+	void print(int, int = DEC) {}
+	void print(unsigned int, int = DEC) {}
+	void print(long, int = DEC) {}
+	void print(unsigned long, int = DEC) {}
+	void print(double, int = 2) {}
+	void println(const char *) {}
+	void println() {}
+};
+
+void delay(unsigned long ms);
+unsigned long millis();
+unsigned long micros();
+
+#endif
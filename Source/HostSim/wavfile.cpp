@@ -0,0 +1,127 @@
+/*
+	Minimal WAV reader/writer for the host renderer
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wavfile.h"
+
+static uint32_t rd32(const uint8_t *p){
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t rd16(const uint8_t *p){
+	return p[0] | (p[1] << 8);
+}
+
+static void wr32(uint8_t *p, uint32_t v){
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void wr16(uint8_t *p, uint16_t v){
+	p[0] = v; p[1] = v >> 8;
+}
+
+int wav_read(const char *path, WavData_t *wav){
+	uint8_t hdr[12], chunk[8], fmt[16];
+	uint16_t channels = 0, bits = 0, format = 0;
+	uint32_t size, idx;
+	int16_t *raw;
+	int havefmt = 0;
+	FILE *fp = fopen(path, "rb");
+
+	memset(wav, 0, sizeof(*wav));
+	if(!fp){
+		fprintf(stderr, "%s: can't open\n", path);
+		return -1;
+	}
+	if(fread(hdr, 1, 12, fp) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr+8, "WAVE", 4)){
+		fprintf(stderr, "%s: not a RIFF/WAVE file\n", path);
+		fclose(fp);
+		return -1;
+	}
+	// Walk the chunks until we find the data
+	while(fread(chunk, 1, 8, fp) == 8){
+		size = rd32(chunk+4);
+		if(!memcmp(chunk, "fmt ", 4)){
+			if(size < 16 || fread(fmt, 1, 16, fp) != 16) break;
+			format = rd16(fmt);
+			channels = rd16(fmt+2);
+			wav->samplerate = rd32(fmt+4);
+			bits = rd16(fmt+14);
+			fseek(fp, (size - 16) + (size & 1), SEEK_CUR);
+			havefmt = 1;
+		}else if(!memcmp(chunk, "data", 4)){
+			if(!havefmt || format != 1 || bits != 16 || channels < 1 || channels > 2){
+				fprintf(stderr, "%s: only 16bit PCM mono/stereo is supported\n", path);
+				fclose(fp);
+				return -1;
+			}
+			wav->length = size / (2 * channels);
+			raw = (int16_t *)malloc(wav->length * channels * sizeof(int16_t));
+			wav->samples = (int16_t *)malloc(wav->length * sizeof(int16_t));
+			if(!raw || !wav->samples){
+				free(raw);
+				fclose(fp);
+				wav_free(wav);
+				return -1;
+			}
+			wav->length = fread(raw, 2 * channels, wav->length, fp);
+			for(idx=0; idx < wav->length; idx++){
+				// Input is little endian
+				if(channels == 1){
+					wav->samples[idx] = (int16_t)rd16((uint8_t *)&raw[idx]);
+				}else{
+					wav->samples[idx] = (int16_t)(((int16_t)rd16((uint8_t *)&raw[idx*2])
+						+ (int16_t)rd16((uint8_t *)&raw[idx*2+1])) / 2);
+				}
+			}
+			free(raw);
+			fclose(fp);
+			return 0;
+		}else{
+			fseek(fp, size + (size & 1), SEEK_CUR);
+		}
+	}
+	fprintf(stderr, "%s: no data chunk\n", path);
+	fclose(fp);
+	return -1;
+}
+
+int wav_write(const char *path, const WavData_t *wav){
+	uint8_t hdr[44];
+	uint8_t sample[2];
+	uint32_t idx;
+	uint32_t datasize = wav->length * 2;
+	FILE *fp = fopen(path, "wb");
+
+	if(!fp){
+		fprintf(stderr, "%s: can't create\n", path);
+		return -1;
+	}
+	memcpy(hdr, "RIFF", 4);
+	wr32(hdr+4, 36 + datasize);
+	memcpy(hdr+8, "WAVEfmt ", 8);
+	wr32(hdr+16, 16);
+	wr16(hdr+20, 1); // PCM
+	wr16(hdr+22, 1); // Mono
+	wr32(hdr+24, wav->samplerate);
+	wr32(hdr+28, wav->samplerate * 2);
+	wr16(hdr+32, 2);
+	wr16(hdr+34, 16);
+	memcpy(hdr+36, "data", 4);
+	wr32(hdr+40, datasize);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	for(idx=0; idx < wav->length; idx++){
+		wr16(sample, (uint16_t)wav->samples[idx]);
+		fwrite(sample, 1, 2, fp);
+	}
+	fclose(fp);
+	return 0;
+}
+
+void wav_free(WavData_t *wav){
+	free(wav->samples);
+	wav->samples = NULL;
+	wav->length = 0;
+}
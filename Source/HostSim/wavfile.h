@@ -0,0 +1,22 @@
+/*
+	Minimal WAV reader/writer for the host renderer
+	Only 16bit PCM is supported. Stereo input is folded down to mono as the
+	pedal only has a single input.
+*/
+#ifndef __HostSim_WavFile__
+#define __HostSim_WavFile__
+
+#include <stdint.h>
+
+typedef struct {
+	uint32_t samplerate;
+	uint32_t length; // Number of mono samples
+	int16_t *samples;
+} WavData_t;
+
+// Returns 0 on success. On failure a message is written to stderr.
+int wav_read(const char *path, WavData_t *wav);
+int wav_write(const char *path, const WavData_t *wav);
+void wav_free(WavData_t *wav);
+
+#endif
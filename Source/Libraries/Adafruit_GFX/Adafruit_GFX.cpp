@@ -438,7 +438,8 @@ void Adafruit_GFX::write(uint8_t c) {
 uint8_t Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg) {
   const FONT_CHAR_INFO *CharInfo;
   const uint8_t *ColPtr;
-  uint8_t CharIndex, row, col, MyCharWidth, MyCharHeight, yoffset, dots, strip, rows_in_byte, StripsPerColumn = 0;
+  const FONT_SHIFTED *Shifted;
+  uint8_t CharIndex, MyCharWidth, MyCharHeight, yoffset, strip, rows_in_byte, StripsPerColumn = 0;
 
   if ((c < currentFont->StartCharacter) || (c > currentFont->EndCharacter)){
     return 0;
@@ -454,6 +455,22 @@ uint8_t Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t c
   MyCharWidth = CharInfo->Charwidth; //Store Char width (variable)
   MyCharHeight = currentFont->CharacterHeight;
   StripsPerColumn = (MyCharHeight + 8 - 1) / 8; // Fast ceiling()
+
+  // Transparent text can use a copy of the font already shifted down by y & 7.
+  // Its strips then start on a page boundary. Opaque text would paint the
+  // extra rows above and below the glyph so it keeps the original.
+  if((y & 7) && bg == color && rotation == 0){
+    for(Shifted = currentFont->Shifted; Shifted < currentFont->Shifted + currentFont->ShiftedCount; Shifted++){
+      if(Shifted->Shift == (y & 7)){
+        // Glyphs are the same widths in the same order, only taller
+        ColPtr = Shifted->Bitmaps + (CharInfo->Offset / StripsPerColumn) * ((MyCharHeight + Shifted->Shift + 7) / 8);
+        MyCharHeight += Shifted->Shift;
+        StripsPerColumn = (MyCharHeight + 8 - 1) / 8;
+        y -= Shifted->Shift;
+        break;
+      }
+    }
+  }
   /*
   Serial.print("drawChar:\"");
   Serial.print(c);
@@ -480,31 +497,35 @@ uint8_t Adafruit_GFX::drawChar(int16_t x, int16_t y, unsigned char c, uint16_t c
     if(rows_in_byte > 8){
       rows_in_byte = 8;
     }
-    for(col=0; col<MyCharWidth; col++){
-      dots = *(ColPtr++);
-      for(row=0; row<rows_in_byte; row++){
-        if(dots & 0x01){
-          drawPixel(x+col, y+yoffset+row, color);
-          //Serial.print("#");
-        }else if (bg != color) {
-          drawPixel(x+col, y+yoffset+row, bg);
-          //Serial.print(" ");
-        }
-        //Serial.print(" col:");
-        //Serial.print(col, DEC);
-        //Serial.print(", row:");
-        //Serial.print(row, DEC);
-        //Serial.println();
-        // Shift the dots
-        dots >>= 1;
-      }
-    }
+    drawColumnBytes(x, y+yoffset, ColPtr, MyCharWidth, rows_in_byte, color, bg);
+    ColPtr += MyCharWidth;
     yoffset += 8;
   }
 
   return MyCharWidth + 2;
 } 
 
+// Draws w columns of h (up to 8) rows. One byte per column, bit 0 at the top.
+// Same as a strip of a TheDotFactory "columnMajor" bitmap.
+// Clear bits are drawn in bg unless bg == color (transparent)
+void Adafruit_GFX::drawColumnBytes(int16_t x, int16_t y, const uint8_t *cols,
+        uint8_t w, uint8_t h, uint16_t color, uint16_t bg) {
+  uint8_t row, col, dots;
+
+  for(col=0; col<w; col++){
+    dots = pgm_read_byte(cols++);
+    for(row=0; row<h; row++){
+      if(dots & 0x01){
+        drawPixel(x+col, y+row, color);
+      }else if (bg != color) {
+        drawPixel(x+col, y+row, bg);
+      }
+      // Shift the dots
+      dots >>= 1;
+    }
+  }
+}
+
 
 void Adafruit_GFX::setCursor(int16_t x, int16_t y) {
   cursor_x = x;
@@ -31,6 +31,8 @@ class Adafruit_GFX : public Print {
     drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color),
     fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color),
     fillScreen(uint16_t color),
+    drawColumnBytes(int16_t x, int16_t y, const uint8_t *cols, uint8_t w,
+      uint8_t h, uint16_t color, uint16_t bg),
     invertDisplay(boolean i);
 
   // These exist only with Adafruit_GFX (no subclass overrides)
@@ -15,6 +15,13 @@ typedef struct _font_char_info{
    uint16_t Offset;
 }FONT_CHAR_INFO;
 ////////////////////////////////////////////////////////////////////////////////
+// Copy of the bitmaps shifted down by Shift rows, made by fontconv in
+// Source/HostSim. Each glyph has (CharacterHeight + Shift + 7) / 8 strips.
+typedef struct _font_shifted{
+   uint8_t Shift;
+   const uint8_t *Bitmaps;
+}FONT_SHIFTED;
+////////////////////////////////////////////////////////////////////////////////
 typedef struct _font_info{
    uint8_t CharacterHeight;
    char StartCharacter;
@@ -22,6 +29,8 @@ typedef struct _font_info{
    const char *FontName;
    const FONT_CHAR_INFO *Descriptors;
    const uint8_t *Bitmaps;
+   uint8_t ShiftedCount; // Optional. TheDotFactory output leaves these 0
+   const FONT_SHIFTED *Shifted;
 }FONT_INFO;
 //////////////////////////////////////////////////////////////////////////////// 
 #endif
\ No newline at end of file
@@ -16,12 +16,64 @@ The SSD1306 and SH1106 are very similar but have a few important differences.
 Written to be compatible with the Adafruit_GFX library.
 *********************************************************************/
 
+#include <PLIB.h> // DMA and interrupts for displayAsync()
 #include "Adafruit_GFX.h"
 #include "Catmacey_SH1106.h"
 
+// SPI status bits
+#define SPISTAT_RBF  (1 << 0)
+#define SPISTAT_ROV  (1 << 6)
+#define SPISTAT_BUSY (1 << 11)
+
 // the memory buffer for the LCD
 static uint8_t buffer[SH1106_LCDHEIGHT * SH1106_LCDWIDTH / 8] = {};
 
+// Span of columns on each page drawn into since the last display()
+// A page is clean when first > last
+static uint8_t dirty_first[SH1106_PAGES];
+static uint8_t dirty_last[SH1106_PAGES];
+
+// Running count of bytes clocked out to the display. Wraps
+static uint32_t bytes_sent = 0;
+
+// Asynchronous flush : See displayAsync()
+// Each dirty page goes as two DMA blocks, the address commands then the data.
+// dmaInterrupt() moves DC and CS between them.
+typedef struct {
+	uint8_t cmd[4]; // Address commands
+	uint8_t cmdlen;
+	uint8_t datalen;
+	uint8_t *data; // Span in front[]
+} FlushPage_t;
+
+// Copy of the spans being sent, so drawing into buffer can carry on
+static uint8_t front[SH1106_LCDHEIGHT * SH1106_LCDWIDTH / 8];
+static FlushPage_t flush_pages[SH1106_PAGES];
+static uint8_t flush_count; // Pages in this flush
+static uint8_t flush_idx; // Page being sent
+static uint8_t flush_data; // 0 = sending the commands, 1 = the data
+static volatile boolean flushing = false;
+
+// Widen a page's dirty span to cover columns first to last
+static inline void markDirty(uint8_t page, uint8_t first, uint8_t last) {
+	if(first < dirty_first[page]) dirty_first[page] = first;
+	if(last > dirty_last[page]) dirty_last[page] = last;
+}
+
+// Fills cmd with the commands to address column col of page
+// The first page of a frame also resets the start line
+static uint8_t pageCommands(uint8_t *cmd, uint8_t page, uint8_t col, boolean first) {
+	uint8_t len = 0;
+	uint8_t ramcol = col + SH1106_COLUMNOFFSET;
+	if(first) cmd[len++] = SH1106_SETSTARTLINE;
+	// Autoincrement of column does not move onto next page
+	// so each page has its own address
+	cmd[len++] = SH1106_PAGEADDR + page; // Set page addr
+	cmd[len++] = ramcol & 0x0f; // Lower col addr
+	cmd[len++] = SH1106_SETHIGHCOLUMN | (ramcol >> 4); // Upper col addr
+	return len;
+}
+
 // the most basic function, set a single pixel
 void Catmacey_SH1106::drawPixel(int16_t x, int16_t y, uint16_t color) {
 	if ((x < 0) || (x >= width()) || (y < 0) || (y >= height()))
@@ -43,6 +95,8 @@ void Catmacey_SH1106::drawPixel(int16_t x, int16_t y, uint16_t color) {
 		break;
 	}  
 
+	markDirty(y/8, x, x);
+
 	// x is which column
 	if (color == WHITE) 
 		buffer[x+ (y/8)*SH1106_LCDWIDTH] |= (1 << (y&7));  
@@ -67,6 +121,9 @@ Catmacey_SH1106::Catmacey_SH1106(
 	rst = RST;
 	cs = CS;
 	spi = SPI;  // This is the SPI Object provided by the DSPI Library
+	spiregs = NULL;
+	// Whatever is in the display RAM at power up has to be overwritten
+	invalidate();
 }
 
 void Catmacey_SH1106::begin() {
@@ -148,50 +205,247 @@ void Catmacey_SH1106::setContrast(uint8_t contrast) {
 }
 
 void Catmacey_SH1106::sh1106_command(uint8_t c) { 
+	while(flushing); // Can't share the bus with the DMA
 	// SPI
 	*csport |= cspinmask;
 	*dcport &= ~dcpinmask;
 	*csport &= ~cspinmask;
 	(void)spi->transfer(c);
 	*csport |= cspinmask;
+	bytes_sent++;
 }
 
 void Catmacey_SH1106::sh1106_data(uint8_t c) {
+	while(flushing); // Can't share the bus with the DMA
 	// SPI
 	*csport |= cspinmask;
 	*dcport |= dcpinmask;
 	*csport &= ~cspinmask;
 	(void)spi->transfer(c);
 	*csport |= cspinmask;
+	bytes_sent++;
 }
 
+// Only sends the column span of each page that has been drawn into since last time.
+// Each page is one CS transaction : the address commands then the data.
+// transfer() waits for each byte to finish so DC can be changed with CS held.
 void Catmacey_SH1106::display(void) {
-	sh1106_command(SH1106_SETSTARTLINE); // Set start line
-	// SPI
-	uint16_t idx = 0;
-	uint8_t col = 0;
-	uint8_t page = 0;
-	for(page=SH1106_PAGEADDR; page < (SH1106_PAGEADDR+SH1106_PAGES); page++){
-		// Autoincrement of column does not move onto next page
-		// so each horizontal stripe (page) has to be zeroed before writing
-		sh1106_command(page); // Set page addr
-		sh1106_command(SH1106_SETLOWCOLUMN); // Lower col addr 0
-		sh1106_command(SH1106_SETHIGHCOLUMN); // Upper col addr 0    
+	uint8_t page, col, last, idx, len;
+	uint8_t cmd[4];
+	boolean first = true;
+	register uint8_t *pBuf;
+
+	while(flushing); // Let any DMA flush finish first
+
+	for(page=0; page < SH1106_PAGES; page++){
+		col = dirty_first[page];
+		last = dirty_last[page];
+		if(col > last) continue; // Nothing changed on this page
+		dirty_first[page] = 0xff;
+		dirty_last[page] = 0;
+
+		len = pageCommands(cmd, page, col, first);
+		first = false;
 		*csport |= cspinmask;
-		*dcport |= dcpinmask;
+		*dcport &= ~dcpinmask;
 		*csport &= ~cspinmask;
-		for (col=0; col<(SH1106_LCDWIDTH); col++) {
-			(void)spi->transfer(buffer[idx++]);
+		for(idx=0; idx < len; idx++){
+			(void)spi->transfer(cmd[idx]);
 		}
+		*dcport |= dcpinmask;
+		pBuf = &buffer[page * SH1106_LCDWIDTH + col];
+		bytes_sent += len + (last - col) + 1;
+		do {
+			(void)spi->transfer(*pBuf++);
+		} while(col++ != last);
+		*csport |= cspinmask;
+	}
+}
+
+// Optional : Lets displayAsync() send by DMA straight into the SPI buffer.
+// regs and txirq are those of the DSPI port, eg. _DSPI0_BASE and _DSPI0_TX_IRQ.
+// The interrupt handler for the DMA channel must call dmaInterrupt()
+void Catmacey_SH1106::beginAsync(p32_spi *regs, uint8_t txirq, uint8_t chn) {
+	spiregs = regs;
+	dmachn = chn;
+	DmaChnOpen((DmaChannel)chn, DMA_CHN_PRI0, DMA_OPEN_DEFAULT);
+	// After the first byte each one is pulled in by the SPI transmit buffer emptying
+	DmaChnSetEventControl((DmaChannel)chn, DMA_EV_START_IRQ_EN | DMA_EV_START_IRQ(txirq));
+	DmaChnSetEvEnableFlags((DmaChannel)chn, DMA_EV_BLOCK_DONE);
+	// Lowest priority. The audio must always be able to preempt this
+	INTSetVectorPriority(INT_VECTOR_DMA((DmaChannel)chn), INT_PRIORITY_LEVEL_1);
+	INTSetVectorSubPriority(INT_VECTOR_DMA((DmaChannel)chn), INT_SUB_PRIORITY_LEVEL_0);
+	INTClearFlag(INT_SOURCE_DMA((DmaChannel)chn));
+	INTEnable(INT_SOURCE_DMA((DmaChannel)chn), INT_ENABLED);
+}
+
+// Starts sending the dirty spans and returns without waiting.
+// They are copied into a front buffer first so drawing can carry on.
+// Returns false if the last flush is still going. What's dirty stays dirty
+// and goes next time. Falls back to display() without beginAsync()
+boolean Catmacey_SH1106::displayAsync(void) {
+	uint8_t page, col, last;
+	uint16_t offset;
+	FlushPage_t *fp;
+
+	if(spiregs == NULL){
+		display();
+		return true;
+	}
+	if(flushing) return false;
+
+	flush_count = 0;
+	for(page=0; page < SH1106_PAGES; page++){
+		col = dirty_first[page];
+		last = dirty_last[page];
+		if(col > last) continue; // Nothing changed on this page
+		dirty_first[page] = 0xff;
+		dirty_last[page] = 0;
+
+		fp = &flush_pages[flush_count];
+		fp->cmdlen = pageCommands(fp->cmd, page, col, flush_count == 0);
+		offset = page * SH1106_LCDWIDTH + col;
+		fp->datalen = last - col + 1;
+		fp->data = &front[offset];
+		memcpy(fp->data, &buffer[offset], fp->datalen);
+		bytes_sent += fp->cmdlen + fp->datalen;
+		flush_count++;
+	}
+	if(flush_count == 0) return true;
+
+	flush_idx = 0;
+	flushing = true;
+	flushPage();
+	return true;
+}
+
+// True while a displayAsync() is still sending
+boolean Catmacey_SH1106::isFlushing(void) const {
+	return flushing;
+}
+
+// Call from the interrupt handler of the DMA channel given to beginAsync()
+void Catmacey_SH1106::dmaInterrupt(void) {
+	DmaChnClrEvFlags((DmaChannel)dmachn, DMA_EV_ALL_EVNTS);
+	INTClearFlag(INT_SOURCE_DMA((DmaChannel)dmachn));
+
+	// The block is done once the last byte is in the SPI buffer. It has to
+	// shift out before DC or CS move. At most 2 bytes : ~1.6uS at 10MHz
+	while(spiregs->sxStat.reg & SPISTAT_BUSY);
+	// Nothing reads MISO. Drain it so a later blocking transfer() doesn't
+	// return early on a stale byte
+	while(spiregs->sxStat.reg & SPISTAT_RBF) (void)spiregs->sxBuf.reg;
+	spiregs->sxStat.clr = SPISTAT_ROV;
+
+	if(!flush_data){
+		// Commands are out, now the data
+		*dcport |= dcpinmask;
+		flush_data = 1;
+		dmaSend(flush_pages[flush_idx].data, flush_pages[flush_idx].datalen);
+	}else{
 		*csport |= cspinmask;
+		if(++flush_idx < flush_count){
+			flushPage();
+		}else{
+			flushing = false;
+		}
 	}
 }
 
+// Opens the CS transaction for flush_pages[flush_idx] and sends its commands
+void Catmacey_SH1106::flushPage(void) {
+	*dcport &= ~dcpinmask;
+	*csport &= ~cspinmask;
+	flush_data = 0;
+	dmaSend(flush_pages[flush_idx].cmd, flush_pages[flush_idx].cmdlen);
+}
+
+// Hands len bytes to the DMA. The first is forced, the SPI pulls the rest
+void Catmacey_SH1106::dmaSend(const void *src, uint8_t len) {
+	DmaChnSetTxfer((DmaChannel)dmachn, src, (void *)&spiregs->sxBuf.reg, len, 1, 1);
+	DmaChnStartTxfer((DmaChannel)dmachn, DMA_WAIT_NOT, 0);
+}
+
+// Mark the whole buffer to be sent by the next display()
+void Catmacey_SH1106::invalidate(void) {
+	memset(dirty_first, 0, SH1106_PAGES);
+	memset(dirty_last, SH1106_LCDWIDTH - 1, SH1106_PAGES);
+}
+
+// Bytes clocked out so far. Take the difference between two reads
+uint32_t Catmacey_SH1106::getBytesSent(void) const {
+	return bytes_sent;
+}
+
 // clear everything
+// Only the bytes that were lit need sending again
 void Catmacey_SH1106::clearDisplay(void) {
+	uint8_t page, col;
+	register uint8_t *pBuf = buffer;
+
+	for(page=0; page < SH1106_PAGES; page++){
+		for(col=0; col < SH1106_LCDWIDTH; col++){
+			if(*pBuf++) markDirty(page, col, col);
+		}
+	}
 	memset(buffer, 0, (SH1106_LCDWIDTH*SH1106_LCDHEIGHT/8));
 }
 
+// Text fast path : drawChar() hands over each strip of a glyph here.
+// Font column bytes are laid out the same as a page so each one is shifted
+// into the one or two pages it covers rather than drawn a pixel at a time.
+// Colors other than WHITE are drawn as black, same as drawPixel().
+void Catmacey_SH1106::drawColumnBytes(int16_t x, int16_t y, const uint8_t *cols, uint8_t w, uint8_t h, uint16_t color, uint16_t bg) {
+	uint8_t page, shift, col;
+	uint16_t rows, dots, touch, set;
+	boolean opaque = (bg != color);
+	boolean fgwhite = (color == WHITE);
+	boolean bgwhite = opaque && (bg == WHITE);
+	register uint8_t *pBuf;
+
+	// Only the usual orientation and on screen glyphs take the fast path
+	if(rotation != 0 || y < 0){
+		Adafruit_GFX::drawColumnBytes(x, y, cols, w, h, color, bg);
+		return;
+	}
+	if(y >= HEIGHT || x >= WIDTH || (x + w) <= 0) return;
+
+	// Clip the sides
+	if(x < 0){
+		cols -= x;
+		w += x;
+		x = 0;
+	}
+	if((x + w) > WIDTH){
+		w = WIDTH - x;
+	}
+
+	page = y / 8;
+	shift = y & 7;
+	rows = ((1 << h) - 1) << shift;
+	pBuf = &buffer[page * SH1106_LCDWIDTH + x];
+
+	for(col=0; col < w; col++){
+		dots = ((uint16_t)cols[col] << shift) & rows;
+		// Transparent text only touches the glyph's own pixels
+		touch = opaque ? rows : dots;
+		set = 0;
+		if(fgwhite) set |= dots;
+		if(bgwhite) set |= ~dots;
+		set &= touch;
+		pBuf[col] = (pBuf[col] & ~touch) | set;
+		// Rows that spill into the next page
+		if((touch >> 8) && page < (SH1106_PAGES - 1)){
+			pBuf[col + SH1106_LCDWIDTH] = (pBuf[col + SH1106_LCDWIDTH] & ~(touch >> 8)) | (set >> 8);
+		}
+	}
+
+	markDirty(page, x, x + w - 1);
+	if((rows >> 8) && page < (SH1106_PAGES - 1)){
+		markDirty(page + 1, x, x + w - 1);
+	}
+}
+
 // This is exactly the same as in Adafruit_SSD1306
 void Catmacey_SH1106::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
 	boolean bSwap = false;
@@ -242,12 +496,14 @@ void Catmacey_SH1106::drawFastHLineInternal(int16_t x, int16_t y, int16_t w, uin
 
 	// make sure we don't go off the edge of the display
 	if( (x + w) > WIDTH) { 
-		w = (HEIGHT- x);
+		w = (WIDTH - x);
 	}
 
 	// if our width is now negative, punt
 	if(w <= 0) { return; }
 
+	markDirty(y/8, x, x + w - 1);
+
 	// set up the pointer for  movement through the buffer
 	register uint8_t *pBuf = buffer;
 	// adjust the buffer pointer for the current row
@@ -416,6 +672,11 @@ void Catmacey_SH1106::drawFastVLineInternal(int16_t x, int16_t __y, int16_t __h,
 	// this display doesn't need ints for coordinates, use local byte registers for faster juggling
 	register uint8_t y = __y;
 	register uint8_t h = __h;
+	register uint8_t mod;
+
+	for(mod = y/8; mod <= (y + h - 1)/8; mod++){
+		markDirty(mod, x, x);
+	}
 
 
 	// set up the pointer for fast movement through the buffer
@@ -426,7 +687,7 @@ void Catmacey_SH1106::drawFastVLineInternal(int16_t x, int16_t __y, int16_t __h,
 	pBuf += x;
 
 	// do the first partial byte, if necessary - this requires some masking
-	register uint8_t mod = (y&7);
+	mod = (y&7);
 	if(mod) {
 		// mask off the high n bits we want to set 
 		mod = 8-mod;
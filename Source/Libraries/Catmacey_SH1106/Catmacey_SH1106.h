@@ -10,6 +10,8 @@ Only 4 SPI + Reset is supported.
   RST : Reset
 
 Built to run on Chipkit and use the DSPI library.
+display() sends the frame a byte at a time. Once beginAsync() has been called
+displayAsync() hands it to a DMA channel and returns straight away.
 
 Adapted from the Adafruit SSD1306 driver.
 The SSD1306 and SH1106 are very similar but have a few important differences.
@@ -72,6 +74,7 @@ typedef volatile uint32_t PortMask;
 
 #define SH1106_SETLOWCOLUMN 0x02
 #define SH1106_SETHIGHCOLUMN 0x10
+#define SH1106_COLUMNOFFSET 2 // The 128 pixel panel sits in the middle of the 132 column RAM
 
 #define SH1106_SETSTARTLINE 0x40
 
@@ -102,12 +105,18 @@ class Catmacey_SH1106 : public Adafruit_GFX {
 	);
 
 	void begin();
+	void beginAsync(p32_spi *regs, uint8_t txirq, uint8_t dmachn);
 	void sh1106_command(uint8_t c);
 	void sh1106_data(uint8_t c);
 
 	void clearDisplay(void);
 	void invertDisplay(uint8_t i);
 	void display();
+	boolean displayAsync();
+	boolean isFlushing(void) const;
+	void dmaInterrupt(void);
+	void invalidate(void);
+	uint32_t getBytesSent(void) const;
 
 	void setContrast(uint8_t contrast);
 
@@ -115,6 +124,7 @@ class Catmacey_SH1106 : public Adafruit_GFX {
 
 	virtual void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
 	virtual void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
+	virtual void drawColumnBytes(int16_t x, int16_t y, const uint8_t *cols, uint8_t w, uint8_t h, uint16_t color, uint16_t bg);
 
  private:
 	int8_t dc, rst, cs;
@@ -122,6 +132,12 @@ class Catmacey_SH1106 : public Adafruit_GFX {
 	PortReg *csport, *dcport;
 	PortMask cspinmask, dcpinmask;
 
+	p32_spi *spiregs; // NULL until beginAsync()
+	uint8_t dmachn;
+
+	void flushPage(void);
+	void dmaSend(const void *src, uint8_t len);
+
 	inline void drawFastVLineInternal(int16_t x, int16_t y, int16_t h, uint16_t color) __attribute__((always_inline));
 	inline void drawFastHLineInternal(int16_t x, int16_t y, int16_t w, uint16_t color) __attribute__((always_inline));
 